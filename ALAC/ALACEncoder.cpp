@@ -102,6 +102,10 @@ static const uint32_t sSupportediPodSampleRates[] =
 ALACEncoder::ALACEncoder() :
 	mBitDepth( 0 ),
     mFastMode( 0 ),
+	mPBFactorSearch( false ),
+	mAGMb( MB0 ),
+	mAGPb( PB0 ),
+	mAGKb( KB0 ),
 	mMixBufferU( nil ),
 	mMixBufferV( nil ),
 	mPredictorU( nil ),
@@ -267,6 +271,7 @@ int32_t ALACEncoder::EncodeStereo( BitBuffer * bitstream, void * inputBuffer, ui
 {
 	BitBuffer		workBits;
 	BitBuffer		startBits = *bitstream;			// squirrel away copy of current state in case we need to go back and do an escape packet
+	BitBuffer		pbBitsU, pbBitsV;
 	AGParamRec		agParams;
 	uint32_t          bits1, bits2;
 	uint32_t			dilate;
@@ -274,7 +279,7 @@ int32_t ALACEncoder::EncodeStereo( BitBuffer * bitstream, void * inputBuffer, ui
 	uint32_t			minBits, minBits1, minBits2;
 	uint32_t			numU, numV;
 	uint32_t			mode;
-	uint32_t			pbFactor;
+	uint32_t			pbFactor, pbFactorU, pbFactorV;
 	uint32_t			chanBits;
 	uint32_t			denShift;
 	uint8_t			bytesShifted;
@@ -356,11 +361,11 @@ int32_t ALACEncoder::EncodeStereo( BitBuffer * bitstream, void * inputBuffer, ui
         pc_block( mMixBufferV, mPredictorV, numSamples/dilate, coefsV[numV - 1], numV, chanBits, DENSHIFT_DEFAULT );
 
         // run the lossless compressor on each channel
-        set_ag_params( &agParams, MB0, (pbFactor * PB0) / 4, KB0, numSamples/dilate, numSamples/dilate, MAX_RUN_DEFAULT );
+        set_ag_params( &agParams, mAGMb, (pbFactor * mAGPb) / 4, mAGKb, numSamples/dilate, numSamples/dilate, MAX_RUN_DEFAULT );
         status = dyn_comp( &agParams, mPredictorU, &workBits, numSamples/dilate, chanBits, &bits1 );
         RequireNoErr( status, goto Exit; );
 
-        set_ag_params( &agParams, MB0, (pbFactor * PB0) / 4, KB0, numSamples/dilate, numSamples/dilate, MAX_RUN_DEFAULT );
+        set_ag_params( &agParams, mAGMb, (pbFactor * mAGPb) / 4, mAGKb, numSamples/dilate, numSamples/dilate, MAX_RUN_DEFAULT );
         status = dyn_comp( &agParams, mPredictorV, &workBits, numSamples/dilate, chanBits, &bits2 );
         RequireNoErr( status, goto Exit; );
 
@@ -415,7 +420,7 @@ int32_t ALACEncoder::EncodeStereo( BitBuffer * bitstream, void * inputBuffer, ui
 
 		dilate = 8;
 
-		set_ag_params( &agParams, MB0, (pbFactor * PB0)/4, KB0, numSamples/dilate, numSamples/dilate, MAX_RUN_DEFAULT );
+		set_ag_params( &agParams, mAGMb, (pbFactor * mAGPb) / 4, mAGKb, numSamples/dilate, numSamples/dilate, MAX_RUN_DEFAULT );
 		status = dyn_comp( &agParams, mPredictorU, &workBits, numSamples/dilate, chanBits, &bits1 );
 
 		if ( (bits1 * dilate + 16 * numUV) < minBits1 )
@@ -424,7 +429,7 @@ int32_t ALACEncoder::EncodeStereo( BitBuffer * bitstream, void * inputBuffer, ui
 			numU = numUV;
 		}
 
-		set_ag_params( &agParams, MB0, (pbFactor * PB0)/4, KB0, numSamples/dilate, numSamples/dilate, MAX_RUN_DEFAULT );
+		set_ag_params( &agParams, mAGMb, (pbFactor * mAGPb) / 4, mAGKb, numSamples/dilate, numSamples/dilate, MAX_RUN_DEFAULT );
 		status = dyn_comp( &agParams, mPredictorV, &workBits, numSamples/dilate, chanBits, &bits2 );
 
 		if ( (bits2 * dilate + 16 * numUV) < minBits2 )
@@ -458,11 +463,13 @@ int32_t ALACEncoder::EncodeStereo( BitBuffer * bitstream, void * inputBuffer, ui
 		//Assert( (pbFactor < 8) && (numV < 32) );
 
 		BitBufferWrite( bitstream, (mode << 4) | DENSHIFT_DEFAULT, 8 );
+		pbBitsU = *bitstream;
 		BitBufferWrite( bitstream, (pbFactor << 5) | numU, 8 );
 		for ( index = 0; index < numU; index++ )
 			BitBufferWrite( bitstream, coefsU[numU - 1][index], 16 );
 
 		BitBufferWrite( bitstream, (mode << 4) | DENSHIFT_DEFAULT, 8 );
+		pbBitsV = *bitstream;
 		BitBufferWrite( bitstream, (pbFactor << 5) | numV, 8 );
 		for ( index = 0; index < numV; index++ )
 			BitBufferWrite( bitstream, coefsV[numV - 1][index], 16 );
@@ -496,7 +503,15 @@ int32_t ALACEncoder::EncodeStereo( BitBuffer * bitstream, void * inputBuffer, ui
 			pc_block( mPredictorV, mPredictorU, numSamples, nil, 31, chanBits, 0 );
 		}
 
-		set_ag_params( &agParams, MB0, (pbFactor * PB0) / 4, KB0, numSamples, numSamples, MAX_RUN_DEFAULT );
+		// the header bytes are already out, patch in the chosen pbFactor
+		pbFactorU = pbFactor;
+		if ( mPBFactorSearch )
+		{
+			pbFactorU = SearchPBFactor( mPredictorU, numSamples, chanBits );
+			BitBufferWrite( &pbBitsU, (pbFactorU << 5) | numU, 8 );
+		}
+
+		set_ag_params( &agParams, mAGMb, (pbFactorU * mAGPb) / 4, mAGKb, numSamples, numSamples, MAX_RUN_DEFAULT );
 		status = dyn_comp( &agParams, mPredictorU, bitstream, numSamples, chanBits, &bits1 );
 		RequireNoErr( status, goto Exit; );
 
@@ -511,7 +526,14 @@ int32_t ALACEncoder::EncodeStereo( BitBuffer * bitstream, void * inputBuffer, ui
 			pc_block( mPredictorU, mPredictorV, numSamples, nil, 31, chanBits, 0 );
 		}
 
-		set_ag_params( &agParams, MB0, (pbFactor * PB0) / 4, KB0, numSamples, numSamples, MAX_RUN_DEFAULT );
+		pbFactorV = pbFactor;
+		if ( mPBFactorSearch )
+		{
+			pbFactorV = SearchPBFactor( mPredictorV, numSamples, chanBits );
+			BitBufferWrite( &pbBitsV, (pbFactorV << 5) | numV, 8 );
+		}
+
+		set_ag_params( &agParams, mAGMb, (pbFactorV * mAGPb) / 4, mAGKb, numSamples, numSamples, MAX_RUN_DEFAULT );
 		status = dyn_comp( &agParams, mPredictorV, bitstream, numSamples, chanBits, &bits2 );
 		RequireNoErr( status, goto Exit; );
 
@@ -669,14 +691,14 @@ int32_t ALACEncoder::EncodeStereoFast( BitBuffer * bitstream, void * inputBuffer
 	// - note: we always use mode 0 in the "fast" path so we don't need the code for mode != 0
 	pc_block( mMixBufferU, mPredictorU, numSamples, coefsU[numU - 1], numU, chanBits, DENSHIFT_DEFAULT );
 
-	set_ag_params( &agParams, MB0, (pbFactor * PB0) / 4, KB0, numSamples, numSamples, MAX_RUN_DEFAULT );
+	set_ag_params( &agParams, mAGMb, (pbFactor * mAGPb) / 4, mAGKb, numSamples, numSamples, MAX_RUN_DEFAULT );
 	status = dyn_comp( &agParams, mPredictorU, bitstream, numSamples, chanBits, &bits1 );
 	RequireNoErr( status, goto Exit; );
 
 	// run the dynamic predictor and lossless compression for the "right" channel
 	pc_block( mMixBufferV, mPredictorV, numSamples, coefsV[numV - 1], numV, chanBits, DENSHIFT_DEFAULT );
 
-	set_ag_params( &agParams, MB0, (pbFactor * PB0) / 4, KB0, numSamples, numSamples, MAX_RUN_DEFAULT );
+	set_ag_params( &agParams, mAGMb, (pbFactor * mAGPb) / 4, mAGKb, numSamples, numSamples, MAX_RUN_DEFAULT );
 	status = dyn_comp( &agParams, mPredictorV, bitstream, numSamples, chanBits, &bits2 );
 	RequireNoErr( status, goto Exit; );
 
@@ -728,6 +750,33 @@ Exit:
 	return status;
 }
 
+/*
+	SearchPBFactor()
+	- pick the pbFactor (adaptation rate of the AG coder) that codes the given residuals in the fewest bits
+	- 0 is never chosen: with a zero rate the running mean can get stuck at 0
+*/
+uint32_t ALACEncoder::SearchPBFactor( int32_t * predictor, uint32_t numSamples, uint32_t chanBits )
+{
+	AGParamRec		agParams;
+	uint32_t			bestFactor = 4;
+	uint32_t			minBits = 1ul << 31;
+
+	for ( uint32_t factor = 1; factor < 8; factor++ )
+	{
+		uint32_t			numBits;
+
+		set_ag_params( &agParams, mAGMb, (factor * mAGPb) / 4, mAGKb, numSamples, numSamples, MAX_RUN_DEFAULT );
+		numBits = dyn_comp_bits( &agParams, predictor, numSamples, chanBits );
+		// prefer the default on a tie
+		if ( numBits < minBits || (numBits == minBits && factor == 4) )
+		{
+			minBits = numBits;
+			bestFactor = factor;
+		}
+	}
+	return bestFactor;
+}
+
 /*
 	EncodeStereoEscape()
 	- encode stereo escape frame
@@ -799,6 +848,7 @@ int32_t ALACEncoder::EncodeStereoEscape( BitBuffer * bitstream, void * inputBuff
 int32_t ALACEncoder::EncodeMono( BitBuffer * bitstream, void * inputBuffer, uint32_t stride, uint32_t channelIndex, uint32_t numSamples )
 {
 	BitBuffer		startBits = *bitstream;			// squirrel away copy of current state in case we need to go back and do an escape packet
+	BitBuffer		pbBitsU;
 	AGParamRec		agParams;
 	uint32_t	bits1;
 	uint32_t			numU;
@@ -907,7 +957,7 @@ int32_t ALACEncoder::EncodeMono( BitBuffer * bitstream, void * inputBuffer, uint
 		dilate = 8;
 		pc_block( mMixBufferU, mPredictorU, numSamples/dilate, coefsU[numU-1], numU, chanBits, DENSHIFT_DEFAULT );
 
-		set_ag_params( &agParams, MB0, (pbFactor * PB0) / 4, KB0, numSamples/dilate, numSamples/dilate, MAX_RUN_DEFAULT );
+		set_ag_params( &agParams, mAGMb, (pbFactor * mAGPb) / 4, mAGKb, numSamples/dilate, numSamples/dilate, MAX_RUN_DEFAULT );
 		status = dyn_comp( &agParams, mPredictorU, &workBits, numSamples/dilate, chanBits, &bits1 );
 		RequireNoErr( status, goto Exit; );
 
@@ -941,6 +991,7 @@ int32_t ALACEncoder::EncodeMono( BitBuffer * bitstream, void * inputBuffer, uint
 		// write the params and predictor coefs
 		numU = bestU;
 		BitBufferWrite( bitstream, (0 << 4) | DENSHIFT_DEFAULT, 8 );	// modeU = 0
+		pbBitsU = *bitstream;
 		BitBufferWrite( bitstream, (pbFactor << 5) | numU, 8 );
 		for ( index = 0; index < numU; index++ )
 			BitBufferWrite( bitstream, coefsU[numU-1][index], 16 );
@@ -955,8 +1006,15 @@ int32_t ALACEncoder::EncodeMono( BitBuffer * bitstream, void * inputBuffer, uint
 		// run the dynamic predictor with the best result
 		pc_block( mMixBufferU, mPredictorU, numSamples, coefsU[numU-1], numU, chanBits, DENSHIFT_DEFAULT );
 
+		// the header byte is already out, patch in the chosen pbFactor
+		if ( mPBFactorSearch )
+		{
+			pbFactor = (uint8_t) SearchPBFactor( mPredictorU, numSamples, chanBits );
+			BitBufferWrite( &pbBitsU, (pbFactor << 5) | numU, 8 );
+		}
+
 		// do lossless compression
-		set_standard_ag_params( &agParams, numSamples, numSamples );
+		set_ag_params( &agParams, mAGMb, (pbFactor * mAGPb) / 4, mAGKb, numSamples, numSamples, MAX_RUN_DEFAULT );
 		status = dyn_comp( &agParams, mPredictorU, bitstream, numSamples, chanBits, &bits1 );
 		//AssertNoErr( status );
 
@@ -1197,9 +1255,9 @@ void ALACEncoder::GetConfig( ALACSpecificConfig & config )
 	config.frameLength			= Swap32NtoB(mFrameSize);
 	config.compatibleVersion	= (uint8_t) kALACCompatibleVersion;
 	config.bitDepth				= (uint8_t) mBitDepth;
-	config.pb					= (uint8_t) PB0;
-	config.kb					= (uint8_t) KB0;
-	config.mb					= (uint8_t) MB0;
+	config.pb					= (uint8_t) mAGPb;
+	config.kb					= (uint8_t) mAGKb;
+	config.mb					= (uint8_t) mAGMb;
 	config.numChannels			= (uint8_t) mNumChannels;
 	config.maxRun				= Swap16NtoB((uint16_t) MAX_RUN_DEFAULT);
 	config.maxFrameBytes		= Swap32NtoB(mMaxFrameBytes);
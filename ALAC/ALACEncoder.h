@@ -47,6 +47,12 @@ class ALACEncoder
 		// this must be called *before* InitializeEncoder()
 		void				SetFrameSize( uint32_t frameSize ) { mFrameSize = frameSize; };
 
+		// file-level adaptive Golomb parameters, written to the magic cookie
+		// - must be set before GetMagicCookie() and not changed afterwards
+		void				SetAGParams( uint32_t mb, uint32_t pb, uint32_t kb ) { mAGMb = mb; mAGPb = pb; mAGKb = kb; };
+		// choose pbFactor for each channel of each frame instead of the fixed 4
+		void				SetPBFactorSearch( bool search ) { mPBFactorSearch = search; };
+
 		void				GetConfig( ALACSpecificConfig & config );
         uint32_t            GetMagicCookieSize(uint32_t inNumChannels);
         void				GetMagicCookie( void * config, uint32_t * ioSize ); 
@@ -60,11 +66,16 @@ class ALACEncoder
 		int32_t			EncodeStereoFast( struct BitBuffer * bitstream, void * input, uint32_t stride, uint32_t channelIndex, uint32_t numSamples );
 		int32_t			EncodeStereoEscape( struct BitBuffer * bitstream, void * input, uint32_t stride, uint32_t numSamples );
 		int32_t			EncodeMono( struct BitBuffer * bitstream, void * input, uint32_t stride, uint32_t channelIndex, uint32_t numSamples );
+		uint32_t			SearchPBFactor( int32_t * predictor, uint32_t numSamples, uint32_t chanBits );
 
 
 		// ALAC encoder parameters
 		int16_t					mBitDepth;
 		bool					mFastMode;
+		bool					mPBFactorSearch;
+		uint32_t				mAGMb;
+		uint32_t				mAGPb;
+		uint32_t				mAGKb;
 
 		// encoding state
 		int16_t					mLastMixRes[kALACMaxChannels];
@@ -71,6 +71,7 @@ void	set_standard_ag_params(AGParamRecPtr params, uint32_t fullwidth, uint32_t s
 void	set_ag_params(AGParamRecPtr params, uint32_t m, uint32_t p, uint32_t k, uint32_t f, uint32_t s, uint32_t maxrun);
 
 int32_t		dyn_comp(AGParamRecPtr params, int32_t * pc, struct BitBuffer * bitstream, int32_t numSamples, int32_t bitSize, uint32_t * outNumBits);
+uint32_t	dyn_comp_bits(AGParamRecPtr params, int32_t * pc, int32_t numSamples, int32_t bitSize);
 int32_t		dyn_decomp(AGParamRecPtr params, struct BitBuffer * bitstream, int32_t * pc, int32_t numSamples, int32_t maxSize, uint32_t * outNumBits);
 
 
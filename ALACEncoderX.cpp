@@ -1,8 +1,10 @@
 #include "ALACEncoderX.h"
 #include "cautil.h"
+#include <aglib.h>
 
 ALACEncoderX::ALACEncoderX(const AudioStreamBasicDescription &desc)
-    : m_encoder(new ALACEncoder()), m_iasbd(desc)
+    : m_encoder(new ALACEncoder()), m_iasbd(desc),
+      m_fast_mode(false), m_variable_frame_length(false)
 {
     std::memcpy(&m_iafd, &desc, sizeof desc);
     m_iafd.mBytesPerFrame =
@@ -39,29 +41,184 @@ ALACEncoderX::ALACEncoderX(const AudioStreamBasicDescription &desc)
     m_output_buffer.resize(pullbytes * 2);
 }
 
+void ALACEncoderX::setVariableFrameLength(bool enable)
+{
+    m_variable_frame_length = enable;
+    /* room for 1 + 2 + 4 candidate packets */
+    size_t size = m_iasbd.mBytesPerFrame * kALACDefaultFramesPerPacket * 2;
+    m_output_buffer.resize(enable ? size * 7 : size);
+}
+
 uint32_t ALACEncoderX::encodeChunk(UInt32 npackets)
 {
     unsigned n = 0;
     for (n = 0; n < npackets; ++n) {
-        size_t nsamples = readSamplesFull(src(), &m_input_buffer[0],
-                                          kALACDefaultFramesPerPacket);
+        size_t nsamples = readInput(src(), &m_input_buffer[0],
+                                    kALACDefaultFramesPerPacket);
         if (nsamples == 0)
             break;
-        size_t nbytes = nsamples * m_iasbd.mBytesPerFrame;
-        if (m_iafd.mBytesPerFrame < m_iasbd.mBytesPerFrame)
-            util::pack(&m_input_buffer[0], &nbytes,
-                       m_iasbd.mBytesPerFrame / m_iasbd.mChannelsPerFrame,
-                       m_iafd.mBytesPerFrame / m_iafd.mChannelsPerFrame);
-
-        int32_t xbytes = static_cast<int32_t>(nbytes);
-        m_encoder->Encode(m_iafd, m_odesc.afd, &m_input_buffer[0],
-                          &m_output_buffer[0], &xbytes);
-        m_sink->writeSamples(&m_output_buffer[0], xbytes, nsamples);
-        m_stat.updateWritten(nsamples, xbytes);
+        if (m_variable_frame_length &&
+            nsamples == kALACDefaultFramesPerPacket)
+            encodeVariable();
+        else {
+            uint32_t xbytes = encodePacket(&m_input_buffer[0], nsamples,
+                                           &m_output_buffer[0]);
+            writePacket(&m_output_buffer[0], xbytes, nsamples);
+        }
     }
     return n;
 }
 
+/*
+ * Encode sampled packets with candidate mb/pb/kb, and keep the ones giving
+ * the smallest total. Parameters are searched one at a time (pb first, as
+ * it matters most), starting from the defaults of the reference encoder.
+ * Per-frame pbFactor search is turned on as well, and is also used while
+ * evaluating candidates.
+ * kb is never raised above KB0; larger k would be valid for the reference
+ * decoder, but some decoders assume k <= 14.
+ * src must be seekable, and is rewound to the beginning when done.
+ */
+void ALACEncoderX::tuneAGParams(ISeekableSource *src)
+{
+    const uint32_t n = kALACDefaultFramesPerPacket;
+    const unsigned max_blocks = 16;
+
+    std::vector<uint8_t> samples(max_blocks * n * m_iasbd.mBytesPerFrame);
+    std::vector<uint32_t> lengths;
+    uint64_t length = src->length();
+    bool spread = length != ~0ULL && length >= n * max_blocks * 2;
+    for (unsigned i = 0; i < max_blocks; ++i) {
+        if (spread)
+            src->seekTo(length * (2 * i + 1) / (2 * max_blocks));
+        uint8_t *bp = &samples[lengths.size() * n * m_iafd.mBytesPerFrame];
+        size_t nsamples = readInput(src, bp, n);
+        if (nsamples == 0)
+            break;
+        lengths.push_back(nsamples);
+    }
+    src->seekTo(0);
+    if (lengths.empty())
+        return;
+
+    std::vector<uint8_t> output(m_output_buffer.size());
+    auto cost = [&](const uint32_t *params) -> uint64_t {
+        ALACEncoder encoder;
+        encoder.SetFastMode(m_fast_mode);
+        encoder.SetAGParams(params[0], params[1], params[2]);
+        encoder.SetPBFactorSearch(true);
+        CHECKCA(encoder.InitializeEncoder(m_odesc.afd));
+        uint64_t total = 0;
+        for (size_t i = 0; i < lengths.size(); ++i) {
+            int32_t xbytes = lengths[i] * m_iafd.mBytesPerFrame;
+            encoder.Encode(m_iafd, m_odesc.afd,
+                           &samples[i * n * m_iafd.mBytesPerFrame],
+                           &output[0], &xbytes);
+            total += xbytes;
+        }
+        return total;
+    };
+    static const uint32_t mb_tab[] = { 2, 5, 10, 20, 40, 0 };
+    static const uint32_t pb_tab[] = { 16, 24, 32, 40, 48, 56, 64, 80, 0 };
+    static const uint32_t kb_tab[] = { 10, 11, 12, 13, 14, 0 };
+    /* index into params[] (mb, pb, kb), in search order */
+    static const struct {
+        unsigned index;
+        const uint32_t *values;
+    } search[] = { { 1, pb_tab }, { 0, mb_tab }, { 2, kb_tab } };
+
+    uint32_t best[3] = { MB0, PB0, KB0 };
+    uint64_t best_cost = cost(best);
+    for (size_t i = 0; i < util::sizeof_array(search); ++i) {
+        uint32_t params[3];
+        std::memcpy(params, best, sizeof params);
+        for (const uint32_t *vp = search[i].values; *vp; ++vp) {
+            if (*vp == best[search[i].index])
+                continue;
+            params[search[i].index] = *vp;
+            uint64_t c = cost(params);
+            if (c < best_cost) {
+                best_cost = c;
+                std::memcpy(best, params, sizeof best);
+            }
+        }
+    }
+    m_encoder->SetAGParams(best[0], best[1], best[2]);
+    m_encoder->SetPBFactorSearch(true);
+}
+
+size_t ALACEncoderX::readInput(ISource *src, uint8_t *buffer, size_t nsamples)
+{
+    nsamples = readSamplesFull(src, buffer, nsamples);
+    size_t nbytes = nsamples * m_iasbd.mBytesPerFrame;
+    if (m_iafd.mBytesPerFrame < m_iasbd.mBytesPerFrame)
+        util::pack(buffer, &nbytes,
+                   m_iasbd.mBytesPerFrame / m_iasbd.mChannelsPerFrame,
+                   m_iafd.mBytesPerFrame / m_iafd.mChannelsPerFrame);
+    return nsamples;
+}
+
+uint32_t ALACEncoderX::encodePacket(uint8_t *input, uint32_t nsamples,
+                                    uint8_t *output)
+{
+    int32_t xbytes = nsamples * m_iafd.mBytesPerFrame;
+    m_encoder->Encode(m_iafd, m_odesc.afd, input, output, &xbytes);
+    return xbytes;
+}
+
+void ALACEncoderX::writePacket(const uint8_t *data, uint32_t nbytes,
+                               uint32_t nsamples)
+{
+    m_sink->writeSamples(data, nbytes, nsamples);
+    m_stat.updateWritten(nsamples, nbytes);
+}
+
+/*
+ * Encode the block as 1 x 4096, 2 x 2048 and 4 x 1024 frames, and write
+ * the smallest partition. Each half of the block is decided separately,
+ * therefore 4096, 2048+2048, 2048+1024+1024, 1024+1024+2048 and
+ * 4 x 1024 are the possible outcomes.
+ * Shorter frames are written as ALAC partial frames, whose header
+ * carries the frame length.
+ */
+void ALACEncoderX::encodeVariable()
+{
+    const uint32_t n = kALACDefaultFramesPerPacket;
+    const size_t slot = m_output_buffer.size() / 7;
+    uint8_t *ip = &m_input_buffer[0];
+    uint8_t *op = &m_output_buffer[0];
+    uint32_t bpf = m_iafd.mBytesPerFrame;
+
+    uint32_t whole = encodePacket(ip, n, op);
+    uint32_t half[2], quarter[4];
+    for (unsigned i = 0; i < 2; ++i)
+        half[i] = encodePacket(ip + i * n / 2 * bpf, n / 2,
+                               op + (1 + i) * slot);
+    for (unsigned i = 0; i < 4; ++i)
+        quarter[i] = encodePacket(ip + i * n / 4 * bpf, n / 4,
+                                  op + (3 + i) * slot);
+
+    bool split[2];
+    uint32_t total = 0;
+    for (unsigned i = 0; i < 2; ++i) {
+        uint32_t q = quarter[2 * i] + quarter[2 * i + 1];
+        split[i] = q < half[i];
+        total += split[i] ? q : half[i];
+    }
+    if (whole <= total) {
+        writePacket(op, whole, n);
+        return;
+    }
+    for (unsigned i = 0; i < 2; ++i) {
+        if (!split[i])
+            writePacket(op + (1 + i) * slot, half[i], n / 2);
+        else {
+            for (unsigned j = 2 * i; j < 2 * i + 2; ++j)
+                writePacket(op + (3 + j) * slot, quarter[j], n / 4);
+        }
+    }
+}
+
 std::vector<uint8_t> ALACEncoderX::getMagicCookie()
 {
     uint32_t size =
@@ -4,6 +4,7 @@
 #include "IEncoder.h"
 #include <stdint.h>
 #include <ALACEncoder.h>
+#include "util.h"
 
 class ALACEncoderX: public IEncoder, public IEncoderStat {
     union ASBD {
@@ -13,15 +14,23 @@ class ALACEncoderX: public IEncoder, public IEncoderStat {
     std::shared_ptr<ISource> m_src;
     std::shared_ptr<ISink> m_sink;
     std::shared_ptr<ALACEncoder> m_encoder;
-    std::vector<uint8_t> m_input_buffer;
-    std::vector<uint8_t> m_output_buffer;
+    util::PooledBuffer m_input_buffer;
+    util::PooledBuffer m_output_buffer;
     AudioStreamBasicDescription m_iasbd;
     AudioFormatDescription m_iafd;
     ASBD m_odesc;
     EncoderStat m_stat;
+    bool m_fast_mode;
+    bool m_variable_frame_length;
 public:
     ALACEncoderX(const AudioStreamBasicDescription &desc);
-    void setFastMode(bool fast) { m_encoder->SetFastMode(fast); }
+    void setFastMode(bool fast)
+    {
+        m_fast_mode = fast;
+        m_encoder->SetFastMode(fast);
+    }
+    void setVariableFrameLength(bool enable);
+    void tuneAGParams(ISeekableSource *src);
     uint32_t encodeChunk(UInt32 npackets);
     std::vector<uint8_t> getMagicCookie();
     void setSource(const std::shared_ptr<ISource> &source) { m_src = source; }
@@ -56,6 +65,11 @@ public:
         }
         return false;
     }
+private:
+    size_t readInput(ISource *src, uint8_t *buffer, size_t nsamples);
+    uint32_t encodePacket(uint8_t *input, uint32_t nsamples, uint8_t *output);
+    void writePacket(const uint8_t *data, uint32_t nbytes, uint32_t nsamples);
+    void encodeVariable();
 };
 
 #endif
@@ -4,6 +4,7 @@
 #include "CoreAudioToolbox.h"
 #include "AudioConverterXX.h"
 #include "IEncoder.h"
+#include "util.h"
 
 class CoreAudioEncoder: public IEncoder, public IEncoderStat {
     AudioConverterXX m_converter;
@@ -12,7 +13,7 @@ class CoreAudioEncoder: public IEncoder, public IEncoderStat {
     std::shared_ptr<ISource> m_src;
     std::shared_ptr<ISink> m_sink;
     std::shared_ptr<AudioBufferList> m_output_abl;
-    std::vector<uint8_t> m_input_buffer, m_output_buffer;
+    util::PooledBuffer m_input_buffer, m_output_buffer;
     std::vector<AudioStreamPacketDescription> m_packet_desc;
     AudioStreamBasicDescription m_input_desc, m_output_desc;
     EncoderStat m_stat;
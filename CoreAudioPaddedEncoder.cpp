@@ -29,29 +29,6 @@ AudioFilePacketTableInfo CoreAudioPaddedEncoder::getGaplessInfo()
     }
     return pinfo;
 }
-void CoreAudioPaddedEncoder::reverse_buffer(float *data, unsigned nsamples,
-                                            unsigned nchannels)
-{
-    unsigned i = 0, j = nchannels * (nsamples - 1), n;
-    for (; i < j; i += nchannels, j -= nchannels) {
-        for (n = 0; n < nchannels; ++n) {
-            float tmp = data[i + n];
-            data[i + n] = data[j + n];
-            data[j + n] = tmp;
-        }
-    }
-}
-void CoreAudioPaddedEncoder::extrapolate(float *input, size_t ilen,
-                                         float *output, size_t olen)
-{
-    unsigned n = getInputDescription().mChannelsPerFrame;
-    float lpc[LPC_ORDER];
-    for (unsigned i = 0; i < n; ++i) {
-        vorbis_lpc_from_data(input + i, lpc, ilen, LPC_ORDER, n);
-        vorbis_lpc_predict(lpc, &input[i + n * (ilen - LPC_ORDER)],
-                           LPC_ORDER, output + i, olen, n);
-    }
-}
 void CoreAudioPaddedEncoder::extrapolate0()
 {
     unsigned nchannels = getInputDescription().mChannelsPerFrame;
@@ -71,12 +48,9 @@ void CoreAudioPaddedEncoder::extrapolate0()
     }
     if (n < 2 * LPC_ORDER)
         std::memset(m_buffer.write_ptr(), 0, nsamples * bpf);
-    else {
-        reverse_buffer(&buf[0], n, nchannels);
-        extrapolate(&buf[0], n, m_buffer.write_ptr(), nsamples);
-        reverse_buffer(m_buffer.write_ptr(), nsamples, nchannels);
-        reverse_buffer(&buf[0], n, nchannels);
-    }
+    else
+        vorbis_lpc_extrapolate(&buf[0], n, nchannels, LPC_ORDER,
+                               m_buffer.write_ptr(), nsamples, 1);
     m_buffer.commit(nsamples);
     std::copy(buf.begin(), buf.begin() + n * nchannels,
               m_buffer.write_ptr());
@@ -84,12 +58,14 @@ void CoreAudioPaddedEncoder::extrapolate0()
 }
 void CoreAudioPaddedEncoder::extrapolate1()
 {
+    unsigned nchannels = getInputDescription().mChannelsPerFrame;
     unsigned fpp = getOutputDescription().mFramesPerPacket;
     unsigned bpf = getInputDescription().mBytesPerFrame;
     size_t count = m_buffer.count();
     m_buffer.reserve(fpp);
     if (count >= 2 * LPC_ORDER)
-        extrapolate(m_buffer.read_ptr(), count, m_buffer.write_ptr(), fpp);
+        vorbis_lpc_extrapolate(m_buffer.read_ptr(), count, nchannels,
+                               LPC_ORDER, m_buffer.write_ptr(), fpp, 0);
     else
         std::memset(m_buffer.write_ptr(), 0, fpp * bpf);
     m_buffer.commit(fpp);
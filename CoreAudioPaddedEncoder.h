@@ -8,7 +8,7 @@ class CoreAudioPaddedEncoder: public CoreAudioEncoder {
     enum { LPC_ORDER = 32 };
     enum { APPLE_NUM_PRIMING = 2112 };
     util::FIFO<float> m_buffer;
-    std::vector<uint8_t> m_pivot;
+    util::PooledBuffer m_pivot;
     std::vector<uint8_t> m_frame;
     unsigned m_num_priming;
     size_t m_frames;
@@ -28,9 +28,6 @@ protected:
         (this->*m_write)(data, length, nsamples);
     }
 private:
-    void reverse_buffer(float *data, unsigned nsamples, unsigned nchannels);
-    void extrapolate(float *input, size_t ilen,
-                     float *output, size_t olen);
     void extrapolate0();
     void extrapolate1();
     size_t readSamples0(void *buffer, size_t nsamples);
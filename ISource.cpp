@@ -38,6 +38,31 @@ namespace {
         }
         return (sign << 31) | ((exp + 0x70) << 23) | (mantissa << 13);
     }
+    size_t get_l2_cache_size()
+    {
+        static size_t cache_size;
+        if (cache_size)
+            return cache_size;
+        size_t size = 256 * 1024;
+        DWORD len = 0;
+        GetLogicalProcessorInformation(0, &len);
+        if (len) {
+            std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION>
+                info(len / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+            if (GetLogicalProcessorInformation(&info[0], &len)) {
+                for (size_t i = 0; i < info.size(); ++i) {
+                    if (info[i].Relationship == RelationCache &&
+                        info[i].Cache.Level == 2 &&
+                        info[i].Cache.Type != CacheInstruction)
+                    {
+                        size = info[i].Cache.Size;
+                        break;
+                    }
+                }
+            }
+        }
+        return cache_size = size;
+    }
     void init_h2s_table()
     {
         if (!h2s_table) {
@@ -61,6 +86,33 @@ size_t readSamplesFull(ISource *src, void *buffer, size_t nsamples)
     return nsamples - rest;
 }
 
+size_t getPreferredBlockSize(const AudioStreamBasicDescription &asbd)
+{
+    /*
+     * A block is typically held in three or four places at once
+     * (source, conversion pivot, filter output, sink), so aim at a
+     * quarter of L2 per block.
+     * Stay in 1024..65536 frames, rounded down to a power of two.
+     */
+    size_t bpf = std::max(asbd.mBytesPerFrame, 1U);
+    size_t frames = get_l2_cache_size() / 4 / bpf;
+    size_t n = 1024;
+    while (n < 65536 && n * 2 <= frames)
+        n *= 2;
+    return n;
+}
+
+unsigned getFloatBitsForFormat(const AudioStreamBasicDescription &asbd,
+                               unsigned limit)
+{
+    unsigned bits = 32;
+    if (asbd.mBitsPerChannel > 32
+        || ((asbd.mFormatFlags & kAudioFormatFlagIsSignedInteger) &&
+            asbd.mBitsPerChannel > 24))
+        bits = 64;
+    return std::min(bits, limit);
+}
+
 size_t readSamplesAsFloat(ISource *src, std::vector<uint8_t> *pivot,
                           std::vector<float> *floatBuffer, size_t nsamples)
 {
@@ -33,6 +33,21 @@ struct IChapterParser {
 
 size_t readSamplesFull(ISource *src, void *buffer, size_t nsamples);
 
+/*
+ * Number of frames a pull loop should request per call, so that a block
+ * (together with the conversion buffers of intermediate filters) stays
+ * resident in L2 cache.
+ */
+size_t getPreferredBlockSize(const AudioStreamBasicDescription &asbd);
+
+/*
+ * Float precision (32 or 64) a float-producing filter should use for
+ * the given input format. limit is the widest format anything further
+ * down the chain can make use of.
+ */
+unsigned getFloatBitsForFormat(const AudioStreamBasicDescription &asbd,
+                               unsigned limit=64);
+
 size_t readSamplesAsFloat(ISource *src, std::vector<uint8_t> *pivot,
                           std::vector<float> *floatBuffer, size_t nsamples);
 
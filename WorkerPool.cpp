@@ -0,0 +1,357 @@
+#include <process.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include "WorkerPool.h"
+#include "strutil.h"
+#include "logging.h"
+
+namespace {
+    bool read_fully(HANDLE h, void *buffer, DWORD size)
+    {
+        char *bp = static_cast<char*>(buffer);
+        DWORD nread;
+        while (size > 0) {
+            if (!ReadFile(h, bp, size, &nread, 0) || !nread)
+                return false;
+            bp += nread;
+            size -= nread;
+        }
+        return true;
+    }
+
+    bool write_fully(HANDLE h, const void *buffer, DWORD size)
+    {
+        const char *bp = static_cast<const char*>(buffer);
+        DWORD nwritten;
+        while (size > 0) {
+            if (!WriteFile(h, bp, size, &nwritten, 0) || !nwritten)
+                return false;
+            bp += nwritten;
+            size -= nwritten;
+        }
+        return true;
+    }
+
+    /* quote as CommandLineToArgvW() (and CRT) expects */
+    std::wstring quote_arg(const std::wstring &arg)
+    {
+        if (arg.size() && arg.find_first_of(L" \t\"") == std::wstring::npos)
+            return arg;
+        std::wstring result(L"\"");
+        size_t nbackslash = 0;
+        for (size_t i = 0; i < arg.size(); ++i) {
+            if (arg[i] == L'\\') {
+                ++nbackslash;
+                continue;
+            }
+            if (arg[i] == L'"')
+                result.append(nbackslash * 2 + 1, L'\\');
+            else
+                result.append(nbackslash, L'\\');
+            result.push_back(arg[i]);
+            nbackslash = 0;
+        }
+        result.append(nbackslash * 2, L'\\');
+        result.push_back(L'"');
+        return result;
+    }
+
+    std::wstring handle_arg(HANDLE h)
+    {
+        return strutil::format(L"%llu", static_cast<unsigned long long>(
+                                            reinterpret_cast<uintptr_t>(h)));
+    }
+}
+
+WorkerChannel WorkerChannel::fromArg(const wchar_t *arg)
+{
+    unsigned long long rd, wr;
+    wchar_t c;
+    if (std::swscanf(arg, L"%llu:%llu%lc", &rd, &wr, &c) != 2)
+        throw std::runtime_error("invalid arg for --worker-pipe");
+    HANDLE hr = reinterpret_cast<HANDLE>(static_cast<uintptr_t>(rd));
+    HANDLE hw = reinterpret_cast<HANDLE>(static_cast<uintptr_t>(wr));
+    return WorkerChannel(std::shared_ptr<void>(hr, CloseHandle),
+                         std::shared_ptr<void>(hw, CloseHandle));
+}
+
+bool WorkerChannel::send(char type, const std::string &payload)
+{
+    if (!m_wr.get())
+        return false;
+    uint32_t len = static_cast<uint32_t>(payload.size());
+    std::vector<char> message(5 + len);
+    for (int i = 0; i < 4; ++i)
+        message[i] = static_cast<char>(len >> (8 * i));
+    message[4] = type;
+    std::copy(payload.begin(), payload.end(), message.begin() + 5);
+    /* one write per message, since log may come from any thread */
+    return write_fully(m_wr.get(), message.data(),
+                       static_cast<DWORD>(message.size()));
+}
+
+bool WorkerChannel::receive(char *type, std::string *payload)
+{
+    unsigned char header[5];
+    if (!m_rd.get() || !read_fully(m_rd.get(), header, 5))
+        return false;
+    uint32_t len = header[0] | (header[1] << 8) | (header[2] << 16)
+                 | (header[3] << 24);
+    if (len > 0x1000000)
+        return false;
+    std::vector<char> buffer(len + 1);
+    if (len && !read_fully(m_rd.get(), buffer.data(), len))
+        return false;
+    *type = header[4];
+    payload->assign(buffer.data(), len);
+    return true;
+}
+
+struct WorkerPool::Worker {
+    WorkerPool *pool;
+    std::shared_ptr<void> process, thread;
+    WorkerChannel channel;
+    int job;  /* index of m_jobs, -1: idle */
+    double percent;
+    std::string linebuf;
+};
+
+WorkerPool::WorkerPool(const std::vector<wchar_t*> &args, unsigned nworkers)
+    : m_nworkers(nworkers), m_interrupted(0), m_ndone(0), m_result(0)
+{
+    m_cmdline = quote_arg(win32::GetModuleFileNameX(0));
+    for (size_t i = 1; i < args.size(); ++i)
+        m_cmdline += L" " + quote_arg(args[i]);
+    InitializeCriticalSection(&m_cs);
+}
+
+WorkerPool::~WorkerPool()
+{
+    DeleteCriticalSection(&m_cs);
+}
+
+int WorkerPool::run(const std::vector<Job> &jobs,
+                    const volatile bool *interrupted, progress_t progress)
+{
+    m_interrupted = interrupted;
+    m_jobs = jobs;
+    m_attempts.assign(jobs.size(), 0);
+    m_queue.clear();
+    for (size_t i = 0; i < jobs.size(); ++i)
+        m_queue.push_back(i);
+    m_ndone = 0;
+    m_result = 0;
+
+    size_t nworkers = std::min(static_cast<size_t>(m_nworkers), jobs.size());
+    std::vector<HANDLE> threads;
+    for (size_t i = 0; i < nworkers; ++i) {
+        auto w = std::make_shared<Worker>();
+        w->pool = this;
+        w->job = -1;
+        w->percent = 0.0;
+        intptr_t h = _beginthreadex(0, 0, staticWorkerThreadProc, w.get(),
+                                    0, 0);
+        if (h == -1) {
+            LOG(L"WARNING: failed to start worker thread: %hs\n",
+                std::strerror(errno));
+            break;
+        }
+        w->thread.reset(reinterpret_cast<HANDLE>(h), CloseHandle);
+        threads.push_back(w->thread.get());
+        m_workers.push_back(w);
+    }
+    if (threads.empty())
+        throw std::runtime_error("cannot start any worker");
+
+    while (WaitForMultipleObjects(static_cast<DWORD>(threads.size()),
+                                  threads.data(), TRUE, 100) == WAIT_TIMEOUT)
+        report(progress);
+    report(progress);
+    m_workers.clear();
+    if (m_queue.size() && !*m_interrupted) {
+        LOG(L"ERROR: %u jobs were not run\n",
+            static_cast<unsigned>(m_queue.size()));
+        m_result = 2;
+    }
+    return m_result;
+}
+
+bool WorkerPool::take(Worker *w, size_t *job)
+{
+    win32::CriticalSectionLock lock(&m_cs);
+    if (*m_interrupted || m_queue.empty())
+        return false;
+    *job = m_queue.front();
+    m_queue.pop_front();
+    w->job = static_cast<int>(*job);
+    w->percent = 0.0;
+    LOG(L"\n[%d] %s\n", m_jobs[*job].id, m_jobs[*job].command.c_str());
+    return true;
+}
+
+void WorkerPool::finish(Worker *w, size_t job, int status)
+{
+    win32::CriticalSectionLock lock(&m_cs);
+    if (status)
+        m_result = 2;
+    ++m_ndone;
+    w->job = -1;
+}
+
+void WorkerPool::requeue(Worker *w, size_t job)
+{
+    DWORD code = STILL_ACTIVE;
+    if (WaitForSingleObject(w->process.get(), 5000) == WAIT_OBJECT_0)
+        GetExitCodeProcess(w->process.get(), &code);
+    else
+        TerminateProcess(w->process.get(), 2);
+    w->channel.close();
+    w->process.reset();
+
+    win32::CriticalSectionLock lock(&m_cs);
+    LOG(L"WARNING: [%d] worker crashed (exit code 0x%08x)\n",
+        m_jobs[job].id, code);
+    if (++m_attempts[job] < 2 && !*m_interrupted)
+        m_queue.push_front(job);
+    else {
+        LOG(L"ERROR: [%d] giving up\n", m_jobs[job].id);
+        m_result = 2;
+        ++m_ndone;
+    }
+    w->job = -1;
+}
+
+void WorkerPool::spawn(Worker *w)
+{
+    /*
+     * Worker ends of the pipes have to be inheritable. Spawning is
+     * serialized, so that no other worker inherits them; otherwise pipes
+     * wouldn't break when the worker dies.
+     */
+    win32::CriticalSectionLock lock(&m_cs);
+    SECURITY_ATTRIBUTES sa = { sizeof(sa), 0, TRUE };
+    HANDLE h[4];
+    if (!CreatePipe(&h[0], &h[1], &sa, 0))
+        win32::throw_error("CreatePipe", GetLastError());
+    std::shared_ptr<void> job_rd(h[0], CloseHandle), job_wr(h[1], CloseHandle);
+    if (!CreatePipe(&h[2], &h[3], &sa, 0))
+        win32::throw_error("CreatePipe", GetLastError());
+    std::shared_ptr<void> msg_rd(h[2], CloseHandle), msg_wr(h[3], CloseHandle);
+    SetHandleInformation(job_wr.get(), HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(msg_rd.get(), HANDLE_FLAG_INHERIT, 0);
+
+    std::wstring cmdline = m_cmdline + L" --worker-pipe " +
+        handle_arg(job_rd.get()) + L":" + handle_arg(msg_wr.get());
+    std::vector<wchar_t> buffer(cmdline.begin(), cmdline.end());
+    buffer.push_back(0);
+
+    STARTUPINFOW si = { 0 };
+    si.cb = sizeof(si);
+    PROCESS_INFORMATION pi;
+    if (!CreateProcessW(0, buffer.data(), 0, 0, TRUE, 0, 0, 0, &si, &pi))
+        win32::throw_error("CreateProcess", GetLastError());
+    CloseHandle(pi.hThread);
+    w->process.reset(pi.hProcess, CloseHandle);
+    w->channel = WorkerChannel(msg_rd, job_wr);
+}
+
+bool WorkerPool::runJob(Worker *w, size_t job, int *status)
+{
+    if (!w->channel.send('J', strutil::w2us(m_jobs[job].command)))
+        return false;
+    char type;
+    std::string payload;
+    while (w->channel.receive(&type, &payload)) {
+        if (type == 'L')
+            forwardLog(w, job, payload);
+        else if (type == 'P') {
+            win32::CriticalSectionLock lock(&m_cs);
+            w->percent = std::atof(payload.c_str());
+        } else if (type == 'D') {
+            forwardLog(w, job, "\n");
+            *status = std::atoi(payload.c_str());
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkerPool::forwardLog(Worker *w, size_t job, const std::string &text)
+{
+    w->linebuf += text;
+    size_t pos;
+    while ((pos = w->linebuf.find('\n')) != std::string::npos) {
+        std::string line = w->linebuf.substr(0, pos);
+        w->linebuf.erase(0, pos + 1);
+        if (line.size() && line[line.size() - 1] == '\r')
+            line.resize(line.size() - 1);
+        if (line.empty())
+            continue;
+        win32::CriticalSectionLock lock(&m_cs);
+        LOG(L"[%d] %s\n", m_jobs[job].id, strutil::us2w(line).c_str());
+    }
+}
+
+void WorkerPool::report(const progress_t &progress)
+{
+    /*
+     * Held while progress writes the status line, so that it doesn't
+     * get mixed up with log lines forwarded by the worker threads.
+     */
+    win32::CriticalSectionLock lock(&m_cs);
+    if (progress)
+        progress(statusLine());
+}
+
+std::wstring WorkerPool::statusLine()
+{
+    win32::CriticalSectionLock lock(&m_cs);
+    std::wstring s = strutil::format(L"\r[%u/%u]",
+                                     static_cast<unsigned>(m_ndone),
+                                     static_cast<unsigned>(m_jobs.size()));
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        Worker *w = m_workers[i].get();
+        if (w->job >= 0)
+            s += strutil::format(L" #%d:%.0f%%", m_jobs[w->job].id,
+                                 w->percent);
+    }
+    return s + L"   ";
+}
+
+void WorkerPool::workerThreadProc(Worker *w)
+{
+    size_t job;
+    while (take(w, &job)) {
+        int status = 2;
+        try {
+            if (!w->process.get())
+                spawn(w);
+        } catch (const std::exception &e) {
+            {
+                win32::CriticalSectionLock lock(&m_cs);
+                LOG(L"ERROR: [%d] %s\n", m_jobs[job].id,
+                    strutil::us2w(e.what()).c_str());
+            }
+            finish(w, job, status);
+            return;
+        }
+        if (runJob(w, job, &status))
+            finish(w, job, status);
+        else
+            requeue(w, job);
+    }
+    if (w->process.get()) {
+        w->channel.send('Q');
+        WaitForSingleObject(w->process.get(), INFINITE);
+        w->channel.close();
+        w->process.reset();
+    }
+}
+
+unsigned __stdcall WorkerPool::staticWorkerThreadProc(void *arg)
+{
+    Worker *w = static_cast<Worker*>(arg);
+    w->pool->workerThreadProc(w);
+    return 0;
+}
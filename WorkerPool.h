@@ -0,0 +1,94 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <deque>
+#include <functional>
+#include "win32util.h"
+
+/*
+ * Message channel between the coordinator of --workers and a worker
+ * process, over a pair of anonymous pipes.
+ *
+ * A message is a type byte and an UTF-8 payload, preceded by the payload
+ * length (32bit little endian).
+ *   coordinator -> worker: 'J' (job, a line of the manifest), 'Q' (quit)
+ *   worker -> coordinator: 'L' (log text), 'P' (progress in percent),
+ *                          'D' (job done, payload is the exit status)
+ * send() and receive() return false when the other side has gone.
+ */
+class WorkerChannel {
+    std::shared_ptr<void> m_rd, m_wr;
+public:
+    WorkerChannel() {}
+    WorkerChannel(const std::shared_ptr<void> &rd,
+                  const std::shared_ptr<void> &wr)
+        : m_rd(rd), m_wr(wr)
+    {}
+    /* worker side, from the arg of --worker-pipe */
+    static WorkerChannel fromArg(const wchar_t *arg);
+    bool send(char type, const std::string &payload=std::string());
+    bool receive(char *type, std::string *payload);
+    void close() { m_rd.reset(); m_wr.reset(); }
+};
+
+/*
+ * Runs jobs of --manifest in worker processes.
+ *
+ * Workers are copies of this program, started with the given command line
+ * (args[0] is replaced by the module path) plus --worker-pipe, and run
+ * jobs they receive one at a time. Logs of workers are forwarded to the
+ * log of this process, with the job number prefixed to each line.
+ *
+ * When a worker dies in the middle of a job (crash in a decoder module
+ * and so on), it is restarted and the job is requeued once. A job that
+ * takes down a worker twice is reported as failed.
+ * Workers share the console with us, therefore Ctrl+C reaches them too:
+ * running jobs are interrupted by themselves, and no more job is given.
+ */
+class WorkerPool {
+public:
+    struct Job {
+        int id;
+        std::wstring command;
+    };
+    /*
+     * called periodically during run(), with a one line status.
+     * Called with the log lock held, and may write to the console.
+     */
+    typedef std::function<void(const std::wstring &)> progress_t;
+private:
+    struct Worker;
+
+    std::wstring m_cmdline;
+    unsigned m_nworkers;
+    CRITICAL_SECTION m_cs;
+    const volatile bool *m_interrupted;
+    std::vector<Job> m_jobs;
+    std::vector<unsigned> m_attempts;
+    std::deque<size_t> m_queue;
+    size_t m_ndone;
+    int m_result;
+    std::vector<std::shared_ptr<Worker> > m_workers;
+public:
+    WorkerPool(const std::vector<wchar_t*> &args, unsigned nworkers);
+    ~WorkerPool();
+    /* returns 0 if every job succeeded, 2 otherwise */
+    int run(const std::vector<Job> &jobs, const volatile bool *interrupted,
+            progress_t progress=progress_t());
+private:
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+
+    bool take(Worker *w, size_t *job);
+    void finish(Worker *w, size_t job, int status);
+    void requeue(Worker *w, size_t job);
+    void spawn(Worker *w);
+    bool runJob(Worker *w, size_t job, int *status);
+    void forwardLog(Worker *w, size_t job, const std::string &text);
+    void report(const progress_t &progress);
+    std::wstring statusLine();
+    void workerThreadProc(Worker *w);
+    static unsigned __stdcall staticWorkerThreadProc(void *arg);
+};
+
+#endif
@@ -14,6 +14,28 @@ public:
     operator U*() { return reinterpret_cast<U*>(m_pointer); }
 };
 
+/*
+ * Serializes construction of module singletons.
+ * Modules are loaded on the first instance() call, and MSVC doesn't
+ * guarantee thread-safe initialization of function-local statics.
+ * A failed load is remembered as the unloaded state of the instance,
+ * so it's tried only once.
+ */
+class DLLock {
+    static volatile LONG &flag()
+    {
+        static volatile LONG value; // zero-initialized before any code runs
+        return value;
+    }
+public:
+    DLLock()
+    {
+        while (InterlockedCompareExchange(&flag(), 1, 0))
+            SwitchToThread();
+    }
+    ~DLLock() { InterlockedExchange(&flag(), 0); }
+};
+
 class DL {
     std::shared_ptr<HINSTANCE__> m_module;
 public:
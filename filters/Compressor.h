@@ -20,7 +20,7 @@ class Compressor: public FilterBase {
     double m_yA;
     bool m_eof;
     int64_t m_position;
-    std::vector<uint8_t > m_pivot;
+    util::PooledBuffer m_pivot;
     util::FIFO<float> m_buffer;
     std::deque<std::pair<int64_t, float>> m_window;
     AudioStreamBasicDescription m_asbd;
@@ -0,0 +1,377 @@
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <algorithm>
+#include <emmintrin.h>
+#include "HalfbandResampler.h"
+#include "cautil.h"
+
+namespace {
+    /* same as the default of soxr */
+    const double kPassbandEnd = 0.913;
+    /* output frames of a stage computed at a time */
+    const size_t kStageBlock = 1024;
+
+    double bessel_i0(double x)
+    {
+        double sum = 1.0, term = 1.0, q = x * x / 4.0;
+        for (int k = 1; k < 200 && term > sum * 1e-17; ++k) {
+            term *= q / (static_cast<double>(k) * k);
+            sum += term;
+        }
+        return sum;
+    }
+
+    /*
+     * Kaiser windowed sinc lowpass, with transition band from fp to fs
+     * (relative to the sample rate) and stopband attenuation of atten dB.
+     * Returns h[0..L] of the symmetric filter h[-L..L], with unity DC gain.
+     * When the transition band is centered at 0.25, the result is a
+     * halfband filter, and even taps other than h[0] are exactly zero.
+     */
+    std::vector<double> design_lowpass(double fp, double fs, double atten)
+    {
+        bool halfband = std::abs(fp + fs - 0.5) < 1e-9;
+        double fc = (fp + fs) / 2.0;
+        double beta = 0.1102 * (atten - 8.7);
+        int L = static_cast<int>(std::ceil((atten - 7.95) /
+                                           (14.36 * (fs - fp)) / 2.0));
+        if (halfband && L % 2 == 0)
+            ++L;
+        std::vector<double> h(L + 1);
+        double sum = 0.0;
+        for (int n = 0; n <= L; ++n) {
+            if (halfband && n > 0 && n % 2 == 0)
+                continue;
+            double x = M_PI * 2.0 * fc * n;
+            double r = static_cast<double>(n) / (L + 1);
+            double w = bessel_i0(beta * std::sqrt(1.0 - r * r))
+                     / bessel_i0(beta);
+            h[n] = 2.0 * fc * (n ? std::sin(x) / x : 1.0) * w;
+            sum += n ? 2.0 * h[n] : h[n];
+        }
+        for (int n = 0; n <= L; ++n)
+            h[n] /= sum;
+        return h;
+    }
+
+    /* acc[i] += c * (a[i] + b[i]) */
+    template <typename T>
+    inline void mac_c(T *acc, const T *a, const T *b, T c, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+            acc[i] += c * (a[i] + b[i]);
+    }
+
+    inline void mac_sse2(float *acc, const float *a, const float *b, float c,
+                         size_t n)
+    {
+        size_t i = 0;
+        __m128 vc = _mm_set1_ps(c);
+        for (; i + 4 <= n; i += 4) {
+            __m128 v = _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+            _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i),
+                                              _mm_mul_ps(v, vc)));
+        }
+        mac_c(acc + i, a + i, b + i, c, n - i);
+    }
+
+    inline void mac_sse2(double *acc, const double *a, const double *b,
+                         double c, size_t n)
+    {
+        size_t i = 0;
+        __m128d vc = _mm_set1_pd(c);
+        for (; i + 2 <= n; i += 2) {
+            __m128d v = _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i));
+            _mm_storeu_pd(acc + i, _mm_add_pd(_mm_loadu_pd(acc + i),
+                                              _mm_mul_pd(v, vc)));
+        }
+        mac_c(acc + i, a + i, b + i, c, n - i);
+    }
+}
+
+/*
+ * 2:1 decimation or 1:2 interpolation by a symmetric FIR filter.
+ *
+ * Decimation computes y[m] = sum(h[n] * x[2m - n]), and interpolation
+ * y[2m] and y[2m+1] from x[m - n/2] (with gain of 2), so both only have
+ * to look at input samples of the same parity for each tap n.
+ * Taps are applied to a whole block of output at once, therefore the
+ * inner loop runs over frames * channels of contiguous samples, whatever
+ * the number of channels is.
+ * The filter is zero phase: output is aligned with input, and has
+ * exactly twice/half the length of input.
+ */
+template <typename T>
+class HalfbandStage {
+    bool m_decimate;
+    bool m_sse2;
+    unsigned m_nchannels;
+    int m_reach;                 /* max |n/2| of taps, rounded up */
+    T m_center;
+    std::vector<int> m_taps;     /* n > 0 with non-zero h[n] */
+    std::vector<T> m_coefs;
+    std::vector<T> m_history;    /* input frames from m_first */
+    int64_t m_first;
+    int64_t m_ninput, m_ndone;
+    bool m_flushed;
+    std::vector<T> m_even, m_odd, m_output;
+public:
+    HalfbandStage(bool decimate, unsigned nchannels,
+                  const std::vector<double> &h)
+        : m_decimate(decimate), m_sse2(util::has_sse2()),
+          m_nchannels(nchannels),
+          m_ninput(0), m_ndone(0), m_flushed(false)
+    {
+        double gain = decimate ? 1.0 : 2.0;
+        int L = static_cast<int>(h.size()) - 1;
+        m_reach = L / 2 + 1;
+        m_center = static_cast<T>(h[0] * gain);
+        for (int n = 1; n <= L; ++n) {
+            if (h[n] == 0.0)
+                continue;
+            m_taps.push_back(n);
+            m_coefs.push_back(static_cast<T>(h[n] * gain));
+        }
+        /* zeros before the beginning of the input */
+        m_first = decimate ? -2 * m_reach : -m_reach;
+        m_history.assign(-m_first * nchannels, 0);
+    }
+    /*
+     * Feed nin frames, and return the output available so far.
+     * flush is given at the end of the input.
+     */
+    const std::vector<T> &process(const T *in, size_t nin, bool flush)
+    {
+        m_output.clear();
+        if (m_flushed)
+            return m_output;
+        m_history.insert(m_history.end(), in, in + nin * m_nchannels);
+        m_ninput += nin;
+        if (flush) {
+            m_flushed = true;
+            m_history.resize(m_history.size() +
+                             (2 * m_reach + 2) * m_nchannels);
+        }
+        if (m_decimate)
+            decimate();
+        else
+            interpolate();
+        return m_output;
+    }
+private:
+    void mac(T *acc, const T *a, const T *b, T c, size_t n)
+    {
+        if (m_sse2)
+            mac_sse2(acc, a, b, c, n);
+        else
+            mac_c(acc, a, b, c, n);
+    }
+    int64_t end() const
+    {
+        return m_first + static_cast<int64_t>(m_history.size() / m_nchannels);
+    }
+    const T *row(int64_t index) const
+    {
+        return &m_history[(index - m_first) * m_nchannels];
+    }
+    void discard(int64_t index)
+    {
+        if (index > m_first) {
+            m_history.erase(m_history.begin(),
+                            m_history.begin() +
+                                (index - m_first) * m_nchannels);
+            m_first = index;
+        }
+    }
+    void decimate()
+    {
+        /* y[m] needs x up to 2m + 2 * m_reach - 1 */
+        int64_t limit = 0;
+        if (end() >= 2 * m_reach)
+            limit = (end() - 2 * m_reach) / 2 + 1;
+        if (m_flushed)
+            limit = std::min(limit, (m_ninput + 1) / 2);
+        unsigned nc = m_nchannels;
+        int A = m_reach;
+        while (m_ndone < limit) {
+            size_t nblock = static_cast<size_t>(
+                std::min<int64_t>(kStageBlock, limit - m_ndone));
+            size_t nrows = nblock + 2 * A;
+            /* even and odd phase, from x[2 * (m_ndone - A)] */
+            m_even.resize(nrows * nc);
+            m_odd.resize(nrows * nc);
+            int64_t base = 2 * (m_ndone - A);
+            for (size_t i = 0; i < nrows; ++i) {
+                int64_t pos = base + 2 * i;
+                for (int p = 0; p < 2; ++p) {
+                    T *dst = &(p ? m_odd : m_even)[i * nc];
+                    if (pos + p < end())
+                        std::copy(row(pos + p), row(pos + p) + nc, dst);
+                    else
+                        std::fill(dst, dst + nc, static_cast<T>(0));
+                }
+            }
+            size_t nsamples = nblock * nc;
+            size_t off = m_output.size();
+            m_output.resize(off + nsamples);
+            T *acc = &m_output[off];
+            const T *ev = &m_even[0], *od = &m_odd[0];
+            for (size_t i = 0; i < nsamples; ++i)
+                acc[i] = m_center * ev[A * nc + i];
+            for (size_t k = 0; k < m_taps.size(); ++k) {
+                int n = m_taps[k];
+                if (n % 2 == 0)
+                    mac(acc, ev + (A - n / 2) * nc, ev + (A + n / 2) * nc,
+                        m_coefs[k], nsamples);
+                else
+                    mac(acc, od + (A - (n + 1) / 2) * nc,
+                        od + (A + (n - 1) / 2) * nc, m_coefs[k], nsamples);
+            }
+            m_ndone += nblock;
+        }
+        discard(2 * (m_ndone - A));
+    }
+    void interpolate()
+    {
+        /* y[2m] and y[2m+1] need x up to m + m_reach */
+        int64_t limit = end() - m_reach;
+        if (m_flushed)
+            limit = std::min(limit, m_ninput);
+        unsigned nc = m_nchannels;
+        int A = m_reach;
+        while (m_ndone < limit) {
+            size_t nblock = static_cast<size_t>(
+                std::min<int64_t>(kStageBlock, limit - m_ndone));
+            size_t nsamples = nblock * nc;
+            const T *x = row(m_ndone - A);
+            m_even.resize(nsamples);
+            m_odd.assign(nsamples, 0);
+            T *ev = &m_even[0], *od = &m_odd[0];
+            for (size_t i = 0; i < nsamples; ++i)
+                ev[i] = m_center * x[A * nc + i];
+            for (size_t k = 0; k < m_taps.size(); ++k) {
+                int n = m_taps[k];
+                if (n % 2 == 0)
+                    mac(ev, x + (A - n / 2) * nc, x + (A + n / 2) * nc,
+                        m_coefs[k], nsamples);
+                else
+                    mac(od, x + (A + 1 - (n + 1) / 2) * nc,
+                        x + (A + (n + 1) / 2) * nc, m_coefs[k], nsamples);
+            }
+            size_t off = m_output.size();
+            m_output.resize(off + 2 * nsamples);
+            T *op = &m_output[off];
+            for (size_t i = 0; i < nblock; ++i) {
+                std::copy(ev + i * nc, ev + (i + 1) * nc, op);
+                op += nc;
+                std::copy(od + i * nc, od + (i + 1) * nc, op);
+                op += nc;
+            }
+            m_ndone += nblock;
+        }
+        discard(m_ndone - A);
+    }
+};
+
+bool HalfbandResampler::isSupported(double irate, double orate)
+{
+    double hi = std::max(irate, orate), lo = std::min(irate, orate);
+    if (lo < 1.0 || hi != std::floor(hi) || lo != std::floor(lo))
+        return false;
+    for (double rate = lo * 2; rate <= lo * 16; rate *= 2)
+        if (rate == hi)
+            return true;
+    return false;
+}
+
+HalfbandResampler::HalfbandResampler(const std::shared_ptr<ISource> &src,
+                                     unsigned rate, unsigned max_bits)
+    : FilterBase(src), m_position(0), m_eof(false), m_queue_pos(0)
+{
+    const AudioStreamBasicDescription &asbd = src->getSampleFormat();
+    unsigned bits = getFloatBitsForFormat(asbd, max_bits);
+    m_asbd = cautil::buildASBDForPCM(rate, asbd.mChannelsPerFrame,
+                                     bits, kAudioFormatFlagIsFloat);
+    if (bits == 32)
+        setup(&m_fstages, asbd.mSampleRate, rate);
+    else
+        setup(&m_dstages, asbd.mSampleRate, rate);
+
+    m_length = source()->length();
+    if (m_length != ~0ULL) {
+        for (size_t i = 0; i < numStages(); ++i)
+            m_length = rate < asbd.mSampleRate ? (m_length + 1) / 2
+                                               : m_length * 2;
+    }
+}
+
+template <typename T>
+void HalfbandResampler::setup(std::vector<std::shared_ptr<HalfbandStage<T> > >
+                                  *stages,
+                              double irate, double orate)
+{
+    /* as SOXR_HQ (20bit) for float32, and SOXR_VHQ (28bit) for float64 */
+    double atten = (m_asbd.mBitsPerChannel == 32 ? 20 : 28) * 6.0206;
+    bool decimate = orate < irate;
+    double lo = std::min(irate, orate);
+    double nyquist = lo / 2.0;
+
+    for (double rate = std::max(irate, orate); rate > lo; rate /= 2.0) {
+        /*
+         * Only [0, nyquist] of the final rate has to be protected, and
+         * the last stage only up to the passband end.
+         */
+        double fp = nyquist / rate;
+        if (rate / 2.0 == lo)
+            fp *= kPassbandEnd;
+        std::shared_ptr<HalfbandStage<T> >
+            stage(new HalfbandStage<T>(decimate, m_asbd.mChannelsPerFrame,
+                                       design_lowpass(fp, 0.5 - fp, atten)));
+        if (decimate)
+            stages->push_back(stage);
+        else
+            stages->insert(stages->begin(), stage);
+    }
+}
+
+size_t HalfbandResampler::readSamples(void *buffer, size_t nsamples)
+{
+    if (m_asbd.mBitsPerChannel == 32)
+        return readSamplesT(static_cast<float*>(buffer), nsamples,
+                            m_fstages, &m_fbuffer, &m_fqueue);
+    else
+        return readSamplesT(static_cast<double*>(buffer), nsamples,
+                            m_dstages, &m_dbuffer, &m_dqueue);
+}
+
+template <typename T>
+size_t HalfbandResampler::readSamplesT(T *buffer, size_t nsamples,
+                                       std::vector<std::shared_ptr<
+                                           HalfbandStage<T> > > &stages,
+                                       std::vector<T> *ibuffer,
+                                       std::vector<T> *queue)
+{
+    unsigned nc = m_asbd.mChannelsPerFrame;
+    while ((queue->size() - m_queue_pos) / nc < nsamples && !m_eof) {
+        queue->erase(queue->begin(), queue->begin() + m_queue_pos);
+        m_queue_pos = 0;
+
+        size_t n = getPreferredBlockSize(source()->getSampleFormat());
+        ibuffer->resize(n * nc);
+        n = readSamplesAsFloat(source(), &m_pivot, ibuffer->data(), n);
+        m_eof = (n == 0);
+        const T *p = ibuffer->data();
+        for (size_t i = 0; i < stages.size(); ++i) {
+            const std::vector<T> &out = stages[i]->process(p, n, m_eof);
+            p = out.data();
+            n = out.size() / nc;
+        }
+        queue->insert(queue->end(), p, p + n * nc);
+    }
+    nsamples = std::min(nsamples, (queue->size() - m_queue_pos) / nc);
+    std::copy(queue->begin() + m_queue_pos,
+              queue->begin() + m_queue_pos + nsamples * nc, buffer);
+    m_queue_pos += nsamples * nc;
+    m_position += nsamples;
+    return nsamples;
+}
@@ -0,0 +1,62 @@
+#ifndef HALFBANDRESAMPLER_H
+#define HALFBANDRESAMPLER_H
+
+#include "FilterBase.h"
+#include "util.h"
+
+template <typename T> class HalfbandStage;
+
+/*
+ * Sample rate conversion by 2^n (96kHz -> 48kHz, 44.1kHz -> 176.4kHz and
+ * so on), as a cascade of 2:1 halfband FIR stages, computed in polyphase
+ * form skipping the zero taps (every other tap of a halfband filter).
+ *
+ * The stage at the lower end of the cascade has the same passband (91.3%
+ * of Nyquist) as SoxrResampler. Being a halfband filter, its stopband
+ * starts as far above Nyquist as the passband ends below it, so unlike
+ * soxr, aliases/images are only rejected outside of the transition band.
+ * Other stages only have to keep them out of [0, Nyquist] of the final
+ * rate.
+ * Opt-in by --halfband-resampler; SoxrResampler is the default.
+ */
+class HalfbandResampler: public FilterBase {
+    int64_t m_position;
+    uint64_t m_length;
+    bool m_eof;
+    size_t m_queue_pos;
+    util::PooledBuffer m_pivot;
+    std::vector<float> m_fbuffer, m_fqueue;
+    std::vector<double> m_dbuffer, m_dqueue;
+    std::vector<std::shared_ptr<HalfbandStage<float> > > m_fstages;
+    std::vector<std::shared_ptr<HalfbandStage<double> > > m_dstages;
+    AudioStreamBasicDescription m_asbd;
+public:
+    /* true if rate can be converted by this class */
+    static bool isSupported(double irate, double orate);
+
+    HalfbandResampler(const std::shared_ptr<ISource> &src, unsigned rate,
+                      unsigned max_bits=64);
+    uint64_t length() const { return m_length; }
+    const AudioStreamBasicDescription &getSampleFormat() const
+    {
+        return m_asbd;
+    }
+    size_t readSamples(void *buffer, size_t nsamples);
+    int64_t getPosition() { return m_position; }
+    size_t numStages() const
+    {
+        /* only one of them is in use */
+        return m_fstages.size() + m_dstages.size();
+    }
+private:
+    template <typename T>
+    void setup(std::vector<std::shared_ptr<HalfbandStage<T> > > *stages,
+               double irate, double orate);
+    template <typename T>
+    size_t readSamplesT(T *buffer, size_t nsamples,
+                        std::vector<std::shared_ptr<HalfbandStage<T> > >
+                            &stages,
+                        std::vector<T> *ibuffer, std::vector<T> *queue);
+};
+
+#endif
@@ -20,8 +20,8 @@ public:
 
 class Limiter: public FilterBase {
     SoftClipper m_clipper;
-    std::vector<uint8_t> m_ibuffer;
-    std::vector<float>   m_fbuffer;
+    util::PooledBuffer m_ibuffer;
+    std::vector<float> m_fbuffer;
     AudioStreamBasicDescription m_asbd;
 public:
     Limiter(const std::shared_ptr<ISource> &source)
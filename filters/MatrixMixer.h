@@ -14,7 +14,7 @@ class MatrixMixer: public FilterBase {
     std::vector<std::shared_ptr<lsx_convolver_t> > m_filter;
     std::vector<unsigned> m_shift_channels, m_pass_channels;
     std::deque<float> m_syncque;
-    std::vector<uint8_t> m_ibuffer;
+    util::PooledBuffer m_ibuffer;
     std::vector<float> m_fbuffer;
     util::FIFO<float> m_buffer;
     AudioStreamBasicDescription m_asbd;
@@ -8,23 +8,21 @@
 #endif
 #include "cautil.h"
 
-Normalizer::Normalizer(const std::shared_ptr<ISource> &src, bool seekable)
+Normalizer::Normalizer(const std::shared_ptr<ISource> &src, bool seekable,
+                       unsigned max_bits, double stored_peak)
     : FilterBase(src),
       m_peak(0.0),
+      m_stored_peak(stored_peak),
       m_processed(0),
       m_position(0)
 {
     const AudioStreamBasicDescription &asbd = source()->getSampleFormat();
-    unsigned bits = 32;
-    if (asbd.mBitsPerChannel > 32
-        || ((asbd.mFormatFlags & kAudioFormatFlagIsSignedInteger) &&
-            asbd.mBitsPerChannel > 24))
-        bits = 64;
+    unsigned bits = getFloatBitsForFormat(asbd, max_bits);
 
     m_asbd = cautil::buildASBDForPCM(asbd.mSampleRate,
                                      asbd.mChannelsPerFrame,
                                      bits, kAudioFormatFlagIsFloat);
-    if (!seekable) {
+    if (!seekable && !isSinglePass()) {
         FILE *tmpfile = win32::tmpfile(L"qaac.norm");
         m_tmpfile = std::shared_ptr<FILE>(tmpfile, std::fclose);
     }
@@ -69,6 +67,8 @@ size_t Normalizer::processT(size_t nsamples)
 template <typename T>
 size_t Normalizer::readSamplesT(void *buffer, size_t nsamples)
 {
+    if (isSinglePass())
+        return readSamplesSinglePassT(static_cast<T*>(buffer), nsamples);
     if (!m_tmpfile.get())
         return 0;
     int nc = util::nread(fd(), buffer, nsamples * m_asbd.mBytesPerFrame);
@@ -82,3 +82,18 @@ size_t Normalizer::readSamplesT(void *buffer, size_t nsamples)
     m_position += nsamples;
     return nsamples;
 }
+
+template <typename T>
+size_t Normalizer::readSamplesSinglePassT(T *buffer, size_t nsamples)
+{
+    size_t nc = readSamplesAsFloat(source(), &m_ibuffer, buffer, nsamples);
+    /* same as the Scaler used after the scan of seekable input */
+    T scale = 1.0 / m_stored_peak;
+    for (size_t i = 0; i < nc * m_asbd.mChannelsPerFrame; ++i) {
+        double x = std::abs(buffer[i]);
+        if (x > m_peak) m_peak = x;
+        buffer[i] *= scale;
+    }
+    m_position += nc;
+    return nc;
+}
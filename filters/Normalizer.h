@@ -2,31 +2,52 @@
 #define _NORMALIZE_H
 
 #include "FilterBase.h"
+#include "util.h"
 
+/*
+ * Normally works in two passes: process() scans the whole input for the
+ * peak (keeping a copy in a tmpfile when the input is not seekable), and
+ * readSamples() returns the scanned samples scaled by the peak.
+ *
+ * When the peak is already known (stored_peak > 0), it works in a single
+ * pass instead: readSamples() reads from the source and scales on the fly.
+ * The actual peak is still measured, so that the caller can verify the
+ * stored one when everything has been read.
+ */
 class Normalizer: public FilterBase {
     double m_peak;
-    std::vector<uint8_t> m_ibuffer;
-    std::vector<uint8_t> m_fbuffer;
+    double m_stored_peak;
+    util::PooledBuffer m_ibuffer;
+    util::PooledBuffer m_fbuffer;
     std::shared_ptr<FILE> m_tmpfile;
     uint64_t m_processed, m_position;
     AudioStreamBasicDescription m_asbd;
 public:
-    Normalizer(const std::shared_ptr<ISource> &src, bool seekable);
+    Normalizer(const std::shared_ptr<ISource> &src, bool seekable,
+               unsigned max_bits=64, double stored_peak=0.0);
     const AudioStreamBasicDescription &getSampleFormat() const
     {
         return m_asbd;
     }
     size_t readSamples(void *buffer, size_t nsamples);
+    /* scanned peak, or peak of what has been read in single pass mode */
     double getPeak() const { return m_peak; }
+    double getStoredPeak() const { return m_stored_peak; }
+    bool isSinglePass() const { return m_stored_peak > 0.0; }
     size_t process(size_t nsamples);
     int64_t getPosition() { return m_position; }
-    uint64_t length() const { return m_processed; }
+    uint64_t length() const
+    {
+        return isSinglePass() ? FilterBase::length() : m_processed;
+    }
 private:
     int fd() { return m_tmpfile.get() ? fileno(m_tmpfile.get()) : -1; }
     template <typename T>
     size_t processT(size_t nsamples);
     template <typename T>
     size_t readSamplesT(void *buffer, size_t nsamples);
+    template <typename T>
+    size_t readSamplesSinglePassT(T *buffer, size_t nsamples);
 };
 
 #endif
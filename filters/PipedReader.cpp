@@ -1,7 +1,6 @@
 #include "PipedReader.h"
 
 namespace {
-    const int NSAMPLES = 0x1000;
     const int PIPE_BUF_FACTOR = 4;
 }
 
@@ -13,7 +12,8 @@ PipedReader::PipedReader(std::shared_ptr<ISource> &src):
     FILE *fp;
 
     uint32_t bpf = src->getSampleFormat().mBytesPerFrame;
-    if (!CreatePipe(&hr, &hw, 0, NSAMPLES * bpf * PIPE_BUF_FACTOR))
+    m_block_size = getPreferredBlockSize(src->getSampleFormat());
+    if (!CreatePipe(&hr, &hw, 0, m_block_size * bpf * PIPE_BUF_FACTOR))
         win32::throw_error("CreatePipe", GetLastError());
     CHECKCRT((fd = _open_osfhandle(reinterpret_cast<intptr_t>(hr),
                                    _O_RDONLY|_O_BINARY)) < 0);
@@ -53,12 +53,12 @@ void PipedReader::inputThreadProc()
     try {
         ISource *src = source();
         uint32_t bpf = src->getSampleFormat().mBytesPerFrame;
-        std::vector<uint8_t> buffer(NSAMPLES * bpf);
+        std::vector<uint8_t> buffer(m_block_size * bpf);
         uint8_t *bp = &buffer[0];
         HANDLE ph = m_writePipe.get();
         size_t n;
         DWORD nb;
-        while ((n = src->readSamples(bp, NSAMPLES)) > 0
+        while ((n = src->readSamples(bp, m_block_size)) > 0
                && WriteFile(ph, bp, n * bpf, &nb, 0))
             ;
     } catch (...) {}
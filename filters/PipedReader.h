@@ -9,6 +9,7 @@ class PipedReader: public FilterBase {
     std::shared_ptr<FILE> m_readPipe;
     std::shared_ptr<void> m_writePipe, m_thread;
     int64_t m_position;
+    size_t m_block_size;
 public:
     PipedReader(std::shared_ptr<ISource> &src);
     ~PipedReader();
@@ -8,37 +8,44 @@ inline T clip(T x, T min, T max)
     return x;
 }
 
-/* inacculate, but much faster than std::uniform_int_distribution<> */
-template <typename Engine>
-class RandomIntSpan {
-    Engine &e_;
-    int div_, off_;
-public:
-    RandomIntSpan(Engine &e, int min, int max)
-        : e_(e), off_(min)
-    {
-        div_ = e.max() / (max - min);
-    }
-    int operator()() { return e_() / div_ + off_; }
-};
-
-template <typename Engine>
-class RandomIntSpanShift {
-    Engine &e_;
-    int shift_, off_;
-public:
-    RandomIntSpanShift(Engine &e, int log2)
-        : e_(e)
-    {
-        shift_ = 32 - log2;
-        off_ = - (1 << (log2 - 1));
-    }
-    int operator()() { return (e_() >> shift_) + off_; }
-};
+/* TPDF noise in [-1, 1) LSB, made of two 32bit uniform values */
+inline double tpdf(uint64_t r)
+{
+    return (static_cast<double>(static_cast<uint32_t>(r)) +
+            static_cast<double>(static_cast<uint32_t>(r >> 32)))
+        * (1.0 / 4294967296.0) - 1.0;
+}
+
+namespace {
+    /*
+     * Error feedback filters for noise shaping, designed for 44.1kHz.
+     * Output is q = x + e - sum(coefs[k] * e[n-1-k]).
+     */
+    const double lipshitz_coefs[] = {
+        2.033, -2.165, 1.959, -1.590, 0.6149
+    };
+    const double fweighted_coefs[] = {
+        2.412, -3.370, 3.937, -4.174, 3.353, -2.205, 1.281, -0.569, 0.0847
+    };
+}
+
+bool Quantizer::isShapingAvailable(unsigned noise_shaping, double rate)
+{
+    /*
+     * Response at 48kHz is stretched by 8.8%, which is still fine.
+     * At other rates the curves are way off from the intended ones.
+     */
+    return noise_shaping == kFlatTPDF || rate == 44100 || rate == 48000;
+}
 
 Quantizer::Quantizer(const std::shared_ptr<ISource> &source,
-                     uint32_t bitdepth, bool no_dither, bool is_float)
-    : FilterBase(source)
+                     uint32_t bitdepth, bool no_dither, bool is_float,
+                     unsigned noise_shaping)
+    : FilterBase(source),
+      m_position(0),
+      m_coefs(0),
+      m_order(0),
+      m_error_pos(0)
 {
     const AudioStreamBasicDescription &asbd = source->getSampleFormat();
     m_asbd = cautil::buildASBDForPCM2(asbd.mSampleRate,
@@ -47,26 +54,55 @@ Quantizer::Quantizer(const std::shared_ptr<ISource> &source,
                                       is_float ? kAudioFormatFlagIsFloat
                                         : kAudioFormatFlagIsSignedInteger);
 
-    bool dither = !no_dither && m_asbd.mBitsPerChannel <= 18;
+    /* nothing to dither when the output is float or as wide as input */
+    bool narrowing = !(m_asbd.mFormatFlags & kAudioFormatFlagIsFloat) &&
+        (!(asbd.mFormatFlags & kAudioFormatFlagIsSignedInteger) ||
+         m_asbd.mBitsPerChannel < asbd.mBitsPerChannel);
+    bool dither = narrowing && !no_dither && m_asbd.mBitsPerChannel <= 18;
+    bool shaped = dither && noise_shaping != kFlatTPDF &&
+                  isShapingAvailable(noise_shaping, asbd.mSampleRate);
+    m_dithered = dither;
+    if (shaped) {
+        if (noise_shaping == kLipshitz) {
+            m_coefs = lipshitz_coefs;
+            m_order = util::sizeof_array(lipshitz_coefs);
+        } else {
+            m_coefs = fweighted_coefs;
+            m_order = util::sizeof_array(fweighted_coefs);
+        }
+        /*
+         * Error history is stored twice in a row, so that the last
+         * m_order entries are always contiguous starting from m_error_pos.
+         */
+        size_t nch = m_asbd.mChannelsPerFrame;
+        m_errors.resize(2 * m_order * nch);
+        m_frame.resize(nch);
+        m_dither.resize(nch);
+    }
 
     if (m_asbd.mFormatFlags & kAudioFormatFlagIsFloat)
         m_convert = &Quantizer::convertSamples_a2f;
     else if (asbd.mFormatFlags & kAudioFormatFlagIsSignedInteger) {
         if (m_asbd.mBitsPerChannel >= asbd.mBitsPerChannel)
             m_convert = &Quantizer::convertSamples_i2i_0;
+        else if (shaped)
+            m_convert = &Quantizer::convertSamples_i2i_3;
         else if (dither)
             m_convert = &Quantizer::convertSamples_i2i_2;
         else
             m_convert = &Quantizer::convertSamples_i2i_1;
     }
     else if (asbd.mBitsPerChannel == 16)
-        m_convert = dither ? &Quantizer::convertSamples_h2i_2
+        m_convert = shaped ? &Quantizer::convertSamples_h2i_3
+                  : dither ? &Quantizer::convertSamples_h2i_2
                            : &Quantizer::convertSamples_h2i_1;
     else if (asbd.mBitsPerChannel <= 32)
-        m_convert = dither ? &Quantizer::convertSamples_f2i_2
+        m_convert = shaped ? &Quantizer::convertSamples_f2i_3
+                  : dither ? &Quantizer::convertSamples_f2i_2
                            : &Quantizer::convertSamples_f2i_1;
     else
-        m_convert = dither ? &Quantizer::convertSamples_d2i_2
+        m_convert = shaped ? &Quantizer::convertSamples_d2i_3
+                  : dither ? &Quantizer::convertSamples_d2i_2
                            : &Quantizer::convertSamples_d2i_1;
 }
 
@@ -99,6 +135,16 @@ size_t Quantizer::convertSamples_i2i_2(void *buffer, size_t nsamples)
     return nsamples;
 }
 
+size_t Quantizer::convertSamples_i2i_3(void *buffer, size_t nsamples)
+{
+    nsamples = source()->readSamples(buffer, nsamples);
+    ditherShaped(static_cast<int32_t *>(buffer),
+                 static_cast<int32_t *>(buffer),
+                 m_asbd.mChannelsPerFrame * nsamples,
+                 m_asbd.mBitsPerChannel, 1.0 / 2147483648.0);
+    return nsamples;
+}
+
 size_t Quantizer::convertSamples_h2i_1(void *buffer, size_t nsamples)
 {
     nsamples = readSamplesAsFloat(source(), &m_pivot,
@@ -121,6 +167,17 @@ size_t Quantizer::convertSamples_h2i_2(void *buffer, size_t nsamples)
     return nsamples;
 }
 
+size_t Quantizer::convertSamples_h2i_3(void *buffer, size_t nsamples)
+{
+    nsamples = readSamplesAsFloat(source(), &m_pivot,
+                                  static_cast<float*>(buffer), nsamples);
+    ditherShaped(static_cast<float *>(buffer),
+                 static_cast<int32_t *>(buffer),
+                 m_asbd.mChannelsPerFrame * nsamples,
+                 m_asbd.mBitsPerChannel, 1.0);
+    return nsamples;
+}
+
 size_t Quantizer::convertSamples_f2i_1(void *buffer, size_t nsamples)
 {
     nsamples = source()->readSamples(buffer, nsamples);
@@ -141,6 +198,16 @@ size_t Quantizer::convertSamples_f2i_2(void *buffer, size_t nsamples)
     return nsamples;
 }
 
+size_t Quantizer::convertSamples_f2i_3(void *buffer, size_t nsamples)
+{
+    nsamples = source()->readSamples(buffer, nsamples);
+    ditherShaped(static_cast<float *>(buffer),
+                 static_cast<int32_t *>(buffer),
+                 m_asbd.mChannelsPerFrame * nsamples,
+                 m_asbd.mBitsPerChannel, 1.0);
+    return nsamples;
+}
+
 size_t Quantizer::convertSamples_d2i_1(void *buffer, size_t nsamples)
 {
     growPivot(nsamples);
@@ -163,6 +230,17 @@ size_t Quantizer::convertSamples_d2i_2(void *buffer, size_t nsamples)
     return nsamples;
 }
 
+size_t Quantizer::convertSamples_d2i_3(void *buffer, size_t nsamples)
+{
+    growPivot(nsamples);
+    nsamples = source()->readSamples(&m_pivot[0], nsamples);
+    ditherShaped(reinterpret_cast<double *>(&m_pivot[0]),
+                 static_cast<int32_t *>(buffer),
+                 m_asbd.mChannelsPerFrame * nsamples,
+                 m_asbd.mBitsPerChannel, 1.0);
+    return nsamples;
+}
+
 /*
  *  MSB <-------------------------> LSB
  *  <----------- original ------------>
@@ -191,9 +269,12 @@ void Quantizer::ditherInt2(int32_t *dst, size_t count, unsigned bits)
     const int half = one / 2;
     const unsigned mask = ~(one - 1);
 
-    RandomIntSpanShift<RandomEngine> noise(m_engine, 31 - bits);
+    const int shift = bits + 1;
     for (size_t i = 0; i < count; ++i) {
-        int value = (dst[i] >> 1) + half + noise() + noise();
+        uint64_t r = m_noise(m_position++);
+        int noise = (static_cast<uint32_t>(r) >> shift)
+                  + (static_cast<uint32_t>(r >> 32) >> shift) - one;
+        int value = (dst[i] >> 1) + half + noise;
         value &= mask;
         dst[i] = clip(value, INT_MIN>>1, INT_MAX>>1) << 1;
     }
@@ -221,15 +302,59 @@ void Quantizer::ditherFloat2(const T *src, int32_t *dst, size_t count,
     double half = static_cast<double>(1U << (bits - 1));
     double min_value = -half;
     double max_value = half - 1;
-    std::uniform_real_distribution<double> dist(-0.5, 0.5);
     for (size_t i = 0; i < count; ++i) {
         double value = src[i] * half;
-        double noise = dist(m_engine) + dist(m_engine);
-        value += noise;
+        value += tpdf(m_noise(m_position++));
         dst[i] = lrint(clip(value, min_value, max_value)) << shifts;
     }
 }
 
+/*
+ * TPDF dither with error feedback, done frame by frame.
+ * The error is measured before adding dither, and before clipping so that
+ * the feedback loop stays bounded.
+ */
+template <typename T>
+void Quantizer::ditherShaped(const T *src, int32_t *dst, size_t count,
+                             unsigned bits, double scale)
+{
+    const unsigned nch = m_asbd.mChannelsPerFrame;
+    const size_t order = m_order;
+    int shifts = 32 - bits;
+    double half = static_cast<double>(1U << (bits - 1));
+    double min_value = -half;
+    double max_value = half - 1;
+    double *frame = &m_frame[0];
+    double *dither = &m_dither[0];
+
+    scale *= half;
+    for (size_t i = 0; i < count; i += nch) {
+        for (unsigned c = 0; c < nch; ++c) {
+            frame[c] = src[i + c] * scale;
+            dither[c] = tpdf(m_noise(m_position++));
+        }
+        size_t pos = m_error_pos;
+        size_t next = (pos == 0 ? order : pos) - 1;
+        for (unsigned c = 0; c < nch; ++c) {
+            const double *ep = &m_errors[pos * nch + c];
+            double acc = 0.0;
+            for (size_t k = 0; k < order; ++k, ep += nch)
+                acc += m_coefs[k] * *ep;
+            double v = frame[c] - acc;
+            double q = lrint(v + dither[c]);
+            double e = q - v;
+            /*
+             * Row next + order can be the oldest one we've just read,
+             * but only the column of this channel is overwritten.
+             */
+            m_errors[next * nch + c] = e;
+            m_errors[(next + order) * nch + c] = e;
+            dst[i + c] = lrint(clip(q, min_value, max_value)) << shifts;
+        }
+        m_error_pos = next;
+    }
+}
+
 void Quantizer::growPivot(size_t nsamples)
 {
     size_t nbytes = nsamples * source()->getSampleFormat().mBytesPerFrame;
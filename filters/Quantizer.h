@@ -2,20 +2,31 @@
 #define INTEGER_SOURCE_H
 
 #include <assert.h>
-#include <random>
 #include "FilterBase.h"
 #include "cautil.h"
 #include "rng.h"
 
 class Quantizer: public FilterBase {
-    typedef rng::LCG RandomEngine;
     AudioStreamBasicDescription m_asbd;
-    RandomEngine m_engine;
-    std::vector<uint8_t> m_pivot;
+    rng::Counter m_noise;
+    uint64_t m_position;
+    util::PooledBuffer m_pivot;
+    /* noise shaping filter state */
+    const double *m_coefs;
+    size_t m_order, m_error_pos;
+    std::vector<double> m_errors, m_frame, m_dither;
+    bool m_dithered;
     size_t (Quantizer::*m_convert)(void *buffer, size_t nsamples);
 public:
+    enum { kFlatTPDF, kLipshitz, kFWeighted };
+
     Quantizer(const std::shared_ptr<ISource> &source, uint32_t bitdepth,
-              bool no_dither, bool is_float=false);
+              bool no_dither, bool is_float=false,
+              unsigned noise_shaping=kFlatTPDF);
+    static bool isShapingAvailable(unsigned noise_shaping, double rate);
+    /* whether dither (and noise shaping) is actually applied */
+    bool isDithered() const { return m_dithered; }
+    bool isShaped() const { return m_coefs != 0; }
     const AudioStreamBasicDescription &getSampleFormat() const
     {
         return m_asbd;
@@ -29,12 +40,16 @@ private:
     size_t convertSamples_i2i_0(void *buffer, size_t nsamples);
     size_t convertSamples_i2i_1(void *buffer, size_t nsamples);
     size_t convertSamples_i2i_2(void *buffer, size_t nsamples);
+    size_t convertSamples_i2i_3(void *buffer, size_t nsamples);
     size_t convertSamples_h2i_1(void *buffer, size_t nsamples);
     size_t convertSamples_h2i_2(void *buffer, size_t nsamples);
+    size_t convertSamples_h2i_3(void *buffer, size_t nsamples);
     size_t convertSamples_f2i_1(void *buffer, size_t nsamples);
     size_t convertSamples_f2i_2(void *buffer, size_t nsamples);
+    size_t convertSamples_f2i_3(void *buffer, size_t nsamples);
     size_t convertSamples_d2i_1(void *buffer, size_t nsamples);
     size_t convertSamples_d2i_2(void *buffer, size_t nsamples);
+    size_t convertSamples_d2i_3(void *buffer, size_t nsamples);
 
     void ditherInt1(int32_t *dst, size_t count, unsigned bits);
     void ditherInt2(int32_t *dst, size_t count, unsigned bits);
@@ -42,6 +57,9 @@ private:
     void ditherFloat1(const T *src, int *dst, size_t count, unsigned bits);
     template <typename T>
     void ditherFloat2(const T *src, int *dst, size_t count, unsigned bits);
+    template <typename T>
+    void ditherShaped(const T *src, int *dst, size_t count, unsigned bits,
+                      double scale);
 
     void growPivot(size_t nsamples);
 };
@@ -15,6 +15,7 @@ private:
     SOXRModule& operator=(const SOXRModule&);
 public:
     static SOXRModule &instance() {
+        DLLock lock;
         static SOXRModule self;
         return self;
     }
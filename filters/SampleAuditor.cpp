@@ -0,0 +1,401 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <emmintrin.h>
+#include <float.h>
+#include "SampleAuditor.h"
+
+namespace {
+    /* more channels than this are audited by the scalar loop */
+    const unsigned kMaxSIMDChannels = 8;
+    /*
+     * Groups of frames summed in SIMD registers before moved to double.
+     * Int32Traits relies on this being small enough for the halves of
+     * 256 samples not to overflow 32bit lanes.
+     */
+    const size_t kSumInterval = 256;
+
+    /*
+     * Each traits class loads kLanes samples at once, and provides masks
+     * (all ones in the lane) of non-finite and clipped samples, and
+     * the value to be reduced, with non-finite lanes zeroed.
+     * fill() puts the given value into the non-finite lanes, so that
+     * they don't take part in min/max. Sums are kept in sum_type.
+     */
+    struct Float32Traits {
+        typedef float sample_type;
+        typedef __m128 raw_type;
+        typedef __m128 mask_type;
+        typedef __m128 value_type;
+        typedef __m128 sum_type;
+        enum { kLanes = 4 };
+
+        explicit Float32Traits(int32_t) {}
+        raw_type load(const float *p) const { return _mm_loadu_ps(p); }
+        mask_type nonfinite(raw_type x) const
+        {
+            __m128 d = _mm_sub_ps(x, x);  /* NaN for NaN and Inf */
+            return _mm_cmpunord_ps(d, d);
+        }
+        mask_type clipped(raw_type x, mask_type nf) const
+        {
+            __m128 a = _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+            return _mm_andnot_ps(nf, _mm_cmpge_ps(a, _mm_set1_ps(1.0f)));
+        }
+        value_type value(raw_type x, mask_type nf) const
+        {
+            return _mm_andnot_ps(nf, x);
+        }
+        value_type fill(value_type v, mask_type nf, value_type with) const
+        {
+            return _mm_or_ps(v, _mm_and_ps(nf, with));
+        }
+        value_type init(double v) const
+        {
+            return _mm_set1_ps(static_cast<float>(v));
+        }
+        value_type min(value_type a, value_type b) const
+        {
+            return _mm_min_ps(a, b);
+        }
+        value_type max(value_type a, value_type b) const
+        {
+            return _mm_max_ps(a, b);
+        }
+        sum_type zero_sum() const { return _mm_setzero_ps(); }
+        sum_type add(sum_type a, value_type b) const
+        {
+            return _mm_add_ps(a, b);
+        }
+        __m128i count(__m128i acc, mask_type mask) const
+        {
+            return _mm_sub_epi32(acc, _mm_castps_si128(mask));
+        }
+        void store(value_type v, double *out) const
+        {
+            float tmp[4];
+            _mm_storeu_ps(tmp, v);
+            std::copy(tmp, tmp + 4, out);
+        }
+        void store(__m128i v, uint64_t *out) const
+        {
+            uint32_t tmp[4];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(tmp), v);
+            std::copy(tmp, tmp + 4, out);
+        }
+        bool is_nonfinite(float x) const { return !_finite(x); }
+        bool is_clipped(float x) const { return std::abs(x) >= 1.0f; }
+        double to_double(float x) const { return x; }
+        float sanitize(float x) const
+        {
+            return _isnan(x) ? 0.0f : x < 0.0f ? -1.0f : 1.0f;
+        }
+    };
+
+    struct Float64Traits {
+        typedef double sample_type;
+        typedef __m128d raw_type;
+        typedef __m128d mask_type;
+        typedef __m128d value_type;
+        typedef __m128d sum_type;
+        enum { kLanes = 2 };
+
+        explicit Float64Traits(int32_t) {}
+        raw_type load(const double *p) const { return _mm_loadu_pd(p); }
+        mask_type nonfinite(raw_type x) const
+        {
+            __m128d d = _mm_sub_pd(x, x);
+            return _mm_cmpunord_pd(d, d);
+        }
+        mask_type clipped(raw_type x, mask_type nf) const
+        {
+            __m128d a = _mm_andnot_pd(_mm_set1_pd(-0.0), x);
+            return _mm_andnot_pd(nf, _mm_cmpge_pd(a, _mm_set1_pd(1.0)));
+        }
+        value_type value(raw_type x, mask_type nf) const
+        {
+            return _mm_andnot_pd(nf, x);
+        }
+        value_type fill(value_type v, mask_type nf, value_type with) const
+        {
+            return _mm_or_pd(v, _mm_and_pd(nf, with));
+        }
+        value_type init(double v) const { return _mm_set1_pd(v); }
+        value_type min(value_type a, value_type b) const
+        {
+            return _mm_min_pd(a, b);
+        }
+        value_type max(value_type a, value_type b) const
+        {
+            return _mm_max_pd(a, b);
+        }
+        sum_type zero_sum() const { return _mm_setzero_pd(); }
+        sum_type add(sum_type a, value_type b) const
+        {
+            return _mm_add_pd(a, b);
+        }
+        __m128i count(__m128i acc, mask_type mask) const
+        {
+            return _mm_sub_epi64(acc, _mm_castpd_si128(mask));
+        }
+        void store(value_type v, double *out) const
+        {
+            _mm_storeu_pd(out, v);
+        }
+        void store(__m128i v, uint64_t *out) const
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), v);
+        }
+        bool is_nonfinite(double x) const { return !_finite(x); }
+        bool is_clipped(double x) const { return std::abs(x) >= 1.0; }
+        double to_double(double x) const { return x; }
+        double sanitize(double x) const
+        {
+            return _isnan(x) ? 0.0 : x < 0.0 ? -1.0 : 1.0;
+        }
+    };
+
+    /*
+     * 32bit integer, aligned high. Reduced exactly in integer scale:
+     * min/max as int32, and sums as the upper and lower 16 bits of
+     * samples, in separate lanes.
+     */
+    struct Int32Traits {
+        typedef int32_t sample_type;
+        typedef __m128i raw_type;
+        typedef __m128i mask_type;
+        typedef __m128i value_type;
+        struct sum_type {
+            __m128i hi, lo;
+        };
+        enum { kLanes = 4 };
+
+        int32_t m_max;  /* full scale for the valid bits */
+
+        explicit Int32Traits(int32_t max_value): m_max(max_value) {}
+        raw_type load(const int32_t *p) const
+        {
+            return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        }
+        mask_type nonfinite(raw_type) const { return _mm_setzero_si128(); }
+        mask_type clipped(raw_type x, mask_type) const
+        {
+            __m128i lo = _mm_cmpeq_epi32(x, _mm_set1_epi32(INT_MIN));
+            __m128i hi = _mm_cmpgt_epi32(x, _mm_set1_epi32(m_max - 1));
+            return _mm_or_si128(lo, hi);
+        }
+        value_type value(raw_type x, mask_type) const { return x; }
+        value_type fill(value_type v, mask_type, value_type) const
+        {
+            return v;
+        }
+        value_type init(double v) const
+        {
+            v *= 2147483648.0;
+            return _mm_set1_epi32(v >= INT_MAX ? INT_MAX
+                                  : v <= INT_MIN ? INT_MIN
+                                  : static_cast<int32_t>(v));
+        }
+        /* no pminsd/pmaxsd in SSE2 */
+        value_type min(value_type a, value_type b) const
+        {
+            __m128i gt = _mm_cmpgt_epi32(a, b);
+            return _mm_or_si128(_mm_and_si128(gt, b),
+                                _mm_andnot_si128(gt, a));
+        }
+        value_type max(value_type a, value_type b) const
+        {
+            __m128i gt = _mm_cmpgt_epi32(a, b);
+            return _mm_or_si128(_mm_and_si128(gt, a),
+                                _mm_andnot_si128(gt, b));
+        }
+        sum_type zero_sum() const
+        {
+            sum_type sum = { _mm_setzero_si128(), _mm_setzero_si128() };
+            return sum;
+        }
+        sum_type add(sum_type a, value_type b) const
+        {
+            a.hi = _mm_add_epi32(a.hi, _mm_srai_epi32(b, 16));
+            a.lo = _mm_add_epi32(a.lo, _mm_and_si128(b,
+                                                     _mm_set1_epi32(0xffff)));
+            return a;
+        }
+        __m128i count(__m128i acc, mask_type mask) const
+        {
+            return _mm_sub_epi32(acc, mask);
+        }
+        void store(value_type v, double *out) const
+        {
+            int32_t tmp[4];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(tmp), v);
+            for (int i = 0; i < 4; ++i)
+                out[i] = tmp[i] / 2147483648.0;
+        }
+        void store(sum_type v, double *out) const
+        {
+            int32_t hi[4], lo[4];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(hi), v.hi);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lo), v.lo);
+            for (int i = 0; i < 4; ++i)
+                out[i] = (hi[i] * 65536.0 + lo[i]) / 2147483648.0;
+        }
+        void store(__m128i v, uint64_t *out) const
+        {
+            uint32_t tmp[4];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(tmp), v);
+            std::copy(tmp, tmp + 4, out);
+        }
+        bool is_nonfinite(int32_t) const { return false; }
+        bool is_clipped(int32_t x) const
+        {
+            return x == INT_MIN || x >= m_max;
+        }
+        double to_double(int32_t x) const { return x / 2147483648.0; }
+        int32_t sanitize(int32_t x) const { return x; }
+    };
+}
+
+SampleAuditor::SampleAuditor(const std::shared_ptr<ISource> &src,
+                             bool sanitize)
+    : FilterBase(src), m_sanitize(sanitize), m_frames(0)
+{
+    const AudioStreamBasicDescription &asbd = src->getSampleFormat();
+    if (!isAvailable(asbd))
+        throw std::runtime_error("SampleAuditor: unsupported format");
+
+    ChannelStats init = { 0, 0, -1, -1, DBL_MAX, -DBL_MAX, 0.0 };
+    m_stats.assign(asbd.mChannelsPerFrame, init);
+
+    unsigned bits = std::min(asbd.mBitsPerChannel, 32U);
+    m_int_max = 0x7fffffff - ((1U << (32 - bits)) - 1);
+
+    /* SSE2 is not there on every IA32 CPU */
+    bool simd = util::has_sse2();
+    if (!(asbd.mFormatFlags & kAudioFormatFlagIsFloat))
+        m_audit = simd ? &SampleAuditor::audit<Int32Traits, true>
+                       : &SampleAuditor::audit<Int32Traits, false>;
+    else if (asbd.mBitsPerChannel == 32)
+        m_audit = simd ? &SampleAuditor::audit<Float32Traits, true>
+                       : &SampleAuditor::audit<Float32Traits, false>;
+    else
+        m_audit = simd ? &SampleAuditor::audit<Float64Traits, true>
+                       : &SampleAuditor::audit<Float64Traits, false>;
+}
+
+bool SampleAuditor::isAvailable(const AudioStreamBasicDescription &asbd)
+{
+    unsigned bpc = asbd.mBytesPerFrame / asbd.mChannelsPerFrame;
+    if (asbd.mFormatFlags & kAudioFormatFlagIsFloat)
+        return bpc == 4 || bpc == 8;
+    return bpc == 4 && (asbd.mFormatFlags & kAudioFormatFlagIsSignedInteger);
+}
+
+template <typename Traits, bool SIMD>
+void SampleAuditor::audit(void *buffer, size_t nsamples)
+{
+    typedef typename Traits::sample_type sample_t;
+    typedef typename Traits::value_type value_t;
+    const Traits tr(m_int_max);
+    const unsigned nc = m_stats.size();
+    const unsigned W = Traits::kLanes;
+    sample_t *samples = static_cast<sample_t*>(buffer);
+
+    m_before = m_stats;
+
+    /*
+     * W frames (nc vectors) at a time. Lane l of k-th vector always
+     * holds channel (k * W + l) % nc, whatever nc is.
+     * Without SIMD, everything is done by the scalar loop below.
+     */
+    size_t ngroups = SIMD && nc <= kMaxSIMDChannels ? nsamples / W : 0;
+    if (ngroups) {
+        value_t vmin[kMaxSIMDChannels], vmax[kMaxSIMDChannels];
+        typename Traits::sum_type vsum[kMaxSIMDChannels];
+        __m128i vnonfinite[kMaxSIMDChannels], vclipped[kMaxSIMDChannels];
+        const value_t inf = tr.init(HUGE_VAL), ninf = tr.init(-HUGE_VAL);
+        for (unsigned k = 0; k < nc; ++k) {
+            vmin[k] = inf;
+            vmax[k] = ninf;
+            vsum[k] = tr.zero_sum();
+            vnonfinite[k] = vclipped[k] = _mm_setzero_si128();
+        }
+        for (size_t g = 0; g < ngroups; ++g) {
+            const sample_t *gp = samples + g * W * nc;
+            for (unsigned k = 0; k < nc; ++k) {
+                typename Traits::raw_type x = tr.load(gp + k * W);
+                typename Traits::mask_type nf = tr.nonfinite(x);
+                value_t v = tr.value(x, nf);
+                vmin[k] = tr.min(vmin[k], tr.fill(v, nf, inf));
+                vmax[k] = tr.max(vmax[k], tr.fill(v, nf, ninf));
+                vsum[k] = tr.add(vsum[k], v);
+                vnonfinite[k] = tr.count(vnonfinite[k], nf);
+                vclipped[k] = tr.count(vclipped[k], tr.clipped(x, nf));
+            }
+            /* sums lose precision or overflow as they grow, move to double */
+            if ((g + 1) % kSumInterval == 0 || g + 1 == ngroups) {
+                for (unsigned k = 0; k < nc; ++k) {
+                    double sums[4];
+                    tr.store(vsum[k], sums);
+                    for (unsigned l = 0; l < W; ++l)
+                        m_stats[(k * W + l) % nc].sum += sums[l];
+                    vsum[k] = tr.zero_sum();
+                }
+            }
+        }
+        for (unsigned k = 0; k < nc; ++k) {
+            double mins[4], maxs[4];
+            uint64_t nonfinite[4], clipped[4];
+            tr.store(vmin[k], mins);
+            tr.store(vmax[k], maxs);
+            tr.store(vnonfinite[k], nonfinite);
+            tr.store(vclipped[k], clipped);
+            for (unsigned l = 0; l < W; ++l) {
+                ChannelStats &s = m_stats[(k * W + l) % nc];
+                s.min = std::min(s.min, mins[l]);
+                s.max = std::max(s.max, maxs[l]);
+                s.nonfinite += nonfinite[l];
+                s.clipped += clipped[l];
+            }
+        }
+    }
+    for (size_t i = ngroups * W; i < nsamples; ++i) {
+        for (unsigned c = 0; c < nc; ++c) {
+            sample_t x = samples[i * nc + c];
+            ChannelStats &s = m_stats[c];
+            if (tr.is_nonfinite(x)) {
+                ++s.nonfinite;
+                continue;
+            }
+            double v = tr.to_double(x);
+            s.min = std::min(s.min, v);
+            s.max = std::max(s.max, v);
+            s.sum += v;
+            if (tr.is_clipped(x))
+                ++s.clipped;
+        }
+    }
+
+    /*
+     * Positions are looked up (and samples are sanitized) by the scalar
+     * loop, only for the channels which had something in this block.
+     */
+    for (unsigned c = 0; c < nc; ++c) {
+        ChannelStats &s = m_stats[c];
+        bool nonfinite = s.nonfinite > m_before[c].nonfinite &&
+                         (s.first_nonfinite < 0 || m_sanitize);
+        bool clipped = s.clipped > m_before[c].clipped && s.first_clipped < 0;
+        if (!nonfinite && !clipped)
+            continue;
+        for (size_t i = 0; i < nsamples; ++i) {
+            sample_t &x = samples[i * nc + c];
+            if (tr.is_nonfinite(x)) {
+                if (s.first_nonfinite < 0)
+                    s.first_nonfinite = m_frames + i;
+                if (m_sanitize)
+                    x = tr.sanitize(x);
+            } else if (tr.is_clipped(x) && s.first_clipped < 0)
+                s.first_clipped = m_frames + i;
+        }
+    }
+}
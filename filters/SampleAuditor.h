@@ -0,0 +1,53 @@
+#ifndef SAMPLEAUDITOR_H
+#define SAMPLEAUDITOR_H
+
+#include "FilterBase.h"
+#include "util.h"
+
+/*
+ * Passes samples through as they are, while collecting per channel
+ * statistics: min/max, DC offset, number of clipped (at or beyond full
+ * scale) and non-finite (NaN/Inf) samples, and where they first appeared.
+ *
+ * With sanitize, non-finite samples are replaced (NaN by 0, Inf by full
+ * scale of the same sign). Overs are left as they are, since they are
+ * still valid float samples, and are better dealt with by normalization
+ * or the limiter.
+ *
+ * Input has to be one of the formats sources deliver: 32bit integer
+ * (aligned high), or 32/64bit float.
+ */
+class SampleAuditor: public FilterBase {
+public:
+    struct ChannelStats {
+        uint64_t nonfinite, clipped;
+        int64_t first_nonfinite, first_clipped;  /* -1: none */
+        double min, max, sum;
+    };
+private:
+    bool m_sanitize;
+    uint64_t m_frames;
+    int32_t m_int_max;
+    std::vector<ChannelStats> m_stats;
+    std::vector<ChannelStats> m_before;  /* m_stats before current block */
+    void (SampleAuditor::*m_audit)(void *buffer, size_t nsamples);
+public:
+    SampleAuditor(const std::shared_ptr<ISource> &src, bool sanitize);
+    static bool isAvailable(const AudioStreamBasicDescription &asbd);
+    size_t readSamples(void *buffer, size_t nsamples)
+    {
+        size_t nc = source()->readSamples(buffer, nsamples);
+        (this->*m_audit)(buffer, nc);
+        m_frames += nc;
+        return nc;
+    }
+    bool sanitizes() const { return m_sanitize; }
+    uint64_t framesAudited() const { return m_frames; }
+    /* min, max and sum are in float scale (full scale is 1.0) */
+    const std::vector<ChannelStats> &stats() const { return m_stats; }
+private:
+    template <typename Traits, bool SIMD>
+    void audit(void *buffer, size_t nsamples);
+};
+
+#endif
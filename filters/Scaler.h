@@ -3,22 +3,19 @@
 
 #include <cmath>
 #include "FilterBase.h"
+#include "util.h"
 
 class Scaler: public FilterBase {
     double m_scale;
-    std::vector<uint8_t> m_ibuffer;
+    util::PooledBuffer m_ibuffer;
     AudioStreamBasicDescription m_asbd;
 public:
-    Scaler(const std::shared_ptr<ISource> &source, double scale)
+    Scaler(const std::shared_ptr<ISource> &source, double scale,
+           unsigned max_bits=64)
         : FilterBase(source), m_scale(scale)
     {
         const AudioStreamBasicDescription &asbd = source->getSampleFormat();
-        unsigned bits = 32;
-        if (asbd.mBitsPerChannel > 32
-            || ((asbd.mFormatFlags & kAudioFormatFlagIsSignedInteger) &&
-                asbd.mBitsPerChannel > 24))
-            bits = 64;
-
+        unsigned bits = getFloatBitsForFormat(asbd, max_bits);
         m_asbd = cautil::buildASBDForPCM(asbd.mSampleRate,
                                          asbd.mChannelsPerFrame,
                                          bits, kAudioFormatFlagIsFloat);
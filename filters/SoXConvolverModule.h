@@ -18,6 +18,7 @@ private:
     SoXConvolverModule& operator=(const SoXConvolverModule&);
 public:
     static SoXConvolverModule &instance() {
+        DLLock lock;
         static SoXConvolverModule self;
         return self;
     }
@@ -7,7 +7,7 @@
 
 class SoxLowpassFilter: public FilterBase {
     int64_t m_position;
-    std::vector<uint8_t > m_pivot;
+    util::PooledBuffer m_pivot;
     util::FIFO<float> m_buffer;
     std::shared_ptr<lsx_convolver_t> m_convolver;
     AudioStreamBasicDescription m_asbd;
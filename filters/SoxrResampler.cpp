@@ -2,15 +2,11 @@
 #include "cautil.h"
 
 SoxrResampler::SoxrResampler(const std::shared_ptr<ISource> &src,
-                             unsigned rate)
+                             unsigned rate, unsigned max_bits)
     : FilterBase(src), m_position(0), m_module(SOXRModule::instance())
 {
     const AudioStreamBasicDescription &asbd = src->getSampleFormat();
-    unsigned bits = 32;
-    if (asbd.mBitsPerChannel > 32
-        || ((asbd.mFormatFlags & kAudioFormatFlagIsSignedInteger) &&
-            asbd.mBitsPerChannel > 24))
-        bits = 64;
+    unsigned bits = getFloatBitsForFormat(asbd, max_bits);
     m_asbd = cautil::buildASBDForPCM(rate, asbd.mChannelsPerFrame,
                                      bits, kAudioFormatFlagIsFloat);
 
@@ -8,12 +8,13 @@
 class SoxrResampler: public FilterBase {
     int64_t m_position;
     uint64_t m_length;
-    std::vector<uint8_t > m_pivot, m_buffer;
+    util::PooledBuffer m_pivot, m_buffer;
     std::shared_ptr<soxr> m_resampler;
     AudioStreamBasicDescription m_asbd;
     SOXRModule &m_module;
 public:
-    SoxrResampler(const std::shared_ptr<ISource> &src, unsigned rate);
+    SoxrResampler(const std::shared_ptr<ISource> &src, unsigned rate,
+                  unsigned max_bits=64);
     ~SoxrResampler() { m_resampler.reset(); }
     uint64_t length() const
     {
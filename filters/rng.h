@@ -58,5 +58,26 @@ namespace rng {
             return x_[3] ^=  x_[3] >> c ^ t ^ t >> b;
         }
     };
+
+    /*
+     * Counter based generator (SplitMix64 finalizer).
+     * Output is a function of (seed, n) only, therefore any position of
+     * the stream can be generated independently of the others.
+     */
+    class Counter
+    {
+        uint64_t seed_;
+    public:
+        typedef uint64_t result_type;
+
+        explicit Counter(uint64_t seed=0): seed_(seed) {}
+        result_type operator()(uint64_t n) const
+        {
+            uint64_t z = seed_ + (n + 1) * 0x9e3779b97f4a7c15ULL;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+    };
 }
 #endif
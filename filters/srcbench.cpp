@@ -0,0 +1,198 @@
+/*
+ * Benchmark of HalfbandResampler against SoxrResampler.
+ *
+ * usage: srcbench [seconds]
+ *
+ * Both resamplers are run on the same synthetic stereo input, for each of
+ * the 2^n conversions below, in float32 (soxr HQ) and float64 (soxr VHQ).
+ * For each of them, prints:
+ *   speed:    seconds of input converted per second (a 1kHz tone)
+ *   passband: gain at 1kHz, and at the end of the passband (91.3%)
+ *   reject:   level of the alias (decimation) or image (interpolation)
+ *             of a tone, landing 20% away from the Nyquist of the lower
+ *             rate. Tones in the transition band partly pass both
+ *             resamplers; this one is in the stopband of both.
+ * soxr rows are skipped when libsoxr is not found.
+ */
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include "HalfbandResampler.h"
+#include "SoxrResampler.h"
+#include "cautil.h"
+
+namespace {
+    /*
+     * Sine of freq Hz with amplitude 0.5 on every channel.
+     * freq has to be a whole number, so that one second of it can be
+     * computed beforehand and repeated, leaving the sin() out of the
+     * speed measurement.
+     */
+    class ToneSource: public ISource {
+        AudioStreamBasicDescription m_asbd;
+        std::vector<uint8_t> m_table;
+        int64_t m_position;
+        uint64_t m_length;
+    public:
+        ToneSource(unsigned rate, unsigned bits, double freq, double seconds)
+            : m_position(0)
+        {
+            m_asbd = cautil::buildASBDForPCM(rate, 2, bits,
+                                             kAudioFormatFlagIsFloat);
+            m_length = static_cast<uint64_t>(rate * seconds);
+            m_table.resize(rate * m_asbd.mBytesPerFrame);
+            for (unsigned i = 0; i < rate; ++i) {
+                double v = 0.5 * std::sin(2.0 * M_PI * freq * i / rate);
+                for (unsigned c = 0; c < 2; ++c) {
+                    if (bits == 32)
+                        reinterpret_cast<float*>(&m_table[0])[i * 2 + c] =
+                            static_cast<float>(v);
+                    else
+                        reinterpret_cast<double*>(&m_table[0])[i * 2 + c] =
+                            v;
+                }
+            }
+        }
+        uint64_t length() const { return m_length; }
+        const AudioStreamBasicDescription &getSampleFormat() const
+        {
+            return m_asbd;
+        }
+        const std::vector<uint32_t> *getChannels() const { return 0; }
+        int64_t getPosition() { return m_position; }
+        size_t readSamples(void *buffer, size_t nsamples)
+        {
+            nsamples = static_cast<size_t>(std::min<uint64_t>(nsamples,
+                                               m_length - m_position));
+            size_t period = m_table.size() / m_asbd.mBytesPerFrame;
+            uint8_t *bp = static_cast<uint8_t*>(buffer);
+            for (size_t done = 0, n; done < nsamples; done += n) {
+                size_t pos = (m_position + done) % period;
+                n = std::min(nsamples - done, period - pos);
+                std::memcpy(bp + done * m_asbd.mBytesPerFrame,
+                            &m_table[pos * m_asbd.mBytesPerFrame],
+                            n * m_asbd.mBytesPerFrame);
+            }
+            m_position += nsamples;
+            return nsamples;
+        }
+    };
+
+    std::shared_ptr<ISource> create(bool soxr,
+                                    const std::shared_ptr<ISource> &src,
+                                    unsigned rate)
+    {
+        if (soxr)
+            return std::make_shared<SoxrResampler>(src, rate);
+        return std::make_shared<HalfbandResampler>(src, rate);
+    }
+
+    /* pulls everything, and returns the first channel */
+    std::vector<double> drain(ISource *src)
+    {
+        std::vector<double> result;
+        std::vector<uint8_t> buffer(4096 * src->getSampleFormat()
+                                                .mBytesPerFrame);
+        bool is32 = src->getSampleFormat().mBitsPerChannel == 32;
+        size_t n;
+        while ((n = src->readSamples(&buffer[0], 4096)) > 0) {
+            for (size_t i = 0; i < n; ++i) {
+                if (is32)
+                    result.push_back(
+                        reinterpret_cast<float*>(&buffer[0])[i * 2]);
+                else
+                    result.push_back(
+                        reinterpret_cast<double*>(&buffer[0])[i * 2]);
+            }
+        }
+        return result;
+    }
+
+    /*
+     * Level of freq in dB relative to the input tone, by correlation over
+     * the middle half (away from the start up and flush transients).
+     */
+    double level(const std::vector<double> &x, double rate, double freq)
+    {
+        size_t begin = x.size() / 4, end = x.size() * 3 / 4;
+        double w = 2.0 * M_PI * freq / rate, re = 0.0, im = 0.0;
+        for (size_t i = begin; i < end; ++i) {
+            re += x[i] * std::cos(w * i);
+            im += x[i] * std::sin(w * i);
+        }
+        double amp = 2.0 * std::sqrt(re * re + im * im) / (end - begin);
+        return 20.0 * std::log10(std::max(amp / 0.5, 1e-20));
+    }
+
+    double measure(bool soxr, unsigned irate, unsigned orate, unsigned bits,
+                   double freq, double seconds, double outfreq)
+    {
+        std::shared_ptr<ISource>
+            src(new ToneSource(irate, bits, freq, seconds));
+        std::shared_ptr<ISource> resampler = create(soxr, src, orate);
+        return level(drain(resampler.get()), orate, outfreq);
+    }
+
+    double speed(bool soxr, unsigned irate, unsigned orate, unsigned bits,
+                 double seconds)
+    {
+        std::shared_ptr<ISource>
+            src(new ToneSource(irate, bits, 1000.0, seconds));
+        std::shared_ptr<ISource> resampler = create(soxr, src, orate);
+        std::vector<uint8_t> buffer(4096 * resampler->getSampleFormat()
+                                                      .mBytesPerFrame);
+        std::clock_t begin = std::clock();
+        while (resampler->readSamples(&buffer[0], 4096) > 0)
+            ;
+        double elapsed = static_cast<double>(std::clock() - begin)
+                       / CLOCKS_PER_SEC;
+        return elapsed > 0.0 ? seconds / elapsed : 0.0;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = argc > 1 ? std::atof(argv[1]) : 60.0;
+    if (!(seconds > 0.0)) {
+        std::fprintf(stderr, "usage: srcbench [seconds]\n");
+        return 1;
+    }
+    static const unsigned rates[][2] = {
+        { 96000, 48000 }, { 48000, 96000 }, { 192000, 48000 },
+        { 44100, 176400 }, { 88200, 44100 }
+    };
+    bool have_soxr = SOXRModule::instance().loaded();
+    if (!have_soxr)
+        std::printf("libsoxr not found, soxr rows are skipped\n");
+    std::printf("%-22s %-9s %10s %12s %12s %10s\n", "conversion", "engine",
+                "speed(x)", "1kHz(dB)", "edge(dB)", "reject(dB)");
+    for (size_t i = 0; i < util::sizeof_array(rates); ++i) {
+        unsigned irate = rates[i][0], orate = rates[i][1];
+        double nyquist = std::min(irate, orate) / 2.0;
+        double edge = std::floor(nyquist * 0.913);
+        /* alias lands 20% below nyquist, image 20% above */
+        double probe = std::floor(orate < irate ? nyquist * 1.2
+                                                : nyquist * 0.8);
+        double image = 2.0 * nyquist - probe;
+        for (unsigned bits = 32; bits <= 64; bits += 32) {
+            for (int soxr = 0; soxr < 2; ++soxr) {
+                if (soxr && !have_soxr)
+                    continue;
+                std::printf("%6u -> %-6u f%-6u %-9s %10.1f %12.6f %12.6f "
+                            "%10.1f\n",
+                            irate, orate, bits, soxr ? "soxr" : "halfband",
+                            speed(soxr, irate, orate, bits, seconds),
+                            measure(soxr, irate, orate, bits, 1000.0, 10.0,
+                                    1000.0),
+                            measure(soxr, irate, orate, bits, edge, 10.0,
+                                    edge),
+                            measure(soxr, irate, orate, bits, probe, 10.0,
+                                    image));
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,167 @@
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <io.h>
+#include "AIFFSource.h"
+#include "util.h"
+#include "metadata.h"
+
+namespace {
+    inline uint16_t read_be16(const uint8_t *p)
+    {
+        return (p[0] << 8) | p[1];
+    }
+    inline uint32_t read_be32(const uint8_t *p)
+    {
+        return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+    /* 80 bit IEEE 754 extended precision */
+    double read_extended(const uint8_t *p)
+    {
+        int exponent = ((p[0] & 0x7f) << 8) | p[1];
+        uint64_t mantissa =
+            static_cast<uint64_t>(read_be32(p + 2)) << 32 | read_be32(p + 6);
+        double value = std::ldexp(static_cast<double>(mantissa),
+                                  exponent - 16383 - 63);
+        return p[0] & 0x80 ? -value : value;
+    }
+}
+
+AIFFSource::AIFFSource(const std::shared_ptr<FILE> &fp)
+    : m_block_align(0),
+      m_big_endian(true),
+      m_data_pos(0),
+      m_position(0),
+      m_length(0),
+      m_fp(fp),
+      m_unpack(0)
+{
+    std::memset(&m_asbd, 0, sizeof m_asbd);
+    parse();
+    m_tags = ID3::fetchAiffID3Tags(fd());
+    CHECKCRT(_lseeki64(fd(), m_data_pos, SEEK_SET) < 0);
+}
+
+size_t AIFFSource::readSamples(void *buffer, size_t nsamples)
+{
+    nsamples = static_cast<size_t>(std::min(static_cast<uint64_t>(nsamples),
+                                            m_length - m_position));
+    size_t nbytes = nsamples * m_block_align;
+    if (m_buffer.size() < nbytes)
+        m_buffer.resize(nbytes);
+    ssize_t n = nbytes ? util::nread(fd(), &m_buffer[0], nbytes) : 0;
+    nsamples = n > 0 ? n / m_block_align : 0;
+    if (nsamples) {
+        size_t size = nsamples * m_block_align;
+        unsigned width = m_block_align / m_asbd.mChannelsPerFrame;
+        if (m_unpack)
+            m_unpack(&m_buffer[0], static_cast<uint32_t *>(buffer),
+                     nsamples * m_asbd.mChannelsPerFrame);
+        else {
+            if (m_big_endian)
+                util::bswapbuffer(&m_buffer[0], size, width * 8);
+            util::unpack(&m_buffer[0], buffer, &size, width,
+                         m_asbd.mBytesPerFrame / m_asbd.mChannelsPerFrame);
+        }
+        m_position += nsamples;
+    }
+    return nsamples;
+}
+
+void AIFFSource::seekTo(int64_t count)
+{
+    CHECKCRT(_lseeki64(fd(), m_data_pos + count * m_block_align,
+                       SEEK_SET) < 0);
+    m_position = count;
+}
+
+void AIFFSource::parse()
+{
+    uint8_t header[12];
+    util::check_eof(util::nread(fd(), header, 12) == 12);
+    if (std::memcmp(header, "FORM", 4))
+        throw std::runtime_error("AIFFSource: not an aiff file");
+    bool aifc = !std::memcmp(header + 8, "AIFC", 4);
+    if (!aifc && std::memcmp(header + 8, "AIFF", 4))
+        throw std::runtime_error("AIFFSource: not an aiff file");
+
+    uint32_t nframes = 0;
+    int64_t data_size = -1;
+    std::vector<uint8_t> chunk;
+    while (util::nread(fd(), header, 8) == 8) {
+        uint32_t size = read_be32(header + 4);
+        int64_t pos = _lseeki64(fd(), 0, SEEK_CUR);
+        if (!std::memcmp(header, "COMM", 4)) {
+            if (size < 18 || size > 0x1000)
+                throw std::runtime_error("AIFFSource: invalid COMM chunk");
+            chunk.resize(size);
+            util::check_eof(util::nread(fd(), &chunk[0], size) == size);
+            nframes = read_be32(&chunk[2]);
+            comm(&chunk[0], size, aifc);
+        } else if (!std::memcmp(header, "SSND", 4)) {
+            uint8_t v[8];
+            util::check_eof(util::nread(fd(), v, 8) == 8);
+            m_data_pos = pos + 8 + read_be32(v);
+            /* size is left 0 or -1 by some streaming writers */
+            if (size < 8 || size == ~0U) {
+                data_size = _filelengthi64(fd()) - m_data_pos;
+                break;
+            }
+            data_size = std::max(pos + size - m_data_pos,
+                                 static_cast<int64_t>(0));
+        }
+        int64_t next = pos + size + (size & 1);
+        if (next > _filelengthi64(fd()) ||
+            _lseeki64(fd(), next, SEEK_SET) != next)
+            break;
+    }
+    if (!m_block_align)
+        throw std::runtime_error("AIFFSource: COMM chunk not found");
+    if (data_size < 0)
+        throw std::runtime_error("AIFFSource: SSND chunk not found");
+    m_length = data_size / m_block_align;
+    if (nframes && nframes < m_length)
+        m_length = nframes;
+}
+
+void AIFFSource::comm(const uint8_t *chunk, size_t size, bool aifc)
+{
+    unsigned nchannels = read_be16(chunk);
+    unsigned bits      = read_be16(chunk + 6);
+    double   rate      = read_extended(chunk + 8);
+    uint32_t type      = 'NONE';
+    if (aifc) {
+        if (size < 22)
+            throw std::runtime_error("AIFFSource: invalid COMM chunk");
+        type = read_be32(chunk + 18);
+    }
+    bool isfloat = false;
+    switch (type) {
+    case 'NONE': case 'twos': case 'in24': case 'in32':
+        break;
+    case 'sowt':
+        m_big_endian = false;
+        break;
+    case 'fl32': case 'FL32':
+        isfloat = true, bits = 32;
+        break;
+    case 'fl64': case 'FL64':
+        isfloat = true, bits = 64;
+        break;
+    default:
+        throw std::runtime_error("AIFFSource: not supported compression: " +
+                                 std::string(util::fourcc(type)));
+    }
+    if (!nchannels || !(rate > 0) || !bits || bits > 64 ||
+        (!isfloat && bits > 32))
+        throw std::runtime_error("AIFFSource: invalid COMM chunk");
+
+    m_block_align = nchannels * ((bits + 7) / 8);
+    m_asbd = cautil::buildASBDForPCM2(rate, nchannels, bits,
+                                      isfloat ? bits : 32,
+                                      isfloat ? kAudioFormatFlagIsFloat
+                                        : kAudioFormatFlagIsSignedInteger);
+    if (!isfloat)
+        m_unpack = util::get_pcm_unpacker((bits + 7) / 8, m_big_endian,
+                                          false);
+}
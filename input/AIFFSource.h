@@ -0,0 +1,46 @@
+#ifndef AIFFSource_H
+#define AIFFSource_H
+
+#include "ISource.h"
+#include "cautil.h"
+#include "win32util.h"
+
+/*
+ * Native AIFF/AIFC demuxer.
+ * Uncompressed (NONE/twos/sowt/in24/in32) and floating point
+ * (fl32/fl64) AIFC are supported.
+ */
+class AIFFSource: public ISeekableSource, public ITagParser {
+    int m_block_align;
+    bool m_big_endian;
+    int64_t m_data_pos;
+    int64_t m_position;
+    uint64_t m_length;
+    std::shared_ptr<FILE> m_fp;
+    std::map<std::string, std::string> m_tags;
+    util::PooledBuffer m_buffer;
+    util::pcm_unpacker_t m_unpack;
+    AudioStreamBasicDescription m_asbd;
+public:
+    AIFFSource(const std::shared_ptr<FILE> &fp);
+    uint64_t length() const { return m_length; }
+    const AudioStreamBasicDescription &getSampleFormat() const
+    {
+        return m_asbd;
+    }
+    const std::vector<uint32_t> *getChannels() const { return 0; }
+    int64_t getPosition() { return m_position; }
+    size_t readSamples(void *buffer, size_t nsamples);
+    bool isSeekable() { return win32::is_seekable(fileno(m_fp.get())); }
+    void seekTo(int64_t count);
+    const std::map<std::string, std::string> &getTags() const
+    {
+        return m_tags;
+    }
+private:
+    int fd() { return fileno(m_fp.get()); }
+    void parse();
+    void comm(const uint8_t *chunk, size_t size, bool aifc);
+};
+
+#endif
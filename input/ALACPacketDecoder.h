@@ -10,7 +10,7 @@ class ALACPacketDecoder: public IPacketDecoder {
     IPacketFeeder *m_feeder;
     AudioStreamBasicDescription m_iasbd, m_oasbd;
     std::shared_ptr<ALACDecoder> m_decoder;
-    std::vector<uint8_t> m_packet_buffer, m_raw_decode_buffer;
+    util::PooledBuffer m_packet_buffer, m_raw_decode_buffer;
     util::FIFO<int32_t> m_decode_buffer;
 public:
     ALACPacketDecoder(IPacketFeeder *feeder,
@@ -15,6 +15,7 @@ private:
     AvisynthModule& operator=(const AvisynthModule&);
 public:
     static AvisynthModule &instance() {
+        DLLock lock;
         static AvisynthModule self;
         return self;
     }
@@ -37,7 +38,7 @@ class AvisynthSource: public ISeekableSource
 {
     uint64_t m_duration;
     uint64_t m_position;
-    std::vector<uint8_t> m_buffer;
+    util::PooledBuffer m_buffer;
     std::shared_ptr<AVS_ScriptEnvironment> m_script_env;
     std::shared_ptr<AVS_Clip> m_clip;
     AudioStreamBasicDescription m_asbd;
@@ -0,0 +1,386 @@
+#include <cstring>
+#include <algorithm>
+#include <io.h>
+#include "CAFSource.h"
+#include "util.h"
+#include "metadata.h"
+#include "chanmap.h"
+#ifdef QAAC
+#include "CoreAudioPacketDecoder.h"
+#else
+#include "ALACPacketDecoder.h"
+#endif
+
+namespace {
+    enum {
+        kCAFLinearPCMFormatFlagIsFloat        = (1L << 0),
+        kCAFLinearPCMFormatFlagIsLittleEndian = (1L << 1)
+    };
+
+    inline uint32_t read_be32(const uint8_t *p)
+    {
+        return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+    inline uint64_t read_be64(const uint8_t *p)
+    {
+        return static_cast<uint64_t>(read_be32(p)) << 32 | read_be32(p + 4);
+    }
+    /* BER encoded integer used in packet table */
+    bool read_ber(const uint8_t **p, const uint8_t *end, int64_t *value)
+    {
+        int64_t v = 0;
+        for (const uint8_t *q = *p; q < end; ++q) {
+            v = (v << 7) | (*q & 0x7f);
+            if (!(*q & 0x80)) {
+                *p = q + 1;
+                *value = v;
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+CAFSource::CAFSource(const std::shared_ptr<FILE> &fp)
+    : m_block_align(0),
+      m_data_pos(0),
+      m_position(0),
+      m_length(0),
+      m_priming(0),
+      m_current_packet(0),
+      m_start_skip(0),
+      m_fp(fp),
+      m_unpack(0)
+{
+    std::memset(&m_iasbd, 0, sizeof m_iasbd);
+    std::memset(&m_oasbd, 0, sizeof m_oasbd);
+    parse();
+    CHECKCRT(_lseeki64(fd(), m_data_pos, SEEK_SET) < 0);
+}
+
+size_t CAFSource::readSamples(void *buffer, size_t nsamples)
+{
+    nsamples = static_cast<size_t>(std::min(static_cast<uint64_t>(nsamples),
+                                            m_length - m_position));
+    if (!nsamples)
+        return 0;
+    return m_decoder ? readPackets(buffer, nsamples)
+                     : readPCM(buffer, nsamples);
+}
+
+void CAFSource::seekTo(int64_t count)
+{
+    if (!m_decoder) {
+        CHECKCRT(_lseeki64(fd(), m_data_pos + count * m_block_align,
+                           SEEK_SET) < 0);
+        m_position = count;
+        return;
+    }
+    m_decode_buffer.reset();
+    m_decoder->reset();
+    m_position = std::min(static_cast<uint64_t>(count), m_length);
+
+    int64_t target = m_position + m_priming;
+    std::vector<int64_t>::iterator it =
+        std::upper_bound(m_packet_timestamps.begin(),
+                         m_packet_timestamps.end(), target);
+    m_current_packet = it - m_packet_timestamps.begin() - 1;
+    m_start_skip = 0;
+    if (m_current_packet + 1 < m_packet_timestamps.size())
+        m_start_skip = target - m_packet_timestamps[m_current_packet];
+    CHECKCRT(_lseeki64(fd(), m_data_pos + m_packet_offsets[m_current_packet],
+                       SEEK_SET) < 0);
+}
+
+bool CAFSource::feed(std::vector<uint8_t> *buffer)
+{
+    if (m_current_packet + 1 >= m_packet_offsets.size()) {
+        buffer->resize(0);
+        return false;
+    }
+    size_t size = m_packet_offsets[m_current_packet + 1]
+                - m_packet_offsets[m_current_packet];
+    buffer->resize(size);
+    if (util::nread(fd(), buffer->data(), size) != size) {
+        buffer->resize(0);
+        return false;
+    }
+    ++m_current_packet;
+    return true;
+}
+
+void CAFSource::parse()
+{
+    char header[8];
+    util::check_eof(util::nread(fd(), header, 8) == 8);
+    if (std::memcmp(header, "caff", 4))
+        throw std::runtime_error("CAFSource: not a caf file");
+
+    std::vector<uint8_t> chunk, pakt_chunk;
+    int64_t data_size = -1;
+    uint32_t fcc;
+    uint64_t size;
+    for (;;) {
+        size = nextChunk(&fcc);
+        if (!fcc)
+            break;
+        if (fcc == 'desc') {
+            readChunk(&chunk, size);
+            desc(chunk);
+        } else if (!m_iasbd.mFormatID) {
+            throw std::runtime_error("CAFSource: desc chunk is expected");
+        } else if (fcc == 'chan') {
+            readChunk(&chunk, size);
+            chan(chunk);
+        } else if (fcc == 'kuki') {
+            readChunk(&m_magic_cookie, size);
+        } else if (fcc == 'pakt') {
+            readChunk(&pakt_chunk, size);
+        } else if (fcc == 'info') {
+            readChunk(&chunk, size);
+            m_tags = CAF::fetchTags(chunk);
+        } else if (fcc == 'data') {
+            int64_t pos = _lseeki64(fd(), 0, SEEK_CUR);
+            /* data chunk of unknown size (-1) extends to the end of file */
+            if (size == ~0ULL)
+                size = _filelengthi64(fd()) - pos;
+            if (size < 4)
+                throw std::runtime_error("CAFSource: invalid data chunk");
+            m_data_pos = pos + 4; // mEditCount
+            data_size = size - 4;
+            CHECKCRT(_lseeki64(fd(), pos + size, SEEK_SET) < 0);
+        } else {
+            CHECKCRT(_lseeki64(fd(), size, SEEK_CUR) < 0);
+        }
+    }
+    if (data_size < 0)
+        throw std::runtime_error("CAFSource: data chunk not found");
+
+    if (m_iasbd.mFormatID == 'lpcm') {
+        setupPCM();
+        m_length = data_size / m_block_align;
+    } else if (m_iasbd.mFormatID == 'alac') {
+        if (pakt_chunk.empty())
+            throw std::runtime_error("CAFSource: pakt chunk not found");
+        pakt(pakt_chunk, data_size);
+        setupALAC();
+    } else {
+        throw std::runtime_error("CAFSource: not supported format: " +
+                                 std::string(util::fourcc(m_iasbd.mFormatID)));
+    }
+}
+
+uint64_t CAFSource::nextChunk(uint32_t *fcc)
+{
+    uint8_t header[12];
+    *fcc = 0;
+    if (util::nread(fd(), header, 12) != 12)
+        return 0;
+    *fcc = read_be32(header);
+    return read_be64(header + 4);
+}
+
+void CAFSource::readChunk(std::vector<uint8_t> *buffer, uint64_t size)
+{
+    if (size > 0x10000000)
+        throw std::runtime_error("CAFSource: chunk too large");
+    buffer->resize(size);
+    if (size)
+        util::check_eof(util::nread(fd(), buffer->data(), size) == size);
+}
+
+void CAFSource::desc(const std::vector<uint8_t> &chunk)
+{
+    if (chunk.size() < 32)
+        throw std::runtime_error("CAFSource: desc chunk too small");
+    const uint8_t *p = chunk.data();
+    uint64_t rate = read_be64(p);
+    std::memcpy(&m_iasbd.mSampleRate, &rate, 8);
+    m_iasbd.mFormatID         = read_be32(p + 8);
+    m_iasbd.mFormatFlags      = read_be32(p + 12);
+    m_iasbd.mBytesPerPacket   = read_be32(p + 16);
+    m_iasbd.mFramesPerPacket  = read_be32(p + 20);
+    m_iasbd.mChannelsPerFrame = read_be32(p + 24);
+    m_iasbd.mBitsPerChannel   = read_be32(p + 28);
+    if (!m_iasbd.mFormatID || !(m_iasbd.mSampleRate > 0) ||
+        !m_iasbd.mChannelsPerFrame)
+        throw std::runtime_error("CAFSource: invalid desc chunk");
+}
+
+void CAFSource::chan(const std::vector<uint8_t> &chunk)
+{
+    if (chunk.size() < 12)
+        return;
+    size_t ndesc = read_be32(&chunk[8]);
+    if (chunk.size() < 12 + ndesc * 20)
+        return;
+    std::vector<uint8_t> buf(sizeof(AudioChannelLayout) +
+                             ndesc * sizeof(AudioChannelDescription));
+    AudioChannelLayout *acl = reinterpret_cast<AudioChannelLayout*>(&buf[0]);
+    acl->mChannelLayoutTag          = read_be32(&chunk[0]);
+    acl->mChannelBitmap             = read_be32(&chunk[4]);
+    acl->mNumberChannelDescriptions = ndesc;
+    for (size_t i = 0; i < ndesc; ++i)
+        acl->mChannelDescriptions[i].mChannelLabel =
+            read_be32(&chunk[12 + i * 20]);
+    m_chanmap = chanmap::getChannels(acl);
+    if (m_chanmap.size() != m_iasbd.mChannelsPerFrame)
+        m_chanmap.clear();
+}
+
+void CAFSource::pakt(const std::vector<uint8_t> &chunk, int64_t data_size)
+{
+    if (chunk.size() < 24)
+        throw std::runtime_error("CAFSource: pakt chunk too small");
+    const uint8_t *p = chunk.data();
+    const uint8_t *end = p + chunk.size();
+    int64_t npackets = read_be64(p);
+    int64_t nvalid   = read_be64(p + 8);
+    m_priming        = read_be32(p + 16);
+    uint32_t remainder = read_be32(p + 20);
+    p += 24;
+
+    if (npackets < 0 || npackets > end - p + 1)
+        throw std::runtime_error("CAFSource: invalid pakt chunk");
+    m_packet_offsets.reserve(npackets + 1);
+    m_packet_timestamps.reserve(npackets + 1);
+    m_packet_offsets.push_back(0);
+    m_packet_timestamps.push_back(0);
+    for (int64_t i = 0; i < npackets; ++i) {
+        int64_t size = m_iasbd.mBytesPerPacket;
+        int64_t frames = m_iasbd.mFramesPerPacket;
+        if ((!size && !read_ber(&p, end, &size)) ||
+            (!frames && !read_ber(&p, end, &frames)))
+            throw std::runtime_error("CAFSource: invalid pakt chunk");
+        m_packet_offsets.push_back(m_packet_offsets.back() + size);
+        m_packet_timestamps.push_back(m_packet_timestamps.back() + frames);
+    }
+    if (m_packet_offsets.back() > data_size)
+        throw std::runtime_error("CAFSource: pakt doesn't match data chunk");
+
+    int64_t total = m_packet_timestamps.back();
+    if (nvalid <= 0 || m_priming + nvalid > total)
+        nvalid = std::max(total - m_priming - remainder,
+                          static_cast<int64_t>(0));
+    m_length = nvalid;
+}
+
+void CAFSource::setupPCM()
+{
+    const AudioStreamBasicDescription &asbd = m_iasbd;
+    bool isfloat = asbd.mFormatFlags & kCAFLinearPCMFormatFlagIsFloat;
+    unsigned width = asbd.mBytesPerPacket / asbd.mChannelsPerFrame;
+
+    if (asbd.mFramesPerPacket != 1 || !asbd.mBytesPerPacket ||
+        asbd.mBytesPerPacket % asbd.mChannelsPerFrame)
+        throw std::runtime_error("CAFSource: invalid lpcm desc");
+    if (isfloat) {
+        if ((asbd.mBitsPerChannel != 32 && asbd.mBitsPerChannel != 64) ||
+            width * 8 != asbd.mBitsPerChannel)
+            throw std::runtime_error("CAFSource: not supported float format");
+    } else if (!asbd.mBitsPerChannel || width > 4 ||
+               width != (asbd.mBitsPerChannel + 7) / 8)
+        throw std::runtime_error("CAFSource: not supported integer format");
+
+    m_block_align = asbd.mBytesPerPacket;
+    m_oasbd = cautil::buildASBDForPCM2(asbd.mSampleRate,
+                                       asbd.mChannelsPerFrame,
+                                       asbd.mBitsPerChannel,
+                                       isfloat ? asbd.mBitsPerChannel : 32,
+                                       isfloat ? kAudioFormatFlagIsFloat
+                                         : kAudioFormatFlagIsSignedInteger);
+    if (!isfloat) {
+        bool big_endian =
+            !(asbd.mFormatFlags & kCAFLinearPCMFormatFlagIsLittleEndian);
+        m_unpack = util::get_pcm_unpacker(width, big_endian, false);
+    }
+}
+
+void CAFSource::setupALAC()
+{
+    /*
+     * Magic cookie might be wrapped with frma/alac atoms, as in
+     * QuickTime sound description.
+     */
+    const uint8_t *p = m_magic_cookie.data();
+    size_t size = m_magic_cookie.size();
+    if (size >= 12 && !std::memcmp(p + 4, "frma", 4))
+        p += 12, size -= 12;
+    if (size >= 12 && !std::memcmp(p + 4, "alac", 4))
+        p += 12, size -= 12;
+    if (size < 24)
+        throw std::runtime_error("Malformed ALAC magic cookie");
+    std::vector<uint8_t> alac(p, p + 24);
+
+    switch (alac[5]) {
+    case 16: m_iasbd.mFormatFlags = 1; break;
+    case 20: m_iasbd.mFormatFlags = 2; break;
+    case 24: m_iasbd.mFormatFlags = 3; break;
+    case 32: m_iasbd.mFormatFlags = 4; break;
+    default: throw std::runtime_error("Malformed ALAC magic cookie");
+    }
+    /* decoder wants the maximum frame length, even for variable frames */
+    m_iasbd.mFramesPerPacket  = read_be32(&alac[0]);
+    m_iasbd.mChannelsPerFrame = alac[9];
+#ifdef QAAC
+    m_decoder = std::make_shared<CoreAudioPacketDecoder>(this, m_iasbd);
+#else
+    m_decoder = std::make_shared<ALACPacketDecoder>(this, m_iasbd);
+#endif
+    m_decoder->setMagicCookie(alac);
+    m_oasbd = m_decoder->getSampleFormat();
+    m_decode_buffer.set_unit(m_oasbd.mBytesPerFrame);
+    m_start_skip = m_priming;
+}
+
+size_t CAFSource::readPCM(void *buffer, size_t nsamples)
+{
+    size_t nbytes = nsamples * m_block_align;
+    if (m_buffer.size() < nbytes)
+        m_buffer.resize(nbytes);
+    ssize_t n = util::nread(fd(), &m_buffer[0], nbytes);
+    nsamples = n > 0 ? n / m_block_align : 0;
+    if (nsamples) {
+        size_t size = nsamples * m_block_align;
+        unsigned width = m_block_align / m_oasbd.mChannelsPerFrame;
+        if (m_unpack)
+            m_unpack(&m_buffer[0], static_cast<uint32_t *>(buffer),
+                     nsamples * m_oasbd.mChannelsPerFrame);
+        else {
+            if (!(m_iasbd.mFormatFlags &
+                  kCAFLinearPCMFormatFlagIsLittleEndian))
+                util::bswapbuffer(&m_buffer[0], size, width * 8);
+            util::unpack(&m_buffer[0], buffer, &size, width,
+                         m_oasbd.mBytesPerFrame / m_oasbd.mChannelsPerFrame);
+        }
+        m_position += nsamples;
+    }
+    return nsamples;
+}
+
+size_t CAFSource::readPackets(void *buffer, size_t nsamples)
+{
+    while (!m_decode_buffer.count()) {
+        if (m_current_packet + 1 >= m_packet_timestamps.size())
+            return 0;
+        size_t nframes = m_packet_timestamps[m_current_packet + 1]
+                       - m_packet_timestamps[m_current_packet];
+        m_decode_buffer.reserve(nframes);
+        nframes = m_decoder->decode(m_decode_buffer.write_ptr(), nframes);
+        if (!nframes)
+            return 0;
+        m_decode_buffer.commit(nframes);
+        if (m_start_skip >= nframes) {
+            m_decode_buffer.reset();
+            m_start_skip -= nframes;
+        } else if (m_start_skip) {
+            m_decode_buffer.advance(m_start_skip);
+            m_start_skip = 0;
+        }
+    }
+    nsamples = std::min(m_decode_buffer.count(), nsamples);
+    std::memcpy(buffer, m_decode_buffer.read(nsamples),
+                nsamples * m_oasbd.mBytesPerFrame);
+    m_position += nsamples;
+    return nsamples;
+}
@@ -0,0 +1,71 @@
+#ifndef CAFSource_H
+#define CAFSource_H
+
+#include "ISource.h"
+#include "PacketDecoder.h"
+#include "cautil.h"
+#include "win32util.h"
+
+/*
+ * Native CAF demuxer.
+ * LPCM is read directly, ALAC is fed to the packet decoder.
+ * Packet table (pakt) is kept in memory, so that seek can go directly
+ * to the packet containing the target frame.
+ */
+class CAFSource: public ISeekableSource, public ITagParser,
+    public IPacketFeeder
+{
+    int m_block_align;
+    int64_t m_data_pos;
+    int64_t m_position;
+    uint64_t m_length;
+    uint32_t m_priming;
+    size_t m_current_packet;
+    unsigned m_start_skip;
+    std::shared_ptr<FILE> m_fp;
+    std::shared_ptr<IPacketDecoder> m_decoder;
+    std::map<std::string, std::string> m_tags;
+    std::vector<uint32_t> m_chanmap;
+    util::PooledBuffer m_buffer;
+    std::vector<uint8_t> m_magic_cookie;
+    /* byte offset / starting frame of each packet, plus the end */
+    std::vector<int64_t> m_packet_offsets;
+    std::vector<int64_t> m_packet_timestamps;
+    util::FIFO<uint8_t> m_decode_buffer;
+    AudioStreamBasicDescription m_iasbd, m_oasbd;
+    util::pcm_unpacker_t m_unpack;
+public:
+    CAFSource(const std::shared_ptr<FILE> &fp);
+    uint64_t length() const { return m_length; }
+    const AudioStreamBasicDescription &getSampleFormat() const
+    {
+        return m_oasbd;
+    }
+    const std::vector<uint32_t> *getChannels() const
+    {
+        return m_chanmap.size() ? &m_chanmap : 0;
+    }
+    int64_t getPosition() { return m_position; }
+    size_t readSamples(void *buffer, size_t nsamples);
+    bool isSeekable() { return win32::is_seekable(fileno(m_fp.get())); }
+    void seekTo(int64_t count);
+    const std::map<std::string, std::string> &getTags() const
+    {
+        return m_tags;
+    }
+    bool feed(std::vector<uint8_t> *buffer);
+private:
+    int fd() { return fileno(m_fp.get()); }
+    void parse();
+    uint64_t nextChunk(uint32_t *fcc);
+    void readChunk(std::vector<uint8_t> *buffer, uint64_t size);
+    void desc(const std::vector<uint8_t> &chunk);
+    void chan(const std::vector<uint8_t> &chunk);
+    void pakt(const std::vector<uint8_t> &chunk, int64_t data_size);
+    void setupPCM();
+    void setupALAC();
+    size_t readPCM(void *buffer, size_t nsamples);
+    size_t readPackets(void *buffer, size_t nsamples);
+};
+
+#endif
@@ -0,0 +1,278 @@
+#include <io.h>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include "ElementaryStreamReader.h"
+#include "util.h"
+#include "bitstream.h"
+#include "metadata.h"
+
+namespace {
+    inline uint32_t read_be32(const uint8_t *p)
+    {
+        return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+}
+
+ElementaryStreamReader::ElementaryStreamReader(const std::shared_ptr<FILE> &fp)
+    : m_fp(fp),
+      m_buffer(0x10000),
+      m_pos(0),
+      m_end(0),
+      m_is_adts(false),
+      m_length(~0ULL),
+      m_frames_read(0),
+      m_encoder_delay(-1),
+      m_padding(0)
+{
+    std::memset(&m_adts, 0, sizeof m_adts);
+    std::memset(&m_asbd, 0, sizeof m_asbd);
+
+    skipID3v2();
+    /* Don't scan whole file when it's not ours */
+    for (size_t skipped = 0; ; ++m_pos, ++skipped) {
+        if (skipped >= 0x10000 || !fill(ADTS_HEADER_SIZE))
+            throw std::runtime_error("Not an ADTS/MPEG audio stream");
+        if (detectFormat())
+            break;
+    }
+    if (m_is_adts) {
+        static const unsigned rate_tab[] = {
+            96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050,
+            16000, 12000, 11025, 8000, 7350
+        };
+        if (m_adts.number_of_raw_data_blocks)
+            throw std::runtime_error("Multiple raw data blocks in ADTS "
+                                     "frame is not supported");
+        if (!m_adts.channel_configuration)
+            throw std::runtime_error("ADTS with PCE is not supported");
+
+        BitStream bs;
+        bs.put(m_adts.profile + 1, 5); // audioObjectType
+        bs.put(m_adts.sampling_frequency_index, 4);
+        bs.put(m_adts.channel_configuration, 4);
+        bs.put(0, 3); /*
+                       * frameLengthFlag: 1
+                       * dependsOnCoreCoder: 1
+                       * extensionFlag: 1
+                       */
+        std::copy(bs.data(), bs.data() + 2, std::back_inserter(m_config));
+
+        m_asbd.mFormatID         = 'aac ';
+        m_asbd.mSampleRate       = rate_tab[m_adts.sampling_frequency_index];
+        m_asbd.mFramesPerPacket  = 1024;
+        m_asbd.mChannelsPerFrame = m_adts.channel_configuration == 7 ? 8
+                                 : m_adts.channel_configuration;
+    } else {
+        static const uint32_t layer_tab[] = { 0, '.mp3', '.mp2', '.mp1' };
+        m_asbd.mFormatID         = layer_tab[m_mpa.layer];
+        m_asbd.mSampleRate       = m_mpa.sample_rate();
+        m_asbd.mFramesPerPacket  = m_mpa.samples_per_frame();
+        m_asbd.mChannelsPerFrame = m_mpa.is_mono() ? 1 : 2;
+
+        /* Xing/Info/VBRI frame carries no audio, don't copy it */
+        if (m_mpa.layer == 1) {
+            bool is_info;
+            size_t size = m_mpa.frame_size();
+            parseInfoFrame(&m_buffer[0] + m_pos, size, &is_info);
+            if (is_info)
+                m_pos += size;
+        }
+    }
+}
+
+bool ElementaryStreamReader::readPacket(std::vector<uint8_t> *packet)
+{
+    size_t size = syncFrame();
+    if (!size)
+        return false;
+    const uint8_t *p = &m_buffer[0] + m_pos;
+    size_t off = 0;
+    if (m_is_adts)
+        off = (p[1] & 1) ? ADTS_HEADER_SIZE : ADTS_HEADER_SIZE + 2;
+    packet->assign(p + off, p + size);
+    m_pos += size;
+    ++m_frames_read;
+    return true;
+}
+
+AudioFilePacketTableInfo ElementaryStreamReader::getGaplessInfo() const
+{
+    AudioFilePacketTableInfo info = { 0 };
+    int64_t total = m_frames_read * m_asbd.mFramesPerPacket;
+    info.mNumberValidFrames = total;
+    if (m_encoder_delay >= 0 && total > m_encoder_delay + m_padding + 529) {
+        /*
+         * LAME tag only tells encoder delay and padding.
+         * Decoder delay of 528 + 1 samples is added as usual.
+         */
+        info.mPrimingFrames = m_encoder_delay + 529;
+        info.mNumberValidFrames = std::min(total - m_encoder_delay - m_padding,
+                                           total - info.mPrimingFrames);
+        info.mRemainderFrames =
+            total - info.mPrimingFrames - info.mNumberValidFrames;
+    }
+    return info;
+}
+
+bool ElementaryStreamReader::fill(size_t size)
+{
+    if (m_end - m_pos >= size)
+        return true;
+    std::memmove(&m_buffer[0], &m_buffer[0] + m_pos, m_end - m_pos);
+    m_end -= m_pos;
+    m_pos = 0;
+    if (m_buffer.size() < size)
+        m_buffer.resize(size);
+    ssize_t n = util::nread(fd(), &m_buffer[0] + m_end,
+                            m_buffer.size() - m_end);
+    if (n > 0)
+        m_end += n;
+    return m_end - m_pos >= size;
+}
+
+void ElementaryStreamReader::skipID3v2()
+{
+    if (!fill(10) || std::memcmp(&m_buffer[0], "ID3", 3))
+        return;
+    const uint8_t *p = &m_buffer[0];
+    uint64_t size = 10 + ((p[6] << 21) | (p[7] << 14) | (p[8] << 7) | p[9]);
+    if (p[5] & 0x10) /* footer present */
+        size += 10;
+    if (win32::is_seekable(fd())) {
+        try {
+            m_tags = ID3::fetchMPEGID3Tags(fd());
+        } catch (...) {}
+    }
+    for (;;) {
+        size_t n = std::min(size, static_cast<uint64_t>(m_end - m_pos));
+        m_pos += n;
+        size -= n;
+        if (!size || !fill(1))
+            break;
+    }
+}
+
+bool ElementaryStreamReader::parseADTSHeader(const uint8_t *p, ADTSHeader *h)
+{
+    if (p[0] != 0xff || (p[1] & 0xf6) != 0xf0)
+        return false;
+    h->protection_absent          = p[1] & 0x1;
+    h->profile                    = p[2] >> 6;
+    h->sampling_frequency_index   = (p[2] >> 2) & 0xf;
+    h->channel_configuration      = ((p[2] & 0x1) << 2) | (p[3] >> 6);
+    h->frame_length               = ((p[3] & 0x3) << 11) | (p[4] << 3)
+                                  | (p[5] >> 5);
+    h->number_of_raw_data_blocks  = p[6] & 0x3;
+
+    size_t header_size = ADTS_HEADER_SIZE + (h->protection_absent ? 0 : 2);
+    return h->sampling_frequency_index < 13 && h->frame_length > header_size;
+}
+
+bool ElementaryStreamReader::parseMPAHeader(const uint8_t *p, MPAHeader *h)
+{
+    try {
+        h->fill(p);
+    } catch (...) {
+        return false;
+    }
+    /* free format is not supported */
+    return h->bitrate_index != 0;
+}
+
+size_t ElementaryStreamReader::matchFrame(const uint8_t *p)
+{
+    if (m_is_adts) {
+        ADTSHeader h;
+        if (!parseADTSHeader(p, &h)
+         || h.profile != m_adts.profile
+         || h.sampling_frequency_index != m_adts.sampling_frequency_index
+         || h.channel_configuration != m_adts.channel_configuration)
+            return 0;
+        if (h.number_of_raw_data_blocks)
+            throw std::runtime_error("Multiple raw data blocks in ADTS "
+                                     "frame is not supported");
+        return h.frame_length;
+    } else {
+        MPAHeader h;
+        if (!parseMPAHeader(p, &h)
+         || h.IDex != m_mpa.IDex
+         || h.ID != m_mpa.ID
+         || h.layer != m_mpa.layer
+         || h.sampling_frequency != m_mpa.sampling_frequency)
+            return 0;
+        return h.frame_size();
+    }
+}
+
+size_t ElementaryStreamReader::syncFrame()
+{
+    while (fill(ADTS_HEADER_SIZE)) {
+        size_t size = matchFrame(&m_buffer[0] + m_pos);
+        if (size)
+            return fill(size) ? size : 0;
+        ++m_pos;
+    }
+    return 0;
+}
+
+bool ElementaryStreamReader::detectFormat()
+{
+    const uint8_t *p = &m_buffer[0] + m_pos;
+    size_t size;
+    if (parseADTSHeader(p, &m_adts)) {
+        m_is_adts = true;
+        size = m_adts.frame_length;
+    } else if (parseMPAHeader(p, &m_mpa)) {
+        m_is_adts = false;
+        size = m_mpa.frame_size();
+    } else
+        return false;
+    /*
+     * A sync word can appear by chance, therefore also check the next
+     * frame (unless the stream ends here).
+     */
+    if (fill(size + ADTS_HEADER_SIZE))
+        return matchFrame(&m_buffer[0] + m_pos + size) > 0;
+    return fill(size);
+}
+
+void ElementaryStreamReader::parseInfoFrame(const uint8_t *frame, size_t size,
+                                            bool *is_info)
+{
+    const uint8_t *endp = frame + size;
+    const uint8_t *p = frame + m_mpa.side_info_end();
+    uint32_t spf = m_mpa.samples_per_frame();
+
+    *is_info = false;
+    if (endp - frame >= 36 + 18 && !std::memcmp(frame + 36, "VBRI", 4)) {
+        *is_info = true;
+        m_length = static_cast<uint64_t>(read_be32(frame + 36 + 14)) * spf;
+        return;
+    }
+    if (endp - p < 8 || (std::memcmp(p, "Xing", 4) &&
+                         std::memcmp(p, "Info", 4)))
+        return;
+    *is_info = true;
+    uint32_t flags = read_be32(p + 4);
+    p += 8;
+    if (flags & 0x1) {
+        if (endp - p < 4) return;
+        m_length = static_cast<uint64_t>(read_be32(p)) * spf;
+        p += 4;
+    }
+    if (flags & 0x2) p += 4;   /* bytes */
+    if (flags & 0x4) p += 100; /* TOC */
+    if (flags & 0x8) p += 4;   /* quality */
+    /*
+     * LAME tag. Encoder delay and padding are stored as 12 bits each,
+     * at offset 21. Lavf/Lavc also writes them in the same layout.
+     */
+    if (endp - p >= 24 && (!std::memcmp(p, "LAME", 4) ||
+                           !std::memcmp(p, "Lavf", 4) ||
+                           !std::memcmp(p, "Lavc", 4)))
+    {
+        m_encoder_delay = (p[21] << 4) | (p[22] >> 4);
+        m_padding = ((p[22] & 0xf) << 8) | p[23];
+    }
+}
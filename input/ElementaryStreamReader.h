@@ -0,0 +1,63 @@
+#ifndef _ELEMENTARYSTREAMREADER_H
+#define _ELEMENTARYSTREAMREADER_H
+
+#include "ISource.h"
+#include "CoreAudioToolbox.h"
+#include "MPAHeader.h"
+#include "win32util.h"
+
+/*
+ * Splits ADTS or MPEG-1/2 audio elementary stream into raw access units,
+ * without decoding them. Used for remuxing into MP4.
+ */
+class ElementaryStreamReader: public ITagParser {
+    enum { ADTS_HEADER_SIZE = 7 };
+    struct ADTSHeader {
+        unsigned profile;
+        unsigned sampling_frequency_index;
+        unsigned channel_configuration;
+        unsigned protection_absent;
+        unsigned frame_length;
+        unsigned number_of_raw_data_blocks;
+    };
+    std::shared_ptr<FILE> m_fp;
+    std::vector<uint8_t> m_buffer;
+    size_t m_pos, m_end;
+    bool m_is_adts;
+    ADTSHeader m_adts;
+    MPAHeader m_mpa;
+    AudioStreamBasicDescription m_asbd;
+    std::vector<uint8_t> m_config;
+    uint64_t m_length;
+    uint64_t m_frames_read;
+    int32_t m_encoder_delay, m_padding;
+    std::map<std::string, std::string> m_tags;
+public:
+    ElementaryStreamReader(const std::shared_ptr<FILE> &fp);
+    uint64_t length() const { return m_length; }
+    const AudioStreamBasicDescription &getSampleFormat() const
+    {
+        return m_asbd;
+    }
+    /* AudioSpecificConfig. Empty for MPEG-1/2 audio */
+    const std::vector<uint8_t> &getDecoderConfig() const { return m_config; }
+    const std::map<std::string, std::string> &getTags() const
+    {
+        return m_tags;
+    }
+    int64_t getPosition() { return m_frames_read * m_asbd.mFramesPerPacket; }
+    bool readPacket(std::vector<uint8_t> *packet);
+    AudioFilePacketTableInfo getGaplessInfo() const;
+private:
+    int fd() { return fileno(m_fp.get()); }
+    bool fill(size_t size);
+    void skipID3v2();
+    bool parseADTSHeader(const uint8_t *p, ADTSHeader *h);
+    bool parseMPAHeader(const uint8_t *p, MPAHeader *h);
+    size_t matchFrame(const uint8_t *p);
+    size_t syncFrame();
+    bool detectFormat();
+    void parseInfoFrame(const uint8_t *frame, size_t size, bool *is_info);
+};
+
+#endif
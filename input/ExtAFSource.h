@@ -14,7 +14,7 @@ class ExtAFSource: public ISeekableSource, public ITagParser
     std::shared_ptr<FILE> m_fp;
     std::vector<uint32_t> m_chanmap;
     std::map<std::string, std::string> m_tags;
-    std::vector<uint8_t> m_buffer;
+    util::PooledBuffer m_buffer;
     AudioStreamBasicDescription m_iasbd, m_asbd;
 public:
     ExtAFSource(const std::shared_ptr<FILE> &fp);
@@ -16,6 +16,7 @@ private:
     FLACModule& operator=(const FLACModule&);
 public:
     static FLACModule &instance() {
+        DLLock lock;
         static FLACModule self;
         return self;
     }
@@ -3,6 +3,8 @@
 #ifdef QAAC
 #include "ExtAFSource.h"
 #endif
+#include "AIFFSource.h"
+#include "CAFSource.h"
 #include "FLACSource.h"
 #include "LibSndfileSource.h"
 #include "RawSource.h"
@@ -46,13 +48,35 @@ std::shared_ptr<ISeekableSource> InputFactory::open(const wchar_t *path)
     if (!win32::is_seekable(fileno(fp.get())))
         throw std::runtime_error("Not available input file format");
 
+    /*
+     * Peek at the magic so that FLAC/WavPack/TAK libraries don't get
+     * loaded only to reject a file that cannot be theirs.
+     * ID3v2 prefixed files are handed to everyone, as before.
+     */
+    char magic[4] = { 0 };
+    util::nread(fileno(fp.get()), magic, 4);
+    _lseeki64(fileno(fp.get()), 0, SEEK_SET);
+    uint32_t fcc = util::fourcc(magic);
+    bool id3 = std::memcmp(magic, "ID3", 3) == 0;
+
+    /*
+     * Formats our own demuxers don't support (such as AAC in CAF) fall
+     * through to ExtAudioFile or libsndfile.
+     */
+    if (fcc == 'caff')
+        TRY_MAKE_SHARED(CAFSource, fp);
+    if (fcc == 'FORM')
+        TRY_MAKE_SHARED(AIFFSource, fp);
     TRY_MAKE_SHARED(MP4Source, fp);
 #ifdef QAAC
     TRY_MAKE_SHARED(ExtAFSource, fp);
 #endif
-    TRY_MAKE_SHARED(FLACSource, fp);
-    TRY_MAKE_SHARED(WavpackSource, path);
-    TRY_MAKE_SHARED(TakSource, fp);
+    if (id3 || fcc == 'fLaC' || fcc == 'OggS')
+        TRY_MAKE_SHARED(FLACSource, fp);
+    if (id3 || fcc == 'wvpk')
+        TRY_MAKE_SHARED(WavpackSource, path);
+    if (id3 || fcc == 'tBaK')
+        TRY_MAKE_SHARED(TakSource, fp);
     TRY_MAKE_SHARED(LibSndfileSource, fp);
     throw std::runtime_error("Not available input file format");
 }
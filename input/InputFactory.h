@@ -24,6 +24,10 @@ public:
         m_raw_format = asbd;
         m_is_raw = true;
     }
+    void clearRawFormat()
+    {
+        m_is_raw = false;
+    }
     void setIgnoreLength(bool cond)
     {
         m_ignore_length = cond;
@@ -1,6 +1,4 @@
 #include "LibSndfileSource.h"
-#include <vorbisfile.h>
-#include "taglibhelper.h"
 #include "win32util.h"
 #include "metadata.h"
 #include "cautil.h"
@@ -173,7 +171,7 @@ LibSndfileSource::LibSndfileSource(const std::shared_ptr<FILE> &fp)
     else if (m_format_name == "caf")
         m_tags = CAF::fetchTags(fileno(m_fp.get()));
     else if (m_format_name == "oga")
-        fetchVorbisTags();
+        m_tags = Vorbis::fetchOggTags(fileno(m_fp.get()));
 }
 
 void LibSndfileSource::seekTo(int64_t count)
@@ -189,31 +187,3 @@ int64_t LibSndfileSource::getPosition()
         throw std::runtime_error("sf_seek() failed");
     return pos;
 }
-
-void LibSndfileSource::fetchVorbisTags()
-{
-    int fd = fileno(m_fp.get());
-    util::FilePositionSaver _(fd);
-    lseek(fd, 0, SEEK_SET);
-    TagLibX::FDIOStreamReader stream(fd);
-    TagLib::Ogg::Vorbis::File file(&stream, false);
-
-    std::map<std::string, std::string> tags;
-
-    auto tag = file.tag();
-    auto &map = tag->fieldListMap();
-    for (auto it = map.begin(); it != map.end(); ++it) {
-        std::string key = it->first.toCString();
-        std::wstring value = it->second.toString().toWString();
-        tags[key] = strutil::w2us(value);
-    }
-    m_tags = TextBasedTag::normalizeTags(tags);
-
-    auto pics = tag->pictureList();
-    for (auto it = pics.begin(); it != pics.end(); ++it) {
-        if ((*it)->type() == TagLib::FLAC::Picture::FrontCover) {
-            auto data = (*it)->data();
-            m_tags["COVER ART"] = std::string(data.begin(), data.end());
-        }
-    }
-}
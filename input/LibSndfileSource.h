@@ -18,6 +18,7 @@ private:
     LibSndfileModule& operator=(const LibSndfileModule&);
 public:
     static LibSndfileModule &instance() {
+        DLLock lock;
         static LibSndfileModule self;
         return self;
     }
@@ -71,8 +72,6 @@ public:
     void seekTo(int64_t count);
     int64_t getPosition();
     const std::map<std::string, std::string> &getTags() const { return m_tags; }
-private:
-    void fetchVorbisTags();
 };
 
 #endif
@@ -4,7 +4,7 @@
 
 RawSource::RawSource(const std::shared_ptr<FILE> &fp,
                      const AudioStreamBasicDescription &asbd)
-    : m_position(0), m_fp(fp), m_asbd(asbd)
+    : m_position(0), m_fp(fp), m_unpack(0), m_asbd(asbd)
 {
     if (isSeekable())
         m_length = _filelengthi64(fileno(m_fp.get())) / asbd.mBytesPerFrame;
@@ -17,34 +17,31 @@ RawSource::RawSource(const std::shared_ptr<FILE> &fp,
                                        isfloat ? asbd.mBitsPerChannel : 32,
                                        isfloat ? kAudioFormatFlagIsFloat
                                           : kAudioFormatFlagIsSignedInteger);
+    if (!isfloat)
+        m_unpack = util::get_pcm_unpacker(
+                asbd.mBytesPerFrame / asbd.mChannelsPerFrame,
+                asbd.mFormatFlags & kAudioFormatFlagIsBigEndian,
+                !(asbd.mFormatFlags & kAudioFormatFlagIsSignedInteger));
 }
 
 size_t RawSource::readSamples(void *buffer, size_t nsamples)
 {
+    /* float doesn't change the sample width, and is read in place */
+    uint8_t *bp = static_cast<uint8_t*>(buffer);
     ssize_t nbytes = nsamples * m_asbd.mBytesPerFrame;
-    if (m_buffer.size() < nbytes)
-        m_buffer.resize(nbytes);
-    nbytes = util::nread(fileno(m_fp.get()), &m_buffer[0], nbytes);
-    nsamples = nbytes > 0 ? nbytes / m_asbd.mBytesPerFrame : 0;
-    if (nsamples) {
-        size_t size = nsamples * m_asbd.mBytesPerFrame;
-
-        /* bswap */
-        if (m_asbd.mFormatFlags & kAudioFormatFlagIsBigEndian)
-            util::bswapbuffer(&m_buffer[0], size,
-                              (m_asbd.mBitsPerChannel + 7) & ~7);
-
-        util::unpack(&m_buffer[0], buffer, &size,
-                     m_asbd.mBytesPerFrame / m_asbd.mChannelsPerFrame,
-                     m_oasbd.mBytesPerFrame / m_oasbd.mChannelsPerFrame);
-        /* convert to signed */
-        if (!(m_asbd.mFormatFlags & kAudioFormatFlagIsFloat) &&
-            !(m_asbd.mFormatFlags & kAudioFormatFlagIsSignedInteger))
-        {
-            util::convert_sign(static_cast<uint32_t *>(buffer),
-                               nsamples * m_asbd.mChannelsPerFrame);
-        }
+    if (m_unpack) {
+        if (m_buffer.size() < nbytes)
+            m_buffer.resize(nbytes);
+        bp = &m_buffer[0];
     }
+    nbytes = util::nread(fileno(m_fp.get()), bp, nbytes);
+    nsamples = nbytes > 0 ? nbytes / m_asbd.mBytesPerFrame : 0;
+    if (nsamples && m_unpack)
+        m_unpack(bp, static_cast<uint32_t *>(buffer),
+                 nsamples * m_asbd.mChannelsPerFrame);
+    else if (nsamples && (m_asbd.mFormatFlags & kAudioFormatFlagIsBigEndian))
+        util::bswapbuffer(bp, nsamples * m_asbd.mBytesPerFrame,
+                          m_asbd.mBitsPerChannel);
     m_position += nsamples;
     return nsamples;
 }
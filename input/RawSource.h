@@ -8,7 +8,8 @@ class RawSource: public ISeekableSource {
     uint64_t m_length;
     int64_t m_position;
     std::shared_ptr<FILE> m_fp;
-    std::vector<uint8_t> m_buffer;
+    util::PooledBuffer m_buffer;
+    util::pcm_unpacker_t m_unpack;
     AudioStreamBasicDescription m_asbd, m_oasbd;
 public:
     RawSource(const std::shared_ptr<FILE> &fp,
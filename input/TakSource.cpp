@@ -4,9 +4,6 @@
 #include "strutil.h"
 #include "win32util.h"
 #include "metadata.h"
-#include <apefile.h>
-#include <apetag.h>
-#include "taglibhelper.h"
 #include "cautil.h"
 
 #define CHECK(expr) do { if (!(expr)) throw std::runtime_error("!?"); } \
@@ -124,7 +121,7 @@ TakSource::TakSource(const std::shared_ptr<FILE> &fp)
             m_chanmap.push_back(a[i]);
     }
     try {
-        fetchTags();
+        m_tags = APE::fetchTags(fileno(m_fp.get()));
     } catch (...) {}
 }
 
@@ -160,37 +157,3 @@ size_t TakSource::readSamples(void *buffer, size_t nsamples)
     }
     return nread;
 }
-
-void TakSource::fetchTags()
-{
-    int fd = fileno(m_fp.get());
-    util::FilePositionSaver _(fd);
-    lseek(fd, 0, SEEK_SET);
-    TagLibX::FDIOStreamReader stream(fd);
-    TagLib::APE::File file(&stream, false);
-
-    std::map<std::string, std::string> tags;
-    std::string cover;
-
-    TagLib::APE::Tag *tag = file.APETag(false);
-    const TagLib::APE::ItemListMap &itemListMap = tag->itemListMap();
-    TagLib::APE::ItemListMap::ConstIterator it;
-    for (it = itemListMap.begin(); it != itemListMap.end(); ++it) {
-        std::string key = it->first.toCString();
-        if (it->second.type() == TagLib::APE::Item::Text) {
-            std::wstring value = it->second.toString().toWString();
-            tags[key] = strutil::w2us(value);
-        } else if (it->second.type() == TagLib::APE::Item::Binary) {
-            if (strcasecmp(key.c_str(), "Cover Art (Front)"))
-                continue;
-            TagLib::ByteVector vec = it->second.binaryData();
-            // strip filename\0 at the beginning
-            auto pos = std::find(vec.begin(), vec.end(), '\0');
-            std::rotate(vec.begin(), pos + 1, vec.end());
-            vec.resize(vec.end() - pos - 1);
-            cover.assign(vec.begin(), vec.end());
-        }
-    }
-    m_tags = TextBasedTag::normalizeTags(tags);
-    if (cover.size()) m_tags["COVER ART"] = cover;
-}
@@ -35,6 +35,7 @@ private:
     TakModule& operator=(const TakModule&);
 public:
     static TakModule &instance() {
+        DLLock lock;
         static TakModule self;
         return self;
     }
@@ -65,7 +66,7 @@ class TakSource: public ISeekableSource, public ITagParser {
     std::shared_ptr<FILE> m_fp;
     std::vector<uint32_t> m_chanmap;
     std::map<std::string, std::string> m_tags;
-    std::vector<uint8_t> m_buffer;
+    util::PooledBuffer m_buffer;
     AudioStreamBasicDescription m_asbd;
     TakModule &m_module;
 public:
@@ -86,7 +87,6 @@ public:
     void seekTo(int64_t count);
     const std::map<std::string, std::string> &getTags() const { return m_tags; }
 private:
-    void fetchTags();
     static void staticDamageCallback(void *ctx, PtakSSDDamageItem info)
     {
         throw std::runtime_error("TAK: damaged frame found");
@@ -21,7 +21,7 @@ namespace wave {
 }
 
 WaveSource::WaveSource(const std::shared_ptr<FILE> &fp, bool ignorelength)
-    : m_data_pos(0), m_position(0), m_fp(fp)
+    : m_data_pos(0), m_position(0), m_fp(fp), m_unpack(0)
 {
     std::memset(&m_asbd, 0, sizeof m_asbd);
     m_seekable = win32::is_seekable(fileno(m_fp.get()));
@@ -49,14 +49,14 @@ size_t WaveSource::readSamples(void *buffer, size_t nsamples)
     nbytes = util::nread(fd(), &m_buffer[0], nbytes);
     nsamples = nbytes > 0 ? nbytes / m_block_align: 0;
     if (nsamples) {
-        size_t size = nsamples * m_block_align;
-        util::unpack(&m_buffer[0], buffer, &size,
-                     m_block_align / m_asbd.mChannelsPerFrame,
-                     m_asbd.mBytesPerFrame / m_asbd.mChannelsPerFrame);
-        /* convert to signed */
-        if (m_asbd.mBitsPerChannel <= 8) {
-            util::convert_sign(static_cast<uint32_t *>(buffer),
-                               nsamples * m_asbd.mChannelsPerFrame);
+        if (m_unpack)
+            m_unpack(&m_buffer[0], static_cast<uint32_t *>(buffer),
+                     nsamples * m_asbd.mChannelsPerFrame);
+        else {
+            size_t size = nsamples * m_block_align;
+            util::unpack(&m_buffer[0], buffer, &size,
+                         m_block_align / m_asbd.mChannelsPerFrame,
+                         m_asbd.mBytesPerFrame / m_asbd.mChannelsPerFrame);
         }
         m_position += nsamples;
     }
@@ -244,4 +244,8 @@ void WaveSource::fmt(size_t size)
                                       wValidBitsPerSample, bits,
                                       isfloat ? kAudioFormatFlagIsFloat
                                         : kAudioFormatFlagIsSignedInteger);
+    /* 8bit wave is unsigned */
+    if (!isfloat)
+        m_unpack = util::get_pcm_unpacker(nBlockAlign / nChannels, false,
+                                          wValidBitsPerSample <= 8);
 }
@@ -24,7 +24,8 @@ class WaveSource: public ISeekableSource {
     uint64_t m_length;
     std::shared_ptr<FILE> m_fp;
     std::vector<uint32_t> m_chanmap;
-    std::vector<uint8_t> m_buffer;
+    util::PooledBuffer m_buffer;
+    util::pcm_unpacker_t m_unpack;
     AudioStreamBasicDescription m_asbd;
 public:
     WaveSource(const std::shared_ptr<FILE> &fp, bool ignorelength = false);
@@ -1,4 +1,5 @@
 #include <io.h>
+#include <process.h>
 #include <sys/stat.h>
 #include "WavpackSource.h"
 #include <wavpack.h>
@@ -101,10 +102,178 @@ namespace wavpack {
     {
         return win32::is_seekable(fd(cookie));
     }
+
+    /*
+     * In-memory stream of consecutive blocks, handed to a worker.
+     * Reported as non-seekable, so that the library doesn't go looking
+     * for the end of file.
+     */
+    struct MemoryStream {
+        const uint8_t *data;
+        int64_t size, pos;
+    };
+    static int32_t mread(void *cookie, void *data, int32_t count)
+    {
+        MemoryStream *ms = static_cast<MemoryStream*>(cookie);
+        int32_t n = static_cast<int32_t>(std::min(static_cast<int64_t>(count),
+                                                  ms->size - ms->pos));
+        std::memcpy(data, ms->data + ms->pos, n);
+        ms->pos += n;
+        return n;
+    }
+    static int64_t mtell(void *cookie)
+    {
+        return static_cast<MemoryStream*>(cookie)->pos;
+    }
+    static uint32_t mtell32(void *cookie)
+    {
+        return static_cast<uint32_t>(mtell(cookie));
+    }
+    static int mseek(void *cookie, int64_t off, int whence)
+    {
+        MemoryStream *ms = static_cast<MemoryStream*>(cookie);
+        int64_t base = whence == SEEK_SET ? 0
+                     : whence == SEEK_CUR ? ms->pos : ms->size;
+        if (base + off < 0 || base + off > ms->size)
+            return -1;
+        ms->pos = base + off;
+        return 0;
+    }
+    static int mseek32(void *cookie, int32_t off, int whence)
+    {
+        return mseek(cookie, off, whence);
+    }
+    static int mseek_abs(void *cookie, int64_t pos)
+    {
+        return mseek(cookie, pos, SEEK_SET);
+    }
+    static int mseek_abs32(void *cookie, uint32_t pos)
+    {
+        return mseek_abs(cookie, pos);
+    }
+    static int mpushback(void *cookie, int c)
+    {
+        MemoryStream *ms = static_cast<MemoryStream*>(cookie);
+        if (ms->pos > 0) --ms->pos;
+        return c;
+    }
+    static int64_t msize(void *cookie)
+    {
+        return static_cast<MemoryStream*>(cookie)->size;
+    }
+    static uint32_t msize32(void *cookie)
+    {
+        return static_cast<uint32_t>(msize(cookie));
+    }
+    static int mseekable(void *)
+    {
+        return 0;
+    }
 }
 
+/*
+ * Decodes a batch of frames on its own thread, with its own decoder
+ * context. Owned and driven by WavpackSource; start() and wait() are
+ * always called from the thread reading the source.
+ */
+struct WavpackSource::Worker {
+    WavpackModule &module;
+    unsigned nchannels;
+    std::vector<uint8_t> input;
+    std::vector<int32_t> output;
+    size_t nsamples, decoded, consumed;
+    bool has_job, running, quit;
+    std::string error;
+    std::shared_ptr<void> start_event, done_event, thread;
+
+    Worker(WavpackModule &module, unsigned nchannels)
+        : module(module), nchannels(nchannels), nsamples(0), decoded(0),
+          consumed(0), has_job(false), running(false), quit(false)
+    {
+        HANDLE h;
+        if (!(h = CreateEventW(0, FALSE, FALSE, 0)))
+            win32::throw_error("CreateEvent", GetLastError());
+        start_event.reset(h, CloseHandle);
+        if (!(h = CreateEventW(0, FALSE, FALSE, 0)))
+            win32::throw_error("CreateEvent", GetLastError());
+        done_event.reset(h, CloseHandle);
+        intptr_t th = _beginthreadex(0, 0, threadProc, this, 0, 0);
+        if (th == -1)
+            throw std::runtime_error(std::strerror(errno));
+        thread.reset(reinterpret_cast<HANDLE>(th), CloseHandle);
+    }
+    ~Worker()
+    {
+        if (running)
+            WaitForSingleObject(done_event.get(), INFINITE);
+        quit = true;
+        SetEvent(start_event.get());
+        WaitForSingleObject(thread.get(), INFINITE);
+    }
+    void start()
+    {
+        running = true;
+        SetEvent(start_event.get());
+    }
+    void wait()
+    {
+        if (running) {
+            WaitForSingleObject(done_event.get(), INFINITE);
+            running = false;
+        }
+        if (!error.empty())
+            throw std::runtime_error(error);
+    }
+    void decode()
+    {
+        static WavpackStreamReader reader32 = {
+            wavpack::mread, wavpack::mtell32, wavpack::mseek_abs32,
+            wavpack::mseek32, wavpack::mpushback, wavpack::msize32,
+            wavpack::mseekable, nullptr
+        };
+        static WavpackStreamReader64 reader64 = {
+            wavpack::mread, nullptr, wavpack::mtell, wavpack::mseek_abs,
+            wavpack::mseek, wavpack::mpushback, wavpack::msize,
+            wavpack::mseekable, nullptr, nullptr
+        };
+        wavpack::MemoryStream ms = { input.data(), input.size(), 0 };
+        char msg[0x100];
+        int flags = OPEN_NORMALIZE | OPEN_STREAMING;
+        WavpackContext *wpc = module.OpenFileInputEx64
+            ? module.OpenFileInputEx64(&reader64, &ms, 0, msg, flags, 0)
+            : module.OpenFileInputEx(&reader32, &ms, 0, msg, flags, 0);
+        if (!wpc)
+            throw std::runtime_error(strutil::format("WavPack: %s", msg));
+        std::shared_ptr<void> wpcPtr(wpc, module.CloseFile);
+        output.resize(nsamples * nchannels);
+        decoded = module.UnpackSamples(wpc, output.data(), nsamples);
+    }
+    static unsigned __stdcall threadProc(void *arg)
+    {
+        Worker *self = static_cast<Worker*>(arg);
+        for (;;) {
+            WaitForSingleObject(self->start_event.get(), INFINITE);
+            if (self->quit)
+                break;
+            try {
+                self->decode();
+            } catch (const std::exception &e) {
+                self->error = e.what();
+            }
+            SetEvent(self->done_event.get());
+        }
+        return 0;
+    }
+};
+
 WavpackSource::WavpackSource(const std::wstring &path)
-    : m_module(WavpackModule::instance())
+    : m_position(0),
+      m_num_workers(0),
+      m_next_frame(0),
+      m_current_worker(0),
+      m_start_skip(0),
+      m_workers_started(false),
+      m_module(WavpackModule::instance())
 {
     char error[0x100];
     static WavpackStreamReader reader32 = {
@@ -160,10 +329,42 @@ WavpackSource::WavpackSource(const std::wstring &path)
     m_chanmap = chanmap::getChannels(mask, m_asbd.mChannelsPerFrame);
 
     fetchTags();
+
+    /*
+     * Blocks are independently decodable, therefore we decode them
+     * in parallel when possible. Correction file is not split into
+     * blocks here, and DSD decimation carries state across blocks,
+     * so these are decoded serially.
+     */
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    if (si.dwNumberOfProcessors > 1 && !m_cfp.get() && parseFrames())
+        m_num_workers = std::min(si.dwNumberOfProcessors, 8UL);
 }
 
 void WavpackSource::seekTo(int64_t count)
 {
+    if (m_num_workers) {
+        for (size_t i = 0; i < m_workers.size(); ++i) {
+            m_workers[i]->wait();
+            m_workers[i]->has_job = false;
+        }
+        int64_t target = m_frames[0].index + count;
+        size_t lo = 0, hi = m_frames.size();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (m_frames[mid].index + m_frames[mid].samples <= target)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        m_next_frame = lo;
+        m_start_skip = lo < m_frames.size() ? target - m_frames[lo].index : 0;
+        m_current_worker = 0;
+        m_workers_started = false;
+        m_position = count;
+        return;
+    }
     int rc = m_module.SeekSample64 ? m_module.SeekSample64(m_wpc.get(), count)
                                    : m_module.SeekSample(m_wpc.get(), count);
     if (!rc) throw std::runtime_error("WavpackSeekSample()");
@@ -171,6 +372,8 @@ void WavpackSource::seekTo(int64_t count)
 
 int64_t WavpackSource::getPosition()
 {
+    if (m_num_workers)
+        return m_position;
     return m_module.GetSampleIndex64 ? m_module.GetSampleIndex64(m_wpc.get())
                                      : m_module.GetSampleIndex(m_wpc.get());
 }
@@ -244,6 +447,111 @@ void WavpackSource::fetchTags()
     }
 }
 
+bool WavpackSource::parseFrames()
+{
+    int fd = fileno(m_fp.get());
+    if (!win32::is_seekable(fd))
+        return false;
+    util::FilePositionSaver saver__(fd);
+    int64_t size = _filelengthi64(fd);
+    int64_t pos = 0;
+    WavpackHeader hdr;
+    std::vector<Frame> frames;
+
+    for (; pos + static_cast<int64_t>(sizeof hdr) <= size;
+         pos += hdr.ckSize + 8)
+    {
+        if (_lseeki64(fd, pos, SEEK_SET) != pos ||
+            util::nread(fd, &hdr, sizeof hdr) != sizeof hdr ||
+            std::memcmp(hdr.ckID, "wvpk", 4))
+            break; // APE tag or garbage at the end
+        if (hdr.ckSize < sizeof hdr - 8 || pos + hdr.ckSize + 8 > size)
+            return false;
+        if (hdr.flags & DSD_FLAG)
+            return false;
+        if (!hdr.block_samples)
+            continue;
+        int64_t index = GET_BLOCK_INDEX(hdr);
+        if (hdr.flags & INITIAL_BLOCK) {
+            Frame frame = { pos, index, 0, hdr.block_samples };
+            if (frames.size() &&
+                frames.back().index + frames.back().samples != index)
+                return false;
+            frames.push_back(frame);
+        } else if (!frames.size() || frames.back().index != index)
+            return false;
+        frames.back().size = static_cast<uint32_t>(pos + hdr.ckSize + 8
+                                                   - frames.back().offset);
+    }
+    if (frames.size() < 2)
+        return false;
+    m_frames.swap(frames);
+    return true;
+}
+
+void WavpackSource::startWorkers()
+{
+    while (m_workers.size() < m_num_workers)
+        m_workers.push_back(std::make_shared<Worker>(m_module,
+                                                     m_asbd.mChannelsPerFrame));
+    for (size_t i = 0; i < m_workers.size(); ++i)
+        submit(m_workers[(m_current_worker + i) % m_workers.size()].get());
+    m_workers[m_current_worker]->consumed = m_start_skip;
+    m_start_skip = 0;
+    m_workers_started = true;
+}
+
+void WavpackSource::submit(Worker *worker)
+{
+    /* about a second of audio or more per batch */
+    const uint32_t batch_samples = static_cast<uint32_t>(m_asbd.mSampleRate);
+
+    worker->has_job = false;
+    if (m_next_frame >= m_frames.size())
+        return;
+    const Frame &first = m_frames[m_next_frame];
+    size_t nsamples = 0, nbytes = 0;
+    do {
+        const Frame &frame = m_frames[m_next_frame++];
+        nsamples += frame.samples;
+        nbytes = frame.offset + frame.size - first.offset;
+    } while (nsamples < batch_samples && m_next_frame < m_frames.size());
+
+    int fd = fileno(m_fp.get());
+    worker->input.resize(nbytes);
+    CHECKCRT(_lseeki64(fd, first.offset, SEEK_SET) < 0);
+    util::check_eof(util::nread(fd, worker->input.data(), nbytes) == nbytes);
+    worker->nsamples = nsamples;
+    worker->decoded = worker->consumed = 0;
+    worker->has_job = true;
+    worker->start();
+}
+
+size_t WavpackSource::unpackSamples(int32_t *buffer, size_t nsamples)
+{
+    if (!m_num_workers)
+        return m_module.UnpackSamples(m_wpc.get(), buffer, nsamples);
+    if (!m_workers_started)
+        startWorkers();
+    for (;;) {
+        Worker *worker = m_workers[m_current_worker].get();
+        if (!worker->has_job)
+            return 0;
+        worker->wait();
+        if (worker->consumed < worker->decoded) {
+            nsamples = std::min(nsamples, worker->decoded - worker->consumed);
+            const unsigned nc = m_asbd.mChannelsPerFrame;
+            std::memcpy(buffer, &worker->output[worker->consumed * nc],
+                        nsamples * nc * sizeof(int32_t));
+            worker->consumed += nsamples;
+            m_position += nsamples;
+            return nsamples;
+        }
+        submit(worker);
+        m_current_worker = (m_current_worker + 1) % m_workers.size();
+    }
+}
+
 size_t WavpackSource::readSamples32(void *buffer, size_t nsamples)
 {
     /*
@@ -255,7 +563,7 @@ size_t WavpackSource::readSamples32(void *buffer, size_t nsamples)
      */
     int shifts = 32 - ((m_asbd.mBitsPerChannel + 7) & ~7);
     int32_t *bp = static_cast<int32_t *>(buffer);
-    int rc = m_module.UnpackSamples(m_wpc.get(), bp, nsamples);
+    int rc = unpackSamples(bp, nsamples);
     if (rc && shifts) {
         const size_t count = rc * m_asbd.mChannelsPerFrame;
         /* align to MSB side */
@@ -271,7 +579,7 @@ size_t WavpackSource::readSamples16(void *buffer, size_t nsamples)
     if (m_pivot.size() < nbytes)
         m_pivot.resize(nbytes);
     int32_t *bp = reinterpret_cast<int32_t *>(&m_pivot[0]);
-    int rc = m_module.UnpackSamples(m_wpc.get(), bp, nsamples);
+    int rc = unpackSamples(bp, nsamples);
     nbytes = rc * m_asbd.mChannelsPerFrame * 4;
     const size_t count = rc * m_asbd.mChannelsPerFrame;
     for (size_t i = 0; i < count; ++i)
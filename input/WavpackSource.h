@@ -22,6 +22,7 @@ private:
     WavpackModule& operator=(const WavpackModule&);
 public:
     static WavpackModule &instance() {
+        DLLock lock;
         static WavpackModule self;
         return self;
     }
@@ -57,18 +58,35 @@ public:
 
 class WavpackSource: public ISeekableSource, public ITagParser
 {
+    /* block(s) sharing the same block index, i.e. one multichannel frame */
+    struct Frame {
+        int64_t offset;
+        int64_t index;
+        uint32_t size;
+        uint32_t samples;
+    };
+    struct Worker;
+
     uint64_t m_length;
+    int64_t m_position;
+    unsigned m_num_workers;
+    size_t m_next_frame;
+    size_t m_current_worker;
+    int64_t m_start_skip;
+    bool m_workers_started;
+    std::vector<Frame> m_frames;
+    std::vector<std::shared_ptr<Worker> > m_workers;
     std::shared_ptr<void> m_wpc;
     std::shared_ptr<FILE> m_fp, m_cfp;
     std::vector<uint32_t> m_chanmap;
     std::map<std::string, std::string> m_tags;
-    std::vector<uint8_t> m_pivot;
+    util::PooledBuffer m_pivot;
     size_t (WavpackSource::*m_readSamples)(void *, size_t);
     AudioStreamBasicDescription m_asbd;
     WavpackModule &m_module;
 public:
     WavpackSource(const std::wstring &path);
-    ~WavpackSource() { m_wpc.reset(); }
+    ~WavpackSource() { m_workers.clear(); m_wpc.reset(); }
     uint64_t length() const { return m_length; }
     const AudioStreamBasicDescription &getSampleFormat() const
     {
@@ -89,6 +107,10 @@ public:
 private:
     bool parseWrapper();
     void fetchTags();
+    bool parseFrames();
+    void startWorkers();
+    void submit(Worker *worker);
+    size_t unpackSamples(int32_t *buffer, size_t nsamples);
     size_t readSamples16(void *buffer, size_t nsamples);
     size_t readSamples32(void *buffer, size_t nsamples);
 };
@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <cstring>
+#include "librefalac.h"
+#include "ALACEncoderX.h"
+#include "sink.h"
+#include "cautil.h"
+#include "strutil.h"
+
+const char *get_qaac_version();
+
+namespace {
+    /* PCM pushed by the caller */
+    class FifoSource: public ISource {
+        AudioStreamBasicDescription m_asbd;
+        std::vector<uint8_t> m_buffer;
+        size_t m_head;
+        int64_t m_position;
+    public:
+        FifoSource(const AudioStreamBasicDescription &asbd)
+            : m_asbd(asbd), m_head(0), m_position(0)
+        {}
+        uint64_t length() const { return ~0ULL; }
+        const AudioStreamBasicDescription &getSampleFormat() const
+        {
+            return m_asbd;
+        }
+        const std::vector<uint32_t> *getChannels() const { return 0; }
+        int64_t getPosition() { return m_position; }
+        size_t available() const
+        {
+            return (m_buffer.size() - m_head) / m_asbd.mBytesPerFrame;
+        }
+        void push(const void *data, size_t nsamples)
+        {
+            /* drop what has been consumed, before growing */
+            if (m_head) {
+                m_buffer.erase(m_buffer.begin(), m_buffer.begin() + m_head);
+                m_head = 0;
+            }
+            const uint8_t *p = static_cast<const uint8_t*>(data);
+            m_buffer.insert(m_buffer.end(), p,
+                            p + nsamples * m_asbd.mBytesPerFrame);
+        }
+        size_t readSamples(void *buffer, size_t nsamples)
+        {
+            nsamples = std::min(nsamples, available());
+            size_t nbytes = nsamples * m_asbd.mBytesPerFrame;
+            if (nbytes)
+                std::memcpy(buffer, &m_buffer[m_head], nbytes);
+            m_head += nbytes;
+            m_position += nsamples;
+            return nsamples;
+        }
+    };
+
+    /* PCM pulled from the caller */
+    class CallbackSource: public ISource {
+        AudioStreamBasicDescription m_asbd;
+        refalac_read_func m_func;
+        void *m_ctx;
+        int64_t m_position;
+    public:
+        CallbackSource(const AudioStreamBasicDescription &asbd,
+                       refalac_read_func func, void *ctx)
+            : m_asbd(asbd), m_func(func), m_ctx(ctx), m_position(0)
+        {}
+        uint64_t length() const { return ~0ULL; }
+        const AudioStreamBasicDescription &getSampleFormat() const
+        {
+            return m_asbd;
+        }
+        const std::vector<uint32_t> *getChannels() const { return 0; }
+        int64_t getPosition() { return m_position; }
+        size_t readSamples(void *buffer, size_t nsamples)
+        {
+            size_t n = m_func(m_ctx, buffer, nsamples);
+            if (n > nsamples)
+                throw std::runtime_error("read callback returned too much");
+            m_position += n;
+            return n;
+        }
+    };
+
+    /* hands packets to the callback, and to the file */
+    class JobSink: public ISink {
+        refalac_packet_func m_func;
+        void *m_ctx;
+        std::shared_ptr<ALACSink> m_file;
+    public:
+        JobSink(refalac_packet_func func, void *ctx,
+                const std::shared_ptr<ALACSink> &file)
+            : m_func(func), m_ctx(ctx), m_file(file)
+        {}
+        void writeSamples(const void *data, size_t length, size_t nsamples)
+        {
+            if (m_func && m_func(m_ctx, data, length, nsamples))
+                throw std::runtime_error("aborted by packet callback");
+            if (m_file.get())
+                m_file->writeSamples(data, length, nsamples);
+        }
+    };
+}
+
+struct refalac_job {
+    enum { IDLE, RUNNING, FINISHED, FAILED };
+
+    AudioStreamBasicDescription asbd;
+    std::shared_ptr<ALACEncoderX> encoder;
+    std::shared_ptr<FifoSource> fifo;
+    std::shared_ptr<ALACSink> file;
+    refalac_packet_func packet_func;
+    void *packet_ctx;
+    std::string path;
+    std::map<std::string, std::string> tags;
+    std::string error;
+    int state;
+
+    refalac_job(const AudioStreamBasicDescription &desc)
+        : asbd(desc),
+          encoder(std::make_shared<ALACEncoderX>(desc)),
+          packet_func(0),
+          packet_ctx(0),
+          state(IDLE)
+    {}
+    void checkIdle()
+    {
+        if (state != IDLE)
+            throw std::runtime_error("encoding has already been started");
+    }
+    void start(const std::shared_ptr<ISource> &src)
+    {
+        checkIdle();
+        if (path.size()) {
+            std::wstring wpath = strutil::us2w(path);
+            win32::MakeSureDirectoryPathExistsX(wpath);
+            file = std::make_shared<ALACSink>(wpath,
+                                              encoder->getMagicCookie());
+        }
+        encoder->setSource(src);
+        encoder->setSink(std::make_shared<JobSink>(packet_func, packet_ctx,
+                                                   file));
+        state = RUNNING;
+    }
+    void checkPushing()
+    {
+        if (state != RUNNING || !fifo.get())
+            throw std::runtime_error("not in push mode");
+    }
+    void finish()
+    {
+        while (encoder->encodeChunk(1))
+            ;
+        if (!file.get()) {
+            state = FINISHED;
+            return;
+        }
+        for (auto it = tags.begin(); it != tags.end(); ++it)
+            file->setTag(it->first, it->second);
+        file->setTag("encoding application",
+                     strutil::format("librefalac %s, Apple Lossless Encoder",
+                                     get_qaac_version()));
+        file->writeTags();
+        file->writeBitrates(encoder->overallBitrate() * 1000.0 + .5);
+        file->close();
+        file.reset();
+        state = FINISHED;
+    }
+};
+
+/*
+ * Every entry point below catches exceptions and turns them into -1 and
+ * the error message, since they must not cross the C boundary.
+ * A failure while the encoder is running leaves the encoder and the sink
+ * in an unknown state, so the job is marked as failed, and every later
+ * call on it fails, leaving the error message as it is.
+ */
+template <typename F>
+static int guard(refalac_job *job, F f)
+{
+    if (!job || job->state == refalac_job::FAILED)
+        return -1;
+    try {
+        f();
+        return 0;
+    } catch (const std::exception &e) {
+        job->error = e.what();
+    } catch (...) {
+        job->error = "unknown error";
+    }
+    if (job->state == refalac_job::RUNNING)
+        job->state = refalac_job::FAILED;
+    return -1;
+}
+
+const char *refalac_version(void)
+{
+    return get_qaac_version();
+}
+
+refalac_job *refalac_create(const refalac_format *format)
+{
+    try {
+        if (!format || format->channels < 1 || format->channels > 8 ||
+            !(format->sample_rate > 0))
+            return 0;
+        switch (format->bits_per_sample) {
+        case 16: case 20: case 24: case 32:
+            break;
+        default:
+            return 0;
+        }
+        AudioStreamBasicDescription asbd =
+            cautil::buildASBDForPCM(format->sample_rate, format->channels,
+                                    format->bits_per_sample,
+                                    kAudioFormatFlagIsSignedInteger,
+                                    kAudioFormatFlagIsAlignedHigh);
+        return new refalac_job(asbd);
+    } catch (...) {
+        return 0;
+    }
+}
+
+void refalac_destroy(refalac_job *job)
+{
+    delete job;
+}
+
+const char *refalac_last_error(refalac_job *job)
+{
+    return job ? job->error.c_str() : "";
+}
+
+int refalac_set_fast_mode(refalac_job *job, int enable)
+{
+    return guard(job, [&]() {
+        job->checkIdle();
+        job->encoder->setFastMode(enable != 0);
+    });
+}
+
+int refalac_set_packet_callback(refalac_job *job, refalac_packet_func func,
+                                void *ctx)
+{
+    return guard(job, [&]() {
+        job->checkIdle();
+        job->packet_func = func;
+        job->packet_ctx = ctx;
+    });
+}
+
+int refalac_set_output_file(refalac_job *job, const char *path)
+{
+    return guard(job, [&]() {
+        job->checkIdle();
+        job->path = path ? path : "";
+    });
+}
+
+int refalac_set_tag(refalac_job *job, const char *name, const char *value)
+{
+    return guard(job, [&]() {
+        job->checkIdle();
+        if (!name || !value)
+            throw std::runtime_error("tag name and value are required");
+        job->tags[name] = value;
+    });
+}
+
+size_t refalac_get_magic_cookie(refalac_job *job, void *buffer, size_t size)
+{
+    std::vector<uint8_t> cookie;
+    int rc = guard(job, [&]() {
+        cookie = job->encoder->getMagicCookie();
+    });
+    if (rc < 0)
+        return 0;
+    if (buffer && size >= cookie.size())
+        std::memcpy(buffer, cookie.data(), cookie.size());
+    return cookie.size();
+}
+
+int refalac_push(refalac_job *job, const void *data, size_t nframes)
+{
+    return guard(job, [&]() {
+        if (job->state == refalac_job::IDLE) {
+            job->fifo = std::make_shared<FifoSource>(job->asbd);
+            job->start(job->fifo);
+        }
+        job->checkPushing();
+        job->fifo->push(data, nframes);
+        /* the last partial packet is left until refalac_finish() */
+        while (job->fifo->available() >= kALACDefaultFramesPerPacket)
+            job->encoder->encodeChunk(1);
+    });
+}
+
+int refalac_finish(refalac_job *job)
+{
+    return guard(job, [&]() {
+        if (job->state == refalac_job::IDLE) {
+            job->fifo = std::make_shared<FifoSource>(job->asbd);
+            job->start(job->fifo);
+        }
+        job->checkPushing();
+        job->finish();
+    });
+}
+
+int refalac_encode(refalac_job *job, refalac_read_func func, void *ctx)
+{
+    return guard(job, [&]() {
+        if (!func)
+            throw std::runtime_error("read callback is required");
+        job->checkIdle();
+        job->start(std::make_shared<CallbackSource>(job->asbd, func, ctx));
+        job->finish();
+    });
+}
+
+uint64_t refalac_frames_written(refalac_job *job)
+{
+    return job ? job->encoder->samplesWritten() : 0;
+}
@@ -0,0 +1,114 @@
+#ifndef LIBREFALAC_H
+#define LIBREFALAC_H
+
+/*
+ * C interface to the ALAC encoding pipeline of refalac.
+ *
+ * A job encodes a single stream. PCM is either pushed by the caller
+ * (refalac_push() + refalac_finish()), or pulled through a callback
+ * (refalac_encode()). Encoded packets are handed to the packet callback,
+ * and/or written to an M4A file with tags.
+ * Output settings have to be done before the first PCM is given.
+ *
+ * Functions returning int return 0 on success, and -1 on failure.
+ * refalac_last_error() describes the last failure.
+ * Once encoding has failed, every later call on the job fails, and
+ * refalac_last_error() keeps describing the original failure.
+ * A job must not be used from more than one thread at a time, but
+ * different jobs can be run in parallel.
+ *
+ * The library is built on Windows only. The encoding core it shares with
+ * refalac (ALACEncoderX, ALACSink, cautil) depends on Win32, and the
+ * bundled CoreAudio headers assume a 32bit long, so neither the library
+ * nor librefalac_test builds on Linux yet.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+# ifdef LIBREFALAC_EXPORTS
+#  define REFALAC_API __declspec(dllexport)
+# else
+#  define REFALAC_API __declspec(dllimport)
+# endif
+#else
+# define REFALAC_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct refalac_job refalac_job;
+
+/*
+ * Interleaved, little endian, signed integer PCM.
+ * bits_per_sample is one of 16, 20, 24 or 32, and each sample takes
+ * (bits_per_sample + 7) / 8 bytes (20bit samples are aligned high).
+ */
+typedef struct refalac_format {
+    double   sample_rate;
+    uint32_t channels;         /* 1 to 8 */
+    uint32_t bits_per_sample;
+} refalac_format;
+
+/*
+ * Fill buffer with up to nframes frames, and return the number of frames
+ * actually read. Returning 0 means end of stream.
+ */
+typedef size_t (*refalac_read_func)(void *ctx, void *buffer, size_t nframes);
+
+/*
+ * Called for every encoded packet. Returning non-zero aborts the job.
+ */
+typedef int (*refalac_packet_func)(void *ctx, const void *data, size_t size,
+                                   uint32_t nframes);
+
+REFALAC_API const char *refalac_version(void);
+
+/* NULL if the format is not supported */
+REFALAC_API refalac_job *refalac_create(const refalac_format *format);
+REFALAC_API void refalac_destroy(refalac_job *job);
+REFALAC_API const char *refalac_last_error(refalac_job *job);
+
+REFALAC_API int refalac_set_fast_mode(refalac_job *job, int enable);
+REFALAC_API int refalac_set_packet_callback(refalac_job *job,
+                                            refalac_packet_func func,
+                                            void *ctx);
+/* UTF-8 path of M4A file to create */
+REFALAC_API int refalac_set_output_file(refalac_job *job, const char *path);
+/*
+ * Tag written to the output file. Both are UTF-8.
+ * name is either one of the well known names (title, artist, album,
+ * tracknumber and so on) or an arbitrary name, which is written as a
+ * long (iTunes custom) tag.
+ */
+REFALAC_API int refalac_set_tag(refalac_job *job, const char *name,
+                                const char *value);
+
+/*
+ * ALAC magic cookie (ALACSpecificConfig, followed by ALACChannelLayout
+ * for more than 2 channels), as stored in MP4/CAF.
+ * Returns the size of the cookie. Nothing is copied when size is too small.
+ * Returns 0 on failure.
+ */
+REFALAC_API size_t refalac_get_magic_cookie(refalac_job *job, void *buffer,
+                                            size_t size);
+
+/* Push mode: feed any number of frames, then call refalac_finish() */
+REFALAC_API int refalac_push(refalac_job *job, const void *data,
+                             size_t nframes);
+REFALAC_API int refalac_finish(refalac_job *job);
+
+/* Pull mode: read until the end of stream, and finish */
+REFALAC_API int refalac_encode(refalac_job *job, refalac_read_func func,
+                               void *ctx);
+
+REFALAC_API uint64_t refalac_frames_written(refalac_job *job);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
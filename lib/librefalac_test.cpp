@@ -0,0 +1,218 @@
+/*
+ * In-memory round trip through librefalac.
+ *
+ * A synthetic signal is encoded through push mode (in odd sized chunks)
+ * and through pull mode (with short reads), packets are collected by the
+ * packet callback, decoded with ALACDecoder, and compared with the input.
+ * Nothing touches the file system. Exits with 0 when everything matches.
+ */
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "librefalac.h"
+#include "ALACDecoder.h"
+#include "ALACBitUtilities.h"
+
+namespace {
+    struct Packets {
+        std::vector<std::vector<uint8_t> > data;
+        uint64_t nframes;
+        int abort_after;  /* -1: never */
+    };
+
+    int on_packet(void *ctx, const void *data, size_t size, uint32_t nframes)
+    {
+        Packets *packets = static_cast<Packets*>(ctx);
+        if (packets->abort_after >= 0 &&
+            packets->data.size() >= static_cast<size_t>(packets->abort_after))
+            return 1;
+        const uint8_t *p = static_cast<const uint8_t*>(data);
+        packets->data.push_back(std::vector<uint8_t>(p, p + size));
+        packets->nframes += nframes;
+        return 0;
+    }
+
+    struct Reader {
+        const std::vector<uint8_t> *pcm;
+        size_t pos, bytes_per_frame, max_frames;
+    };
+
+    size_t on_read(void *ctx, void *buffer, size_t nframes)
+    {
+        Reader *reader = static_cast<Reader*>(ctx);
+        size_t remaining = (reader->pcm->size() - reader->pos)
+                         / reader->bytes_per_frame;
+        /* short reads on purpose */
+        size_t n = std::min(std::min(nframes, remaining), reader->max_frames);
+        std::memcpy(buffer, &(*reader->pcm)[reader->pos],
+                    n * reader->bytes_per_frame);
+        reader->pos += n * reader->bytes_per_frame;
+        return n;
+    }
+
+    /* sweeps and a bit of noise, little endian, full range of bits */
+    std::vector<uint8_t> make_signal(const refalac_format &fmt,
+                                     size_t nframes)
+    {
+        unsigned bytes = (fmt.bits_per_sample + 7) / 8;
+        unsigned shift = bytes * 8 - fmt.bits_per_sample;
+        double amplitude = std::ldexp(0.9, fmt.bits_per_sample - 1);
+        std::vector<uint8_t> pcm(nframes * fmt.channels * bytes);
+        uint32_t seed = 1;
+        uint8_t *p = pcm.data();
+        for (size_t i = 0; i < nframes; ++i) {
+            for (unsigned c = 0; c < fmt.channels; ++c) {
+                double t = i / fmt.sample_rate;
+                double f = 100.0 * (c + 1) + 2000.0 * t;
+                seed = seed * 1664525 + 1013904223;
+                double noise = (seed >> 16) / 65536.0 - 0.5;
+                double x = amplitude * (0.9 * std::sin(2 * M_PI * f * t)
+                                        + 0.01 * noise);
+                int32_t v = static_cast<int32_t>(std::floor(x + 0.5));
+                uint32_t u = static_cast<uint32_t>(v) << shift;
+                for (unsigned b = 0; b < bytes; ++b)
+                    *p++ = static_cast<uint8_t>(u >> (8 * b));
+            }
+        }
+        return pcm;
+    }
+
+    bool decode(refalac_job *job, const refalac_format &fmt,
+                const Packets &packets, std::vector<uint8_t> *pcm)
+    {
+        uint8_t cookie[256];
+        size_t size = refalac_get_magic_cookie(job, cookie, sizeof cookie);
+        if (!size || size > sizeof cookie) {
+            std::printf("magic cookie: %s\n", refalac_last_error(job));
+            return false;
+        }
+        ALACDecoder decoder;
+        if (decoder.Init(cookie, static_cast<uint32_t>(size)))
+            return false;
+        unsigned bytes = (fmt.bits_per_sample + 7) / 8;
+        uint32_t frame_length = decoder.mConfig.frameLength;
+        std::vector<uint8_t> buffer(frame_length * fmt.channels * bytes);
+        for (size_t i = 0; i < packets.data.size(); ++i) {
+            std::vector<uint8_t> data(packets.data[i]);
+            BitBuffer bits;
+            BitBufferInit(&bits, data.data(),
+                          static_cast<uint32_t>(data.size()));
+            uint32_t n;
+            if (decoder.Decode(&bits, buffer.data(), frame_length,
+                               fmt.channels, &n))
+                return false;
+            pcm->insert(pcm->end(), buffer.begin(),
+                        buffer.begin() + n * fmt.channels * bytes);
+        }
+        return true;
+    }
+
+    bool check(const char *name, refalac_job *job, const refalac_format &fmt,
+               const Packets &packets, const std::vector<uint8_t> &input)
+    {
+        std::vector<uint8_t> output;
+        bool ok = decode(job, fmt, packets, &output) && output == input &&
+                  packets.nframes == refalac_frames_written(job);
+        std::printf("%-8s %2u ch %2u bit: %u packets, %s\n", name,
+                    fmt.channels, fmt.bits_per_sample,
+                    static_cast<unsigned>(packets.data.size()),
+                    ok ? "ok" : "MISMATCH");
+        return ok;
+    }
+
+    bool test_push(const refalac_format &fmt, const std::vector<uint8_t> &pcm)
+    {
+        Packets packets = { std::vector<std::vector<uint8_t> >(), 0, -1 };
+        refalac_job *job = refalac_create(&fmt);
+        size_t bpf = fmt.channels * ((fmt.bits_per_sample + 7) / 8);
+        size_t nframes = pcm.size() / bpf;
+        bool ok = job &&
+                  !refalac_set_packet_callback(job, on_packet, &packets);
+        for (size_t pos = 0, n = 1; ok && pos < nframes; pos += n, n *= 3) {
+            n = std::min(n, nframes - pos);
+            ok = !refalac_push(job, &pcm[pos * bpf], n);
+        }
+        ok = ok && !refalac_finish(job);
+        if (job && !ok)
+            std::printf("push: %s\n", refalac_last_error(job));
+        ok = ok && check("push", job, fmt, packets, pcm);
+        refalac_destroy(job);
+        return ok;
+    }
+
+    bool test_pull(const refalac_format &fmt, const std::vector<uint8_t> &pcm)
+    {
+        Packets packets = { std::vector<std::vector<uint8_t> >(), 0, -1 };
+        size_t bpf = fmt.channels * ((fmt.bits_per_sample + 7) / 8);
+        Reader reader = { &pcm, 0, bpf, 1000 };
+        refalac_job *job = refalac_create(&fmt);
+        bool ok = job &&
+                  !refalac_set_packet_callback(job, on_packet, &packets) &&
+                  !refalac_encode(job, on_read, &reader);
+        if (job && !ok)
+            std::printf("pull: %s\n", refalac_last_error(job));
+        ok = ok && check("pull", job, fmt, packets, pcm);
+        refalac_destroy(job);
+        return ok;
+    }
+
+    /* aborting from the callback fails the job, and it stays failed */
+    bool test_abort(const refalac_format &fmt,
+                    const std::vector<uint8_t> &pcm)
+    {
+        Packets packets = { std::vector<std::vector<uint8_t> >(), 0, 2 };
+        size_t bpf = fmt.channels * ((fmt.bits_per_sample + 7) / 8);
+        refalac_job *job = refalac_create(&fmt);
+        bool ok = job &&
+                  !refalac_set_packet_callback(job, on_packet, &packets) &&
+                  refalac_push(job, pcm.data(), pcm.size() / bpf) == -1;
+        std::string error = job ? refalac_last_error(job) : "";
+        ok = ok && refalac_push(job, pcm.data(), 1) == -1 &&
+             refalac_finish(job) == -1 &&
+             refalac_get_magic_cookie(job, 0, 0) == 0 &&
+             error == refalac_last_error(job) && packets.data.size() == 2;
+        std::printf("abort    %2u ch %2u bit: %s (%s)\n", fmt.channels,
+                    fmt.bits_per_sample, ok ? "ok" : "FAILED",
+                    error.c_str());
+        refalac_destroy(job);
+        return ok;
+    }
+}
+
+int main()
+{
+    static const refalac_format formats[] = {
+        { 44100.0, 2, 16 },
+        { 48000.0, 1, 20 },
+        { 96000.0, 6, 24 },
+        { 44100.0, 2, 32 },
+    };
+    std::printf("librefalac %s\n", refalac_version());
+    bool ok = true;
+    /* unsupported formats are refused upfront */
+    static const refalac_format bad[] = {
+        { 44100.0, 2, 0 }, { 44100.0, 2, 8 }, { 44100.0, 2, 17 },
+        { 44100.0, 2, 33 }, { 44100.0, 0, 16 }, { 0.0, 2, 16 },
+    };
+    for (size_t i = 0; i < sizeof bad / sizeof bad[0]; ++i) {
+        refalac_job *job = refalac_create(&bad[i]);
+        if (job) {
+            std::printf("create   %2u ch %2u bit: accepted\n",
+                        bad[i].channels, bad[i].bits_per_sample);
+            refalac_destroy(job);
+            ok = false;
+        }
+    }
+    for (size_t i = 0; i < sizeof formats / sizeof formats[0]; ++i) {
+        /* not a multiple of the packet size */
+        std::vector<uint8_t> pcm = make_signal(formats[i], 4096 * 5 + 1234);
+        ok = test_push(formats[i], pcm) && ok;
+        ok = test_pull(formats[i], pcm) && ok;
+        ok = test_abort(formats[i], pcm) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -1,17 +1,19 @@
 #include <cstdio>
 #include <cstdarg>
 #include <vector>
+#include <functional>
 #include "win32util.h"
 
 class Log {
     std::vector<std::shared_ptr<FILE>> m_streams;
+    std::function<void(const wchar_t *)> m_hook;
 public:
     static Log &instance()
     {
         static Log self;
         return self;
     }
-    bool is_enabled() { return m_streams.size() != 0; }
+    bool is_enabled() { return m_streams.size() != 0 || m_hook; }
     void enable_stderr()
     {
         if (GetFileType(win32::get_handle(2)) != FILE_TYPE_UNKNOWN)
@@ -26,6 +28,11 @@ public:
             m_streams.push_back(std::shared_ptr<FILE>(fp, std::fclose));
         } catch (...) {}
     }
+    /* receives every message, in addition to the streams */
+    void set_hook(const std::function<void(const wchar_t *)> &hook)
+    {
+        m_hook = hook;
+    }
     void vwprintf(const wchar_t *fmt, va_list args)
     {
         int rc = _vscwprintf(fmt, args);
@@ -35,6 +42,8 @@ public:
         OutputDebugStringW(buffer.data());
         for (size_t i = 0; i < m_streams.size(); ++i)
             std::fputws(buffer.data(), m_streams[i].get());
+        if (m_hook)
+            m_hook(buffer.data());
     }
     void wprintf(const wchar_t *fmt, ...)
     {
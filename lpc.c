@@ -62,21 +62,14 @@ Carsten Bormann
 /* Input : n elements of time doamin data
    Output: m lpc coefficients, excitation energy */
 
-float vorbis_lpc_from_data(float *data,float *lpci,int n,int m,int stride){
-  double *aut=malloc(sizeof(*aut)*(m+1));
-  double *lpc=malloc(sizeof(*lpc)*(m));
+/* Levinson-Durbin recursion over m+1 autocorrelation values, followed
+   by damping. Returns the excitation energy. */
+
+static double lpc_from_autocorr(const double *aut,double *lpc,int m){
   double error;
   double epsilon;
   int i,j;
 
-  /* autocorrelation, p+1 lag coefficients */
-  j=m+1;
-  while(j--){
-    double d=0; /* double needed for accumulator depth */
-    for(i=j;i<n;i++)d+=(double)data[i*stride]*data[(i-j)*stride]/1073741824.0;
-    aut[j]=d;
-  }
-
   /* Generate lpc coefficients from autocorr values */
 
   /* set our noise floor to about -100dB */
@@ -125,6 +118,24 @@ float vorbis_lpc_from_data(float *data,float *lpci,int n,int m,int stride){
       damp*=g;
     }
   }
+  return error;
+}
+
+float vorbis_lpc_from_data(float *data,float *lpci,int n,int m,int stride){
+  double *aut=malloc(sizeof(*aut)*(m+1));
+  double *lpc=malloc(sizeof(*lpc)*(m));
+  double error;
+  int i,j;
+
+  /* autocorrelation, p+1 lag coefficients */
+  j=m+1;
+  while(j--){
+    double d=0; /* double needed for accumulator depth */
+    for(i=j;i<n;i++)d+=(double)data[i*stride]*data[(i-j)*stride]/1073741824.0;
+    aut[j]=d;
+  }
+
+  error=lpc_from_autocorr(aut,lpc,m);
 
   for(j=0;j<m;j++)lpci[j]=(float)lpc[j];
 
@@ -165,3 +176,69 @@ void vorbis_lpc_predict(float *coeff,float *prime,int m,
   }
   free(work);
 }
+
+/* Extrapolate all channels of interleaved data at once, without
+   reversed copies.
+
+    in: data[0...n*channels-1] interleaved samples
+   out: out[0...olen*channels-1] olen frames that follow data
+        (backward == 0), or that precede data (backward != 0)
+
+   Autocorrelation is the same in both directions, so backward
+   extrapolation only differs in priming and output order.  Inner loops
+   run over channels with unit stride so that the compiler can
+   vectorize them. */
+
+void vorbis_lpc_extrapolate(const float *data,long n,int channels,int m,
+                            float *out,long olen,int backward){
+  double *aut=calloc((m+1)*channels,sizeof(*aut));
+  double *caut=malloc(sizeof(*caut)*(m+1));
+  double *lpc=malloc(sizeof(*lpc)*m);
+  float *coeff=malloc(sizeof(*coeff)*m*channels);
+  float *work=malloc(sizeof(*work)*(m+olen)*channels);
+  float *y=malloc(sizeof(*y)*channels);
+  long i,j;
+  int c;
+
+  /* autocorrelation; lag j of channel c goes to aut[j*channels+c] */
+  for(j=0;j<=m;j++){
+    double *a=aut+j*channels;
+    const float *p=data+j*channels,*q=data;
+    for(i=j;i<n;i++,p+=channels,q+=channels)
+      for(c=0;c<channels;c++)
+        a[c]+=(double)p[c]*q[c];
+  }
+
+  /* coefficients stored as coeff[j*channels+c], in the order they are
+     applied to the work buffer */
+  for(c=0;c<channels;c++){
+    for(j=0;j<=m;j++)caut[j]=aut[j*channels+c]/1073741824.0;
+    lpc_from_autocorr(caut,lpc,m);
+    for(j=0;j<m;j++)coeff[(m-1-j)*channels+c]=(float)lpc[j];
+  }
+
+  /* the last m frames in the direction of extrapolation */
+  for(j=0;j<m;j++){
+    const float *src=backward?data+(m-1-j)*channels:data+(n-m+j)*channels;
+    for(c=0;c<channels;c++)work[j*channels+c]=src[c];
+  }
+
+  for(i=0;i<olen;i++){
+    const float *w=work+i*channels;
+    float *dst=backward?out+(olen-1-i)*channels:out+i*channels;
+    for(c=0;c<channels;c++)y[c]=0;
+    for(j=0;j<m;j++,w+=channels){
+      const float *k=coeff+j*channels;
+      for(c=0;c<channels;c++)y[c]-=w[c]*k[c];
+    }
+    for(c=0;c<channels;c++)
+      work[(m+i)*channels+c]=dst[c]=y[c];
+  }
+
+  free(y);
+  free(work);
+  free(coeff);
+  free(lpc);
+  free(caut);
+  free(aut);
+}
@@ -24,4 +24,7 @@ extern float vorbis_lpc_from_data(float *data,float *lpc,int n,int m,int stride)
 extern void vorbis_lpc_predict(float *coeff,float *prime,int m,
                                float *data,long n,int stride);
 
+extern void vorbis_lpc_extrapolate(const float *data,long n,int channels,
+                                   int m,float *out,long olen,int backward);
+
 #endif
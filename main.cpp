@@ -1,20 +1,27 @@
 #include <clocale>
+#include <cmath>
 #include <numeric>
 #include <regex>
+#include <typeinfo>
 #include "win32util.h"
+#include <shellapi.h>
 #include "options.h"
+#include "wgetopt.h"
 #include "InputFactory.h"
 #include "sink.h"
 #include "WaveSink.h"
 #include "CAFSink.h"
+#include "JournalSink.h"
 #include "WaveOutSink.h"
 #include "PeakSink.h"
 #include "cuesheet.h"
 #include "CompositeSource.h"
 #include "NullSource.h"
 #include "SoxrResampler.h"
+#include "HalfbandResampler.h"
 #include "SoxLowpassFilter.h"
 #include "Normalizer.h"
+#include "SampleAuditor.h"
 #include "MatrixMixer.h"
 #include "Quantizer.h"
 #include "Scaler.h"
@@ -24,6 +31,7 @@
 #include "chanmap.h"
 #include "ChannelMapper.h"
 #include "logging.h"
+#include "WorkerPool.h"
 #include "Compressor.h"
 #include "metadata.h"
 #include "wicimage.h"
@@ -41,6 +49,7 @@
 #include "CoreAudioEncoder.h"
 #include "CoreAudioPaddedEncoder.h"
 #include "CoreAudioResampler.h"
+#include "ElementaryStreamReader.h"
 #endif
 #include <crtdbg.h>
 
@@ -52,6 +61,13 @@
 
 static volatile bool g_interrupted = false;
 
+/*
+ * Set in a worker process of --workers. Progress (in percent) goes to
+ * the coordinator through this, and nothing is displayed on the console
+ * shared with the coordinator.
+ */
+static std::function<void(double)> g_progress_hook;
+
 static
 BOOL WINAPI console_interrupt_handler(DWORD type)
 {
@@ -89,6 +105,7 @@ public:
         }
     }
     void flush() {
+        if (g_progress_hook) return;
         if (m_verbose) std::fputws(m_message.c_str(), stderr);
         if (m_verbose && m_console_visible &&
             m_last_tick_stderr - m_last_tick_title > m_interval * 4)
@@ -124,6 +141,11 @@ public:
     }
     void update(uint64_t current)
     {
+        if (g_progress_hook) {
+            if (m_total != ~0ULL)
+                g_progress_hook(100.0 * current / m_total);
+            return;
+        }
         if ((!m_verbose || !m_stderr_type) && !m_console_visible) return;
         double fcurrent = current;
         double percent = 100.0 * fcurrent / m_total;
@@ -146,7 +168,7 @@ public:
     void finish(uint64_t current)
     {
         m_disp.flush();
-        if (m_verbose) fputwc('\n', stderr);
+        if (m_verbose && !g_progress_hook) fputwc('\n', stderr);
         double ellapsed = m_timer.ellapsed();
         LOG(L"%lld/%lld samples processed in %s\n",
             current, m_total, util::format_seconds(ellapsed).c_str());
@@ -324,18 +346,35 @@ std::string pcm_format_str(AudioStreamBasicDescription &asbd)
     return strutil::format("%s%d", stype[itype], asbd.mBitsPerChannel);
 }
 
+/*
+ * Widest float format the tail of the chain can make use of.
+ * AAC encoder (and --bits-per-sample 32 float output) take float32,
+ * so there's no point in letting intermediate filters produce float64
+ * only to be quantized back to float32 at the end.
+ */
+static unsigned max_float_bits(const Options &opts)
+{
+    if (opts.isAAC())
+        return 32;
+    if (opts.bits_per_sample == 32 && !opts.isALAC())
+        return 32;
+    return 64;
+}
+
 static double do_normalize(std::vector<std::shared_ptr<ISource> > &chain,
                            const Options &opts, bool seekable)
 {
     std::shared_ptr<ISource> src = chain.back();
-    Normalizer *normalizer = new Normalizer(src, seekable);
+    Normalizer *normalizer = new Normalizer(src, seekable,
+                                            max_float_bits(opts));
     chain.push_back(std::shared_ptr<ISource>(normalizer));
 
     LOG(L"Scanning maximum peak...\n");
     uint64_t n = 0, rc;
     Progress progress(opts.verbose, src->length(),
                       src->getSampleFormat().mSampleRate);
-    while (!g_interrupted && (rc = normalizer->process(4096)) > 0) {
+    size_t block_size = getPreferredBlockSize(normalizer->getSampleFormat());
+    while (!g_interrupted && (rc = normalizer->process(block_size)) > 0) {
         n += rc;
         progress.update(src->getPosition());
     }
@@ -344,6 +383,288 @@ static double do_normalize(std::vector<std::shared_ptr<ISource> > &chain,
     return normalizer->getPeak();
 }
 
+static void add_auditor(std::vector<std::shared_ptr<ISource> > &chain,
+                        const Options &opts)
+{
+    if (!opts.audit && !opts.sanitize)
+        return;
+    if (SampleAuditor::isAvailable(chain.back()->getSampleFormat()))
+        chain.push_back(std::make_shared<SampleAuditor>(chain.back(),
+                                                        opts.sanitize));
+    else
+        LOG(L"WARNING: --audit is not available for this input\n");
+}
+
+/*
+ * True if the filter passes samples through untouched.
+ * SampleAuditor only looks at them unless sanitizing.
+ */
+static bool is_observer(ISource *filter)
+{
+    SampleAuditor *auditor = dynamic_cast<SampleAuditor*>(filter);
+    return auditor && !auditor->sanitizes();
+}
+
+/* True if samples reach the end of the chain as the source gave them. */
+static bool is_bare_source(const std::vector<std::shared_ptr<ISource> >
+                               &chain)
+{
+    for (size_t i = 1; i < chain.size(); ++i)
+        if (!is_observer(chain[i].get()))
+            return false;
+    return true;
+}
+
+static void report_audit(const std::vector<std::shared_ptr<ISource> > &chain)
+{
+    for (size_t i = 1; i < chain.size(); ++i) {
+        SampleAuditor *auditor = dynamic_cast<SampleAuditor*>(chain[i].get());
+        if (!auditor || !auditor->framesAudited())
+            continue;
+        double rate = auditor->getSampleFormat().mSampleRate;
+        auto first_at = [rate](int64_t pos) -> std::wstring {
+            return pos < 0 ? L""
+                : L" from " + util::format_seconds(pos / rate);
+        };
+        const std::vector<SampleAuditor::ChannelStats> &stats =
+            auditor->stats();
+        for (size_t c = 0; c < stats.size(); ++c) {
+            const SampleAuditor::ChannelStats &s = stats[c];
+            LOG(L"Audit ch%u: min %g max %g DC %g, "
+                L"%llu clipped%s, %llu NaN/Inf%s%s\n",
+                static_cast<unsigned>(c + 1), s.min, s.max,
+                s.sum / auditor->framesAudited(),
+                s.clipped, first_at(s.first_clipped).c_str(),
+                s.nonfinite, first_at(s.first_nonfinite).c_str(),
+                s.nonfinite && auditor->sanitizes() ? L" (replaced)" : L"");
+        }
+        return;
+    }
+}
+
+/* tag name without " -_", in lower case */
+static std::string canonical_tag_name(const std::string &name)
+{
+    std::string ss;
+    for (const char *s = name.c_str(); *s; ++s)
+        if (!std::strchr(" -_", *s))
+            ss.push_back(tolower(static_cast<unsigned char>(*s)));
+    return ss;
+}
+
+/* ReplayGain track peak of the source, or 0 */
+static double get_peak_from_tag(ISource *src)
+{
+    ITagParser *parser = dynamic_cast<ITagParser*>(src);
+    if (!parser)
+        return 0.0;
+    const std::map<std::string, std::string> &tags = parser->getTags();
+    for (auto it = tags.begin(); it != tags.end(); ++it) {
+        double peak;
+        if (canonical_tag_name(it->first) == "replaygaintrackpeak" &&
+            std::sscanf(it->second.c_str(), "%lf", &peak) == 1 &&
+            peak > FLT_MIN)
+            return peak;
+    }
+    return 0.0;
+}
+
+/* FNV-1a, for keys of --peak-cache and --resume */
+class Hasher {
+    uint64_t m_value;
+public:
+    Hasher(): m_value(14695981039346656037ULL) {}
+    uint64_t value() const { return m_value; }
+    void feed(const void *data, size_t size)
+    {
+        const uint8_t *p = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            m_value ^= p[i];
+            m_value *= 1099511628211ULL;
+        }
+    }
+    void feed(const std::string &s) { feed(s.c_str(), s.size() + 1); }
+    void feed(const AudioStreamBasicDescription &asbd)
+    {
+        uint32_t v[] = { asbd.mFormatID, asbd.mFormatFlags,
+                         asbd.mBitsPerChannel, asbd.mChannelsPerFrame };
+        feed(&asbd.mSampleRate, sizeof asbd.mSampleRate);
+        feed(v, sizeof v);
+    }
+    /*
+     * Input is identified by its format, length and a few blocks of
+     * decoded samples, rather than by file name or timestamp, so that
+     * renaming or retagging doesn't matter.
+     * The source is rewound afterwards.
+     */
+    void feed(ISeekableSource *src);
+};
+
+void Hasher::feed(ISeekableSource *src)
+{
+    const AudioStreamBasicDescription &asbd = src->getSampleFormat();
+    uint64_t length = src->length();
+    feed(asbd);
+    feed(&length, sizeof length);
+
+    const size_t nblock = 4096;
+    int64_t positions[3] = { 0 };
+    size_t npositions = 1;
+    if (length != ~0ULL && length > nblock * 3) {
+        positions[1] = length / 2;
+        positions[2] = length - nblock;
+        npositions = 3;
+    }
+    std::vector<uint8_t> buffer(nblock * asbd.mBytesPerFrame);
+    for (size_t i = 0; i < npositions; ++i) {
+        src->seekTo(positions[i]);
+        size_t n = readSamplesFull(src, &buffer[0], nblock);
+        feed(&buffer[0], n * asbd.mBytesPerFrame);
+    }
+    src->seekTo(0);
+}
+
+/*
+ * Key of --peak-cache entry.
+ * Input is identified by Hasher::feed(ISeekableSource*), so that entries
+ * survive renaming or retagging. DSP in front of the normalizer is
+ * identified by the filters in the chain and the options they are built
+ * from. Observers are left out, since they don't change the peak.
+ */
+static std::string
+peak_cache_key(ISeekableSource *src,
+               const std::vector<std::shared_ptr<ISource> > &chain,
+               size_t nfilters, const Options &opts)
+{
+    Hasher h;
+    h.feed(src);
+    for (size_t i = 1; i < nfilters; ++i) {
+        if (is_observer(chain[i].get()))
+            continue;
+        h.feed(std::string(typeid(*chain[i]).name()));
+        h.feed(chain[i]->getSampleFormat());
+    }
+    int ivals[] = { opts.rate, opts.lowpass, opts.chanmask,
+                    opts.no_matrix_normalize, opts.native_resampler,
+                    opts.native_resampler_quality,
+                    static_cast<int>(opts.native_resampler_complexity) };
+    h.feed(ivals, sizeof ivals);
+    if (opts.chanmap.size())
+        h.feed(&opts.chanmap[0], opts.chanmap.size() * sizeof(uint32_t));
+    /*
+     * Matrix coefficients rather than the file name, since the file can be
+     * edited between runs.
+     */
+    if (opts.remix_preset || opts.remix_file) {
+        std::vector<std::vector<misc::complex_t> > matrix;
+        if (opts.remix_file)
+            matrix = misc::loadRemixerMatrixFromFile(opts.remix_file);
+        else
+            matrix = misc::loadRemixerMatrixFromPreset(opts.remix_preset);
+        for (size_t i = 0; i < matrix.size(); ++i) {
+            uint32_t n = static_cast<uint32_t>(matrix[i].size());
+            h.feed(&n, sizeof n);
+            if (n) h.feed(&matrix[i][0], n * sizeof(misc::complex_t));
+        }
+    }
+    for (size_t i = 0; i < opts.drc_params.size(); ++i) {
+        const DRCParams &p = opts.drc_params[i];
+        double dvals[] = { p.m_threshold, p.m_ratio, p.m_knee_width,
+                           p.m_attack, p.m_release };
+        h.feed(dvals, sizeof dvals);
+    }
+    return strutil::format("%016llx", h.value());
+}
+
+/*
+ * --peak-cache is a text file of "<key> <peak>" lines.
+ * Entries are only appended, and the last one for a key wins.
+ */
+static double load_cached_peak(const wchar_t *path, const std::string &key)
+{
+    if (GetFileAttributesW(win32::prefixed_path(path).c_str())
+            == INVALID_FILE_ATTRIBUTES)
+        return 0.0;
+    std::shared_ptr<FILE> fp = win32::fopen(path, L"r");
+    char line[256], name[64];
+    double value, peak = 0.0;
+    while (std::fgets(line, sizeof line, fp.get()))
+        if (std::sscanf(line, "%63s %lf", name, &value) == 2 && key == name)
+            peak = value;
+    return peak;
+}
+
+static void store_cached_peak(const wchar_t *path, const std::string &key,
+                              double peak)
+{
+    std::shared_ptr<FILE> fp = win32::fopen(path, L"a");
+    if (std::fprintf(fp.get(), "%s %.17g\n", key.c_str(), peak) < 0)
+        util::throw_crt_error(path);
+}
+
+/*
+ * Peak known without scanning, from --peak-cache or --peak-from-tag.
+ * Returns 0 when not available. *key is set when the cache is in use.
+ */
+static double
+get_stored_peak(ISeekableSource *src,
+                const std::vector<std::shared_ptr<ISource> > &chain,
+                const Options &opts, std::string *key)
+{
+    double peak = 0.0;
+    if (opts.peak_cache && src->isSeekable()) {
+        *key = peak_cache_key(src, chain, chain.size(), opts);
+        if ((peak = load_cached_peak(opts.peak_cache, *key)) > FLT_MIN) {
+            LOG(L"Peak value (from cache): %g\n", peak);
+            return peak;
+        }
+    }
+    if (opts.peak_from_tag) {
+        /* tag is about the source itself */
+        if (is_bare_source(chain) &&
+            (peak = get_peak_from_tag(src)) > FLT_MIN) {
+            LOG(L"Peak value (from tag): %g\n", peak);
+            return peak;
+        }
+        LOG(L"WARNING: --peak-from-tag is ignored for this input\n");
+    }
+    return 0.0;
+}
+
+/*
+ * When normalized with a stored peak, the normalizer has measured the
+ * actual peak while encoding. Compare them, and fix the cache entry.
+ */
+static void verify_stored_peak(const std::vector<std::shared_ptr<ISource> >
+                                   &chain,
+                               const Options &opts)
+{
+    if (g_interrupted)
+        return;
+    for (size_t i = 1; i < chain.size(); ++i) {
+        Normalizer *normalizer = dynamic_cast<Normalizer*>(chain[i].get());
+        if (!normalizer || !normalizer->isSinglePass())
+            continue;
+        double stored = normalizer->getStoredPeak();
+        double actual = normalizer->getPeak();
+        /* ReplayGain peaks are usually written with 6 digits */
+        if (std::abs(actual - stored) <= stored * 1e-5)
+            return;
+        ISeekableSource *src = dynamic_cast<ISeekableSource*>(chain[0].get());
+        if (opts.peak_cache && src && src->isSeekable())
+            store_cached_peak(opts.peak_cache,
+                              peak_cache_key(src, chain, i, opts), actual);
+        if (opts.strict_peak)
+            throw std::runtime_error(strutil::format(
+                    "stored peak %g doesn't match actual peak %g",
+                    stored, actual));
+        if (actual > stored)
+            LOG(L"WARNING: actual peak %g is higher than stored peak %g, "
+                L"output may be clipped\n", actual, stored);
+        return;
+    }
+}
+
 void build_filter_chain_sub(std::shared_ptr<ISeekableSource> src,
                             std::vector<std::shared_ptr<ISource> > &chain,
                             const Options &opts, bool normalize_pass=false)
@@ -373,10 +694,22 @@ void build_filter_chain_sub(std::shared_ptr<ISeekableSource> src,
         double irate = chain.back()->getSampleFormat().mSampleRate;
         double orate = target_sample_rate(opts, chain.back().get());
         if (orate != irate) {
-            if (!opts.native_resampler && SOXRModule::instance().loaded()) {
+            if (opts.halfband_resampler && !opts.native_resampler &&
+                HalfbandResampler::isSupported(irate, orate)) {
+                LOG(L"%gHz -> %gHz\n", irate, orate);
+                std::shared_ptr<HalfbandResampler>
+                    resampler(new HalfbandResampler(chain.back(), orate,
+                                                    max_float_bits(opts)));
+                if (opts.verbose > 1 || opts.logfilename)
+                    LOG(L"Using halfband SRC: %u stage(s)\n",
+                        static_cast<unsigned>(resampler->numStages()));
+                chain.push_back(resampler);
+            } else if (!opts.native_resampler &&
+                       SOXRModule::instance().loaded()) {
                 LOG(L"%gHz -> %gHz\n", irate, orate);
                 std::shared_ptr<SoxrResampler>
-                    resampler(new SoxrResampler(chain.back(), orate));
+                    resampler(new SoxrResampler(chain.back(), orate,
+                                                max_float_bits(opts)));
                 if (opts.verbose > 1 || opts.logfilename)
                     LOG(L"Using libsoxr SRC: %hs\n", resampler->engine());
                 chain.push_back(resampler);
@@ -438,9 +771,20 @@ void build_filter_chain_sub(std::shared_ptr<ISeekableSource> src,
         chain.push_back(compressor);
     }
     if (normalize_pass) {
-        do_normalize(chain, opts, src->isSeekable());
-        if (src->isSeekable())
-            return;
+        std::string key;
+        double peak = get_stored_peak(src.get(), chain, opts, &key);
+        if (peak > FLT_MIN) {
+            std::shared_ptr<ISource>
+                normalizer(new Normalizer(chain.back(), true,
+                                          max_float_bits(opts), peak));
+            chain.push_back(normalizer);
+        } else {
+            peak = do_normalize(chain, opts, src->isSeekable());
+            if (key.size() && !g_interrupted && peak > FLT_MIN)
+                store_cached_peak(opts.peak_cache, key, peak);
+            if (src->isSeekable())
+                return;
+        }
     }
 
     if (opts.gain) {
@@ -448,7 +792,8 @@ void build_filter_chain_sub(std::shared_ptr<ISeekableSource> src,
         if (opts.verbose > 1 || opts.logfilename)
             LOG(L"Gain adjustment: %gdB, scale factor %g\n",
                 opts.gain, scale);
-        std::shared_ptr<ISource> scaler(new Scaler(chain.back(), scale));
+        std::shared_ptr<ISource>
+            scaler(new Scaler(chain.back(), scale, max_float_bits(opts)));
         chain.push_back(scaler);
     }
     if (opts.limiter) {
@@ -466,9 +811,15 @@ void build_filter_chain_sub(std::shared_ptr<ISeekableSource> src,
             LOG(L"WARNING: --bits-per-sample has no effect for AAC\n");
         else if (sbits != opts.bits_per_sample ||
                  !!(sflags & kAudioFormatFlagIsFloat) != is_float) {
-            std::shared_ptr<ISource>
+            double rate = chain.back()->getSampleFormat().mSampleRate;
+            std::shared_ptr<Quantizer>
                 isrc(new Quantizer(chain.back(), opts.bits_per_sample,
-                                   opts.no_dither, is_float));
+                                   opts.no_dither, is_float,
+                                   opts.noise_shaping));
+            if (opts.noise_shaping != Quantizer::kFlatTPDF &&
+                isrc->isDithered() && !isrc->isShaped())
+                LOG(L"WARNING: noise shaping is not available at %gHz, "
+                    L"using flat dither\n", rate);
             chain.push_back(isrc);
             if (opts.verbose > 1 || opts.logfilename)
                 LOG(L"Convert to %d bit\n", opts.bits_per_sample);
@@ -500,15 +851,19 @@ void build_filter_chain(std::shared_ptr<ISeekableSource> src,
                         const Options &opts)
 {
     chain.push_back(src);
+    add_auditor(chain, opts);
     build_filter_chain_sub(src, chain, opts, opts.normalize);
-    if (opts.normalize && src->isSeekable()) {
+    Normalizer *normalizer = dynamic_cast<Normalizer*>(chain.back().get());
+    if (opts.normalize && src->isSeekable() &&
+        normalizer && !normalizer->isSinglePass()) {
         src->seekTo(0);
-        Normalizer *normalizer = dynamic_cast<Normalizer*>(chain.back().get());
         double peak = normalizer->getPeak();
         chain.clear();
         chain.push_back(src);
+        add_auditor(chain, opts);
         if (peak > FLT_MIN)
-            chain.push_back(std::make_shared<Scaler>(src, 1.0/peak));
+            chain.push_back(std::make_shared<Scaler>(chain.back(), 1.0/peak,
+                                                     max_float_bits(opts)));
         build_filter_chain_sub(src, chain, opts, false);
     }
 }
@@ -536,10 +891,7 @@ bool accept_tag(const std::string &name)
         std::regex("minorversion"),    /* XXX: ffmpeg metadata for mp4 */
         std::regex("replaygain.*"),
     };
-    std::string ss;
-    for (const char *s = name.c_str(); *s; ++s)
-        if (!std::strchr(" -_", *s))
-            ss.push_back(tolower(static_cast<unsigned char>(*s)));
+    std::string ss = canonical_tag_name(name);
     size_t i = 0, end = util::sizeof_array(black_list);
     for (i = 0; i < end; ++i)
         if (std::regex_match(ss, black_list[i]))
@@ -548,14 +900,13 @@ bool accept_tag(const std::string &name)
 }
 
 static
-void set_tags(ISource *src, ISink *sink, const Options &opts,
+void set_tags(ITagParser *parser, ISink *sink, const Options &opts,
               const std::wstring encoder_config)
 {
     ITagStore *tagstore = dynamic_cast<ITagStore*>(sink);
     if (!tagstore)
         return;
     MP4SinkBase *mp4sink = dynamic_cast<MP4SinkBase*>(tagstore);
-    ITagParser *parser = dynamic_cast<ITagParser*>(src);
     if (parser) {
         const std::map<std::string, std::string> &tags = parser->getTags();
         std::map<std::string, std::string>::const_iterator ssi;
@@ -573,7 +924,7 @@ void set_tags(ISource *src, ISink *sink, const Options &opts,
                 tagstore->setTag(ssi->first, ssi->second);
         }
         if (mp4sink) {
-            IChapterParser *cp = dynamic_cast<IChapterParser*>(src);
+            IChapterParser *cp = dynamic_cast<IChapterParser*>(parser);
             if (cp) {
                 auto &chapters = cp->getChapters();
                 if (chapters.size())
@@ -599,6 +950,13 @@ void set_tags(ISource *src, ISink *sink, const Options &opts,
     }
 }
 
+static
+void set_tags(ISource *src, ISink *sink, const Options &opts,
+              const std::wstring encoder_config)
+{
+    set_tags(dynamic_cast<ITagParser*>(src), sink, opts, encoder_config);
+}
+
 static
 void decode_file(const std::vector<std::shared_ptr<ISource> > &chain,
                  const std::wstring &ofilename, const Options &opts)
@@ -638,11 +996,12 @@ void decode_file(const std::vector<std::shared_ptr<ISource> > &chain,
 
     Progress progress(opts.verbose, src->length(), sf.mSampleRate);
     uint32_t bpf = sf.mBytesPerFrame;
-    std::vector<uint8_t> buffer(4096 * bpf);
+    size_t block_size = getPreferredBlockSize(sf);
+    std::vector<uint8_t> buffer(block_size * bpf);
     try {
         size_t nread;
         while (!g_interrupted &&
-               (nread = src->readSamples(&buffer[0], 4096)) > 0) {
+               (nread = src->readSamples(&buffer[0], block_size)) > 0) {
             progress.update(src->getPosition());
             sink->writeSamples(&buffer[0], nread * bpf, nread);
         }
@@ -661,6 +1020,8 @@ void decode_file(const std::vector<std::shared_ptr<ISource> > &chain,
         PeakSink *p = dynamic_cast<PeakSink *>(sink.get());
         LOG(L"peak: %g (%gdB)\n", p->peak(), util::scale_to_dB(p->peak()));
     }
+    report_audit(chain);
+    verify_stored_peak(chain, opts);
 }
 
 static
@@ -734,15 +1095,13 @@ static void do_optimize(MP4FileX *file, const std::wstring &dst, bool verbose)
     }
 }
 
+/* duration in seconds, bitrate in kbps */
 static
-void finalize_m4a(MP4SinkBase *sink, IEncoder *encoder,
-                   const std::wstring &ofilename, const Options &opts)
+void finalize_m4a(MP4SinkBase *sink, double duration, double bitrate,
+                  const std::wstring &ofilename, const Options &opts)
 {
-    IEncoderStat *stat = dynamic_cast<IEncoderStat *>(encoder);
     if (opts.chapter_file) {
         try {
-            double duration = stat->samplesRead() /
-                encoder->getInputDescription().mSampleRate;
             auto xs = misc::convertChaptersToQT(opts.chapters, duration);
             sink->setChapters(xs.begin(), xs.end());
         } catch (const std::runtime_error &e) {
@@ -750,12 +1109,22 @@ void finalize_m4a(MP4SinkBase *sink, IEncoder *encoder,
         }
     }
     sink->writeTags();
-    sink->writeBitrates(stat->overallBitrate() * 1000.0 + .5);
+    sink->writeBitrates(bitrate * 1000.0 + .5);
     if (!opts.no_optimize)
         do_optimize(sink->getFile(), ofilename, opts.verbose);
     sink->close();
 }
 
+static
+void finalize_m4a(MP4SinkBase *sink, IEncoder *encoder,
+                   const std::wstring &ofilename, const Options &opts)
+{
+    IEncoderStat *stat = dynamic_cast<IEncoderStat *>(encoder);
+    double duration = stat->samplesRead() /
+        encoder->getInputDescription().mSampleRate;
+    finalize_m4a(sink, duration, stat->overallBitrate(), ofilename, opts);
+}
+
 #ifdef QAAC
 static
 std::shared_ptr<ISink> open_sink(const std::wstring &ofilename,
@@ -955,10 +1324,71 @@ void encode_file(const std::shared_ptr<ISeekableSource> &src,
         }
     }
     MP4SinkBase *mp4sinkbase = dynamic_cast<MP4SinkBase*>(sink.get());
+    ADTSSink *adtssink = dynamic_cast<ADTSSink*>(sink.get());
     if (mp4sinkbase)
         finalize_m4a(mp4sinkbase, encoder.get(), ofilename, opts);
     else if (cafsink)
         cafsink->finishWrite(pti);
+    else if (adtssink)
+        adtssink->finishWrite();
+    report_audit(chain);
+    verify_stored_peak(chain, opts);
+}
+
+/*
+ * Copy ADTS/MPEG audio packets into M4A as they are.
+ * Since no decoding is involved, DSP options are not applicable.
+ */
+static
+void remux_file(const std::wstring &ifilename, const std::wstring &ofilename,
+                const Options &opts)
+{
+    ElementaryStreamReader reader(win32::fopen(ifilename, L"rb"));
+    const AudioStreamBasicDescription &asbd = reader.getSampleFormat();
+    const char *codec = "AAC";
+    if (asbd.mFormatID == '.mp3')
+        codec = "MP3";
+    else if (asbd.mFormatID == '.mp2')
+        codec = "MP2";
+    else if (asbd.mFormatID == '.mp1')
+        codec = "MP1";
+    std::wstring encoder_config = strutil::format(L"%hs passthrough", codec);
+    LOG(L"%s\n", encoder_config.c_str());
+
+    win32::MakeSureDirectoryPathExistsX(ofilename);
+    {
+        std::shared_ptr<FILE> _ = win32::fopen(ofilename, L"wb");
+    }
+    std::shared_ptr<MP4Sink> sink;
+    if (asbd.mFormatID == 'aac ')
+        sink = std::make_shared<MP4Sink>(ofilename, reader.getDecoderConfig(),
+                                         !opts.no_optimize);
+    else
+        sink = std::make_shared<MP4Sink>(ofilename, asbd, !opts.no_optimize);
+    set_tags(&reader, sink.get(), opts, encoder_config);
+
+    Progress progress(opts.verbose, reader.length(), asbd.mSampleRate);
+    std::vector<uint8_t> packet;
+    uint64_t bytes = 0;
+    try {
+        while (!g_interrupted && reader.readPacket(&packet)) {
+            sink->writeSamples(packet.data(), packet.size(),
+                               asbd.mFramesPerPacket);
+            bytes += packet.size();
+            progress.update(reader.getPosition());
+        }
+        progress.finish(reader.getPosition());
+    } catch (...) {
+        LOG(L"\n");
+        throw;
+    }
+    double duration = reader.getPosition() / asbd.mSampleRate;
+    double bitrate = duration ? bytes * 8.0 / duration / 1000.0 : 0.0;
+    LOG(L"Overall bitrate: %gkbps\n", bitrate);
+
+    sink->setGaplessMode(opts.gapless_mode + 1);
+    sink->setGaplessInfo(reader.getGaplessInfo());
+    finalize_m4a(sink.get(), duration, bitrate, ofilename, opts);
 }
 #endif // QAAC
 #ifdef REFALAC
@@ -974,36 +1404,105 @@ void encode_file(const std::shared_ptr<ISeekableSource> &src,
         decode_file(chain, ofilename, opts);
         return;
     }
+    /* channel mapper added below only reorders channels of each frame */
+    bool no_dsp = is_bare_source(chain);
     uint32_t channel_layout = map_to_aac_channels(chain, opts);
     AudioStreamBasicDescription iasbd = chain.back()->getSampleFormat();
     AudioStreamBasicDescription oasbd =
         get_encoding_ASBD(chain.back().get(), opts.output_format);
     ALACEncoderX encoder(iasbd);
     encoder.setFastMode(opts.alac_fast);
+    encoder.setVariableFrameLength(opts.alac_variable_frames);
+    if (opts.alac_tune_ag) {
+        /* the pre-scan seeks around, and we can't do that through DSP */
+        if (no_dsp && src->isSeekable())
+            encoder.tuneAGParams(src.get());
+        else
+            LOG(L"WARNING: --tune-ag is ignored for this input\n");
+    }
     auto cookie = encoder.getMagicCookie();
+    if (opts.alac_variable_frames)
+        oasbd.mFramesPerPacket = 0;
 
     win32::MakeSureDirectoryPathExistsX(ofilename);
+    encoder.setSource(chain.back());
+
+    /*
+     * With --resume, packets go to the journal first, and are copied to
+     * the output only when everything has been encoded.
+     */
+    std::shared_ptr<JournalSink> journal;
+    if (opts.resume) {
+        /* journal position is in source frames, DSP can't be in between */
+        if (no_dsp && src->isSeekable() && ofilename != L"-") {
+            /*
+             * Everything that affects the packets, other than the format
+             * and the magic cookie which the journal checks by itself.
+             */
+            Hasher h;
+            h.feed(src.get());
+            std::string job =
+                strutil::format("%016llx fast:%d vbr:%d tune-ag:%d",
+                                h.value(), opts.alac_fast,
+                                opts.alac_variable_frames,
+                                opts.alac_tune_ag);
+            journal = std::make_shared<JournalSink>(ofilename + L".resume",
+                                                    iasbd, src->length(),
+                                                    cookie, job, true);
+            if (journal->replacedStale())
+                LOG(L"WARNING: %s was made for another input or options, "
+                    L"starting over\n", (ofilename + L".resume").c_str());
+            if (journal->framesWritten()) {
+                double pos = journal->framesWritten() / iasbd.mSampleRate;
+                LOG(L"Resuming from %s\n",
+                    util::format_seconds(pos).c_str());
+                src->seekTo(journal->framesWritten());
+            }
+            encoder.setSink(journal);
+            do_encode(&encoder, ofilename, opts);
+            if (g_interrupted) {
+                journal->checkpoint();
+                LOG(L"Interrupted, run again with --resume to continue\n");
+                return;
+            }
+        } else
+            LOG(L"WARNING: --resume is ignored for this input\n");
+    }
+
     std::shared_ptr<ISink> sink;
     if (opts.is_caf)
         sink = std::make_shared<CAFSink>(ofilename, oasbd,
                                          channel_layout, cookie);
     else
         sink = std::make_shared<ALACSink>(ofilename, cookie, !opts.no_optimize);
-    encoder.setSource(chain.back());
-    encoder.setSink(sink);
     set_tags(src.get(), sink.get(), opts, L"Apple Lossless Encoder");
     CAFSink *cafsink = dynamic_cast<CAFSink*>(sink.get());
     if (cafsink)
         cafsink->beginWrite();
 
-    do_encode(&encoder, ofilename, opts);
-    LOG(L"Overall bitrate: %gkbps\n", encoder.overallBitrate());
+    double duration, bitrate;
+    if (journal.get()) {
+        journal->replay(sink.get());
+        duration = journal->framesWritten() / iasbd.mSampleRate;
+        bitrate = duration ? journal->bytesWritten() * 8.0 / duration / 1000.0
+                           : 0.0;
+    } else {
+        encoder.setSink(sink);
+        do_encode(&encoder, ofilename, opts);
+        duration = encoder.samplesRead() / iasbd.mSampleRate;
+        bitrate = encoder.overallBitrate();
+    }
+    LOG(L"Overall bitrate: %gkbps\n", bitrate);
 
     MP4SinkBase *mp4sinkbase = dynamic_cast<MP4SinkBase*>(sink.get());
     if (mp4sinkbase)
-        finalize_m4a(mp4sinkbase, &encoder, ofilename, opts);
+        finalize_m4a(mp4sinkbase, duration, bitrate, ofilename, opts);
     else if (cafsink)
         cafsink->finishWrite(AudioFilePacketTableInfo());
+    if (journal.get())
+        journal->remove();
+    report_audit(chain);
+    verify_stored_peak(chain, opts);
 }
 #endif
 
@@ -1195,6 +1694,207 @@ std::wstring get_output_filename(const std::wstring &ifilename,
     return win32::PathReplaceExtension(ofilename, tl.c_str());
 }
 
+static
+void process_inputs(const Options &opts, int argc, wchar_t **argv)
+{
+    if (opts.ofilename) {
+        std::wstring fullpath = win32::GetFullPathNameX(opts.ofilename);
+        const wchar_t *ws = fullpath.c_str();
+        if (!std::wcscmp(opts.ofilename, L"-"))
+            _setmode(1, _O_BINARY);
+    }
+
+    if (opts.sort_args) {
+        std::sort(&argv[0], &argv[argc],
+                  [](const wchar_t *a, const wchar_t *b) {
+                      return std::wcscmp(a, b) < 0;
+                  });
+    }
+    if (opts.is_raw)
+        InputFactory::instance().setRawFormat(getRawFormat(opts));
+    else
+        InputFactory::instance().clearRawFormat();
+    InputFactory::instance().setIgnoreLength(opts.ignore_length);
+
+#ifdef QAAC
+    if (opts.remux) {
+        for (int i = 0; i < argc && !g_interrupted; ++i) {
+            std::wstring ofilename = get_output_filename(argv[i], opts);
+            LOG(L"\n%s\n",
+                ofilename == L"-" ? L"<stdout>"
+                                  : PathFindFileNameW(ofilename.c_str()));
+            remux_file(argv[i], ofilename, opts);
+        }
+        return;
+    }
+#endif
+    std::vector<workItem> workItems;
+    for (int i = 0; i < argc; ++i)
+        load_track(argv[i], opts, workItems);
+
+    if (!opts.concat) {
+        for (size_t i = 0; i < workItems.size() && !g_interrupted; ++i) {
+            std::wstring ofilename =
+                get_output_filename(workItems[i].first, opts);
+            LOG(L"\n%s\n",
+                ofilename == L"-" ? L"<stdout>"
+                                  : PathFindFileNameW(ofilename.c_str()));
+            auto src = trim_input(workItems[i].second, opts);
+            src->seekTo(0);
+            encode_file(src, ofilename, opts);
+        }
+    } else {
+        std::wstring ofilename = get_output_filename(argv[0], opts);
+        LOG(L"\n%s\n",
+            ofilename == L"-" ? L"<stdout>"
+                              : PathFindFileNameW(ofilename.c_str()));
+
+        auto cs = std::make_shared<CompositeSource>();
+        for (size_t i = 0; i < workItems.size(); ++i)
+            cs->addSourceWithChapter(workItems[i].second, L"");
+
+        auto src = trim_input(cs, opts);
+        src->seekTo(0);
+        encode_file(src, ofilename, opts);
+    }
+}
+
+/*
+ * Lines of the manifest, excluding empty ones and comments.
+ * Job id is the line number.
+ */
+static
+std::vector<WorkerPool::Job> load_manifest(const Options &opts)
+{
+    std::vector<WorkerPool::Job> jobs;
+    std::wstring text = misc::loadTextFile(opts.manifest, opts.textcp);
+    strutil::Tokenizer<wchar_t> lines(text, L"\n");
+    wchar_t *line;
+    for (int lineno = 1; (line = lines.next()); ++lineno) {
+        size_t len = std::wcslen(line);
+        if (len && line[len - 1] == L'\r')
+            line[--len] = 0;
+        line += std::wcsspn(line, L" \t");
+        if (!*line || *line == L'#')
+            continue;
+        WorkerPool::Job job = { lineno, line };
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+/*
+ * A line of the manifest is parsed as a command line, preceded by
+ * the options given on the real command line (args).
+ * Returns exit status of the job; a failing job is reported and skipped.
+ */
+static
+int run_manifest_job(const Options &opts, const std::vector<wchar_t*> &args,
+                     const std::wstring &line)
+{
+    /*
+     * CommandLineToArgvW() parses the first token as a program name,
+     * with different quoting rules
+     */
+    std::wstring cmdline = L"- " + line;
+    int nargs;
+    wchar_t **argv = CommandLineToArgvW(cmdline.c_str(), &nargs);
+    if (!argv)
+        win32::throw_error("CommandLineToArgvW", GetLastError());
+    std::shared_ptr<wchar_t*> argvPtr(argv, LocalFree);
+
+    std::vector<wchar_t*> baseargs(args);
+    baseargs.push_back(0);
+    int argc = baseargs.size() - 1;
+    wchar_t **jobargv = &baseargs[0];
+
+    int result = 0;
+    try {
+        /* options of the line are parsed on top of the command line */
+        Options job;
+        getopt::optind = 0;
+        if (!job.parseOptions(argc, jobargv))
+            throw std::runtime_error("invalid options on the command line");
+        job.manifest_line = true;
+        argc = nargs;
+        jobargv = argv;
+        getopt::optind = 0;
+        if (!job.parseOptions(argc, jobargv) || !job.validate(argc))
+            throw std::runtime_error("invalid options in the manifest");
+        job.encoder_name = opts.encoder_name;
+        load_metadata_files(&job);
+        process_inputs(job, argc, jobargv);
+    } catch (const std::exception &e) {
+        LOG(L"ERROR: %s\n", errormsg(e).c_str());
+        result = 2;
+    }
+    InputFactory::instance().close();
+    return result;
+}
+
+/*
+ * Without --workers, jobs run one after another in this process,
+ * therefore DLL modules are loaded only once for the whole batch.
+ * With --workers, they are handed out to worker processes, which
+ * keeps a crash in a decoder module from taking down the whole batch.
+ */
+static
+int process_manifest(const Options &opts, const std::vector<wchar_t*> &args)
+{
+    std::vector<WorkerPool::Job> jobs = load_manifest(opts);
+    if (opts.workers) {
+        WorkerPool pool(args, opts.workers);
+        PeriodicDisplay disp(100, opts.verbose);
+        int result = pool.run(jobs, &g_interrupted,
+                              [&](const std::wstring &status) {
+                                  disp.put(status);
+                              });
+        disp.flush();
+        if (opts.verbose) fputwc('\n', stderr);
+        return result;
+    }
+    int result = 0;
+    for (size_t i = 0; i < jobs.size() && !g_interrupted; ++i) {
+        LOG(L"\n[%d] %s\n", jobs[i].id, jobs[i].command.c_str());
+        if (run_manifest_job(opts, args, jobs[i].command))
+            result = 2;
+    }
+    return result;
+}
+
+/*
+ * Worker process of --workers: runs jobs sent from the coordinator
+ * until told to quit, or the coordinator is gone.
+ * Log and progress go back to the coordinator.
+ */
+static
+int serve_worker(const Options &opts, const std::vector<wchar_t*> &args)
+{
+    WorkerChannel channel = WorkerChannel::fromArg(opts.worker_pipe);
+    DWORD last_tick = GetTickCount();
+
+    Log::instance().set_hook([&](const wchar_t *message) {
+        channel.send('L', strutil::w2us(message));
+    });
+    g_progress_hook = [&](double percent) {
+        DWORD tick = GetTickCount();
+        if (tick - last_tick > 250) {
+            last_tick = tick;
+            channel.send('P', strutil::format("%.1f", percent));
+        }
+    };
+    char type;
+    std::string payload;
+    while (channel.receive(&type, &payload) && type == 'J') {
+        int status = run_manifest_job(opts, args, strutil::us2w(payload));
+        if (!channel.send('D', strutil::format("%d", status)))
+            break;
+    }
+    g_progress_hook = std::function<void(double)>();
+    Log::instance().set_hook(std::function<void(const wchar_t *)>());
+    return 0;
+}
+
 struct ConsoleTitleSaver {
     wchar_t title[1024];
     ConsoleTitleSaver()
@@ -1247,8 +1947,34 @@ int wmain1(int argc, wchar_t **argv)
     std::getc(fp);
 #endif
     int result = 0;
+    /*
+     * options to be prepended to every job of --manifest, except for
+     * the ones of the batch itself.
+     * taken before parse(), which permutes argv.
+     */
+    static const wchar_t * const batch_options[] = {
+        L"--manifest", L"--workers", L"--worker-pipe"
+    };
+    std::vector<wchar_t*> args;
+    for (int i = 0; i < argc; ++i) {
+        size_t j, len = 0;
+        for (j = 0; j < util::sizeof_array(batch_options); ++j) {
+            len = std::wcslen(batch_options[j]);
+            if (!std::wcsncmp(argv[i], batch_options[j], len) &&
+                (!argv[i][len] || argv[i][len] == L'='))
+                break;
+        }
+        if (j == util::sizeof_array(batch_options))
+            args.push_back(argv[i]);
+        else if (!argv[i][len] && i + 1 < argc)
+            ++i;
+    }
     if (!opts.parse(argc, argv))
         return 1;
+    /* crash of a worker is handled by the coordinator, not by a dialog */
+    if (opts.worker_pipe)
+        SetErrorMode(SEM_FAILCRITICALERRORS | SEM_NOOPENFILEERRORBOX |
+                     SEM_NOGPFAULTERRORBOX);
 
     COMInitializer __com__;
     Log &logger = Log::instance();
@@ -1256,13 +1982,26 @@ int wmain1(int argc, wchar_t **argv)
     try {
         ConsoleTitleSaver consoleTitle;
 
-        if (opts.verbose)
+        /* log of a worker is forwarded to the coordinator */
+        if (opts.verbose && !opts.worker_pipe)
             logger.enable_stderr();
-        if (opts.logfilename)
+        if (opts.logfilename && !opts.worker_pipe)
             logger.enable_file(opts.logfilename);
 
-        if (opts.nice)
+        /*
+         * With --workers, these are left to the worker processes, which get
+         * the same options. The coordinator does no encoding, and what it
+         * set here would be inherited by every worker it spawns.
+         */
+        bool coordinator = opts.workers && !opts.worker_pipe;
+        if (opts.nice && !coordinator)
             SetPriorityClass(GetCurrentProcess(), IDLE_PRIORITY_CLASS);
+        if (opts.low_io_priority && !coordinator &&
+            !util::lower_io_priority())
+            LOG(L"WARNING: failed to lower I/O priority\n");
+        if (opts.affinity && !coordinator &&
+            !util::set_cpu_affinity(opts.affinity_cpus))
+            LOG(L"WARNING: failed to set CPU affinity\n");
 
         std::string encoder_name;
         encoder_name = strutil::format(PROGNAME " %s", get_qaac_version());
@@ -1324,26 +2063,8 @@ int wmain1(int argc, wchar_t **argv)
             _wputenv(env.c_str());
         }
 
-        if (opts.ofilename) {
-            std::wstring fullpath = win32::GetFullPathNameX(opts.ofilename);
-            const wchar_t *ws = fullpath.c_str();
-            if (!std::wcscmp(opts.ofilename, L"-"))
-                _setmode(1, _O_BINARY);
-        }
-
-        if (opts.sort_args) {
-            std::sort(&argv[0], &argv[argc],
-                      [](const wchar_t *a, const wchar_t *b) {
-                          return std::wcscmp(a, b) < 0;
-                      });
-        }
         SetConsoleCtrlHandler(console_interrupt_handler, TRUE);
 
-        if (opts.is_raw) {
-            InputFactory::instance().setRawFormat(getRawFormat(opts));
-        }
-        InputFactory::instance().setIgnoreLength(opts.ignore_length);
-
         struct CleanupScope {
             ~CleanupScope() {
                 InputFactory::instance().close();
@@ -1351,35 +2072,12 @@ int wmain1(int argc, wchar_t **argv)
             }
         } __cleanup__;
 
-        std::vector<workItem> workItems;
-        for (int i = 0; i < argc; ++i)
-            load_track(argv[i], opts, workItems);
-
-        if (!opts.concat) {
-            for (size_t i = 0; i < workItems.size() && !g_interrupted; ++i) {
-                std::wstring ofilename =
-                    get_output_filename(workItems[i].first, opts);
-                LOG(L"\n%s\n",
-                    ofilename == L"-" ? L"<stdout>"
-                                      : PathFindFileNameW(ofilename.c_str()));
-                auto src = trim_input(workItems[i].second, opts);
-                src->seekTo(0);
-                encode_file(src, ofilename, opts);
-            }
-        } else {
-            std::wstring ofilename = get_output_filename(argv[0], opts);
-            LOG(L"\n%s\n",
-                ofilename == L"-" ? L"<stdout>"
-                                  : PathFindFileNameW(ofilename.c_str()));
-
-            auto cs = std::make_shared<CompositeSource>();
-            for (size_t i = 0; i < workItems.size(); ++i)
-                cs->addSourceWithChapter(workItems[i].second, L"");
-
-            auto src = trim_input(cs, opts);
-            src->seekTo(0);
-            encode_file(src, ofilename, opts);
-        }
+        if (opts.worker_pipe)
+            result = serve_worker(opts, args);
+        else if (opts.manifest)
+            result = process_manifest(opts, args);
+        else
+            process_inputs(opts, argc, argv);
     } catch (const std::exception &e) {
         LOG(L"ERROR: %s\n", errormsg(e).c_str());
         result = 2;
@@ -1,12 +1,4 @@
 #include <algorithm>
-#include <riff/aiff/aifffile.h>
-#include <ape/apefile.h>
-#include <ape/apetag.h>
-#include <mpeg/mpegfile.h>
-#include <mpeg/id3v1/id3v1genres.h>
-#include <mpeg/id3v2/id3v2framefactory.h>
-#include <mpeg/id3v2/frames/textidentificationframe.h>
-#include <mpeg/id3v2/frames/attachedpictureframe.h>
 #include "metadata.h"
 #ifdef _WIN32
 #include "win32util.h"
@@ -14,7 +6,7 @@
 #include "strutil.h"
 #include "mp4v2wrapper.h"
 #include "cuesheet.h"
-#include "taglibhelper.h"
+#include <mpeg/id3v1/id3v1genres.h>
 
 namespace {
     typedef const char *kvpair_t[2];
@@ -33,6 +25,16 @@ namespace {
         else
             return 0;
     }
+
+    inline uint32_t be32(const uint8_t *p)
+    {
+        return p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    }
+
+    inline uint32_t le32(const uint8_t *p)
+    {
+        return p[0] | p[1] << 8 | p[2] << 16 | p[3] << 24;
+    }
 }
 
 namespace TextBasedTag {
@@ -170,7 +172,7 @@ namespace ID3 {
         { "TCOM", "composer"                    },
         { "TCON", "genre"                       },
         { "TCOP", "copyright"                   },
-        {" TDOR", "ORIGINAL RELEASE DATE"       },
+        { "TDOR", "ORIGINAL RELEASE DATE"       },
         { "TDRC", "recorded date"               },
         { "TEXT", "lyricist"                    },
         { "TIT1", "GROUPING"                    },
@@ -199,60 +201,319 @@ namespace ID3 {
         { "TSRC", "ISRC"                        },
         { "TSST", "SET SUBTITLE"                },
     };
-    std::map<std::string, std::string> fetchID3v2Tags(TagLib::ID3v2::Tag *tag)
+    /* ID3v2.2 frames we are interested in, and corresponding v2.4 ones */
+    const char *v22_keys[][2] = {
+        { "PIC", "APIC" },
+        { "TAL", "TALB" },
+        { "TBP", "TBPM" },
+        { "TCM", "TCOM" },
+        { "TCO", "TCON" },
+        { "TCP", "TCMP" },
+        { "TCR", "TCOP" },
+        { "TDA", "TDAT" },
+        { "TIM", "TIME" },
+        { "TOR", "TDOR" },
+        { "TP1", "TPE1" },
+        { "TP2", "TPE2" },
+        { "TP3", "TPE3" },
+        { "TP4", "TPE4" },
+        { "TPA", "TPOS" },
+        { "TPB", "TPUB" },
+        { "TRK", "TRCK" },
+        { "TT1", "TIT1" },
+        { "TT2", "TIT2" },
+        { "TT3", "TIT3" },
+        { "TXT", "TEXT" },
+        { "TXX", "TXXX" },
+        { "TYE", "TDRC" },
+    };
+    /* ID3v2.3 frames renamed in v2.4 */
+    const char *v23_keys[][2] = {
+        { "TORY", "TDOR" },
+        { "TYER", "TDRC" },
+    };
+
+    inline uint32_t synchsafe32(const uint8_t *p)
+    {
+        return (p[0] & 0x7f) << 21 | (p[1] & 0x7f) << 14
+             | (p[2] & 0x7f) << 7 | (p[3] & 0x7f);
+    }
+
+    /* remove 0x00 following 0xff */
+    void resynchronize(std::vector<uint8_t> *buf)
+    {
+        if (buf->empty())
+            return;
+        auto dst = buf->begin() + 1;
+        for (auto src = dst; src != buf->end(); ++src)
+            if (*src || src[-1] != 0xff)
+                *dst++ = *src;
+        buf->erase(dst, buf->end());
+    }
+
+    /*
+     * Read a NUL terminated string of given text encoding, convert it to
+     * UTF-8, and advance *p past the terminator.
+     */
+    std::string readString(unsigned encoding, const uint8_t **p,
+                           const uint8_t *endp)
+    {
+        const uint8_t *s = *p;
+        if (encoding == 0 || encoding == 3) {
+            const uint8_t *e = std::find(s, endp, 0);
+            *p = e < endp ? e + 1 : e;
+            if (encoding == 3)
+                return std::string(s, e);
+            return strutil::w2us(std::wstring(s, e));
+        }
+        bool big_endian = (encoding == 2);
+        if (encoding == 1 && endp - s >= 2) {
+            if (s[0] == 0xfe && s[1] == 0xff) {
+                big_endian = true;
+                s += 2;
+            } else if (s[0] == 0xff && s[1] == 0xfe)
+                s += 2;
+        }
+        std::wstring ws;
+        for (; endp - s >= 2; s += 2) {
+            wchar_t c = big_endian ? s[0] << 8 | s[1] : s[1] << 8 | s[0];
+            if (!c) {
+                s += 2;
+                break;
+            }
+            ws.push_back(c);
+        }
+        *p = std::min(s, endp);
+        return strutil::w2us(ws);
+    }
+
+    /*
+     * TCON can refer to ID3v1 genres: "(13)", "(13)Pop", "(RX)", "(CR)",
+     * or just "13" since v2.4. References are replaced by names, and
+     * a refinement equal to the referred name is dropped, like TagLib's
+     * FrameFactory does. "((" at the beginning escapes "(".
+     */
+    void resolveGenre(const std::string &s, std::vector<std::string> *out)
+    {
+        auto name = [](const std::string &ref) -> std::string {
+            if (ref == "RX")
+                return "Remix";
+            if (ref == "CR")
+                return "Cover";
+            char *endp;
+            long n = std::strtol(ref.c_str(), &endp, 10);
+            if (ref.empty() || *endp || n < 0 || n > 255)
+                return ref;
+            std::string genre = TagLib::ID3v1::genre(n).to8Bit(true);
+            return genre.size() ? genre : ref;
+        };
+        size_t pos = 0;
+        std::string last;
+        while (s.size() - pos > 1 && s[pos] == '(' && s[pos + 1] != '(') {
+            size_t end = s.find(')', pos);
+            if (end == std::string::npos)
+                break;
+            last = name(s.substr(pos + 1, end - pos - 1));
+            out->push_back(last);
+            pos = end + 1;
+        }
+        std::string text = s.substr(pos);
+        if (text.size() > 1 && text[0] == '(' && text[1] == '(')
+            text.erase(0, 1);
+        else if (!pos)
+            text = name(text);
+        if (text.size() && text != last)
+            out->push_back(text);
+    }
+
+    void parseFrame(const std::string &id, unsigned version,
+                    const uint8_t *p, const uint8_t *endp,
+                    std::map<std::string, std::string> *tags)
+    {
+        unsigned encoding = *p++;
+        if (id == "TXXX") {
+            std::string key = readString(encoding, &p, endp);
+            (*tags)[key] = readString(encoding, &p, endp);
+        } else if (id == "APIC") {
+            if (version == 2)
+                p = std::min(p + 3, endp); /* image format */
+            else
+                readString(0, &p, endp); /* MIME type */
+            if (p == endp)
+                return;
+            unsigned type = *p++;
+            readString(encoding, &p, endp); /* description */
+            if (type == 3) /* front cover */
+                (*tags)["COVER ART"] = std::string(p, endp);
+        } else if (id[0] == 'T') {
+            auto end = known_keys + util::sizeof_array(known_keys);
+            auto key = lookup_by_key(known_keys, end, id.c_str());
+            if (!key)
+                return;
+            /* v2.4 allows multiple strings, join them like TagLib does */
+            std::vector<std::string> values;
+            while (p < endp) {
+                std::string s = readString(encoding, &p, endp);
+                if (s.empty())
+                    continue;
+                if (id == "TCON")
+                    resolveGenre(s, &values);
+                else
+                    values.push_back(s);
+            }
+            std::string value;
+            for (size_t i = 0; i < values.size(); ++i) {
+                if (i) value.push_back(' ');
+                value += values[i];
+            }
+            (*tags)[key] = value;
+        }
+    }
+
+    std::map<std::string, std::string> parseTag(const uint8_t *data,
+                                                size_t size)
     {
         std::map<std::string, std::string> tags;
+        if (size < 10 || std::memcmp(data, "ID3", 3))
+            return tags;
+        unsigned version = data[3];
+        unsigned flags = data[5];
+        if (version < 2 || version > 4)
+            return tags;
+        size_t tag_size = std::min(size - 10,
+                                   static_cast<size_t>(synchsafe32(data + 6)));
+        std::vector<uint8_t> buf(data + 10, data + 10 + tag_size);
+        if ((flags & 0x80) && version < 4)
+            resynchronize(&buf);
 
-        auto frameList = tag->frameList();
-        std::for_each(frameList.begin(), frameList.end(),
-                      [&](TagLib::ID3v2::Frame *frame) {
-            auto vID = frame->frameID();
-            std::string sID(vID.data(), vID.data() + vID.size());
-
-            if (sID == "TXXX") {
-                auto txframe =
-                  dynamic_cast<TagLib::ID3v2::TextIdentificationFrame*>(frame);
-                auto fields = txframe->fieldList();
-                auto k = fields.begin()->toWString();
-                auto v = (++fields.begin())->toWString();
-                tags[strutil::w2us(k)] = strutil::w2us(v);
-            } else if (sID == "APIC") {
-                auto picframe =
-                    dynamic_cast<TagLib::ID3v2::AttachedPictureFrame*>(frame);
-                if (picframe->type() ==
-                    TagLib::ID3v2::AttachedPictureFrame::FrontCover)
-                {
-                    auto pic = picframe->picture();
-                    tags["COVER ART"] = std::string(pic.begin(), pic.end());
-                }
-            } else {
-                auto end = known_keys + util::sizeof_array(known_keys);
-                auto key = lookup_by_key(known_keys, end, sID.c_str());
+        const uint8_t *p = buf.data();
+        const uint8_t *endp = p + buf.size();
+        if ((flags & 0x40) && version > 2) { /* extended header */
+            if (endp - p < 4)
+                return tags;
+            size_t ext_size = version == 3 ? be32(p) + 4 : synchsafe32(p);
+            if (ext_size > static_cast<size_t>(endp - p))
+                return tags;
+            p += ext_size;
+        }
+        const size_t id_size = version == 2 ? 3 : 4;
+        const size_t header_size = version == 2 ? 6 : 10;
+        std::string tdat, tim; /* v2.3 and earlier: DDMM, HHMM */
+
+        while (static_cast<size_t>(endp - p) >= header_size && p[0]) {
+            std::string id(p, p + id_size);
+            size_t frame_size;
+            unsigned frame_flags = 0;
+            if (version == 2)
+                frame_size = p[3] << 16 | p[4] << 8 | p[5];
+            else {
+                frame_size = version == 3 ? be32(p + 4) : synchsafe32(p + 4);
+                frame_flags = p[9];
+            }
+            p += header_size;
+            if (frame_size > static_cast<size_t>(endp - p))
+                break;
+            const uint8_t *fp = p;
+            const uint8_t *fendp = p + frame_size;
+            p = fendp;
+
+            std::vector<uint8_t> fbuf;
+            if (version == 2) {
+                auto end = v22_keys + util::sizeof_array(v22_keys);
+                auto key = lookup_by_key(v22_keys, end, id.c_str());
+                if (!key)
+                    continue;
+                id = key;
+            } else if (version == 3) {
+                if (frame_flags & 0xc0) /* compression, encryption */
+                    continue;
+                if (frame_flags & 0x20) /* grouping identity */
+                    ++fp;
+                auto end = v23_keys + util::sizeof_array(v23_keys);
+                auto key = lookup_by_key(v23_keys, end, id.c_str());
                 if (key)
-                    tags[key] = strutil::w2us(frame->toString().toWString());
+                    id = key;
+            } else {
+                if (frame_flags & 0x0c) /* compression, encryption */
+                    continue;
+                if (frame_flags & 0x40) /* grouping identity */
+                    ++fp;
+                if (frame_flags & 0x01) /* data length indicator */
+                    fp += 4;
+                if (fp < fendp && ((frame_flags & 0x02) || (flags & 0x80))) {
+                    fbuf.assign(fp, fendp);
+                    resynchronize(&fbuf);
+                    fp = fbuf.data();
+                    fendp = fp + fbuf.size();
+                }
             }
-        });
+            if (fp < fendp && version < 4 && (id == "TDAT" || id == "TIME")) {
+                unsigned encoding = *fp++;
+                std::string &s = id == "TDAT" ? tdat : tim;
+                s = readString(encoding, &fp, fendp);
+            } else if (fp < fendp)
+                parseFrame(id, version, fp, fendp, &tags);
+        }
+        /* merge TDAT and TIME into the year, as TagLib does */
+        auto date = tags.find("recorded date");
+        if (date != tags.end() && date->second.size() == 4 &&
+            tdat.size() == 4)
+        {
+            date->second += "-" + tdat.substr(2, 2) + "-" + tdat.substr(0, 2);
+            if (tim.size() == 4)
+                date->second += "T" + tim.substr(0, 2) + ":" +
+                                tim.substr(2, 2);
+        }
         return TextBasedTag::normalizeTags(tags);
     }
+
+    /*
+     * Read whole tag at the offset in one go. Usually the first read
+     * is enough unless the tag carries a large picture.
+     */
+    std::map<std::string, std::string> fetchTags(int fd, int64_t offset)
+    {
+        util::FilePositionSaver _(fd);
+        std::vector<uint8_t> buf(0x10000);
+        if (_lseeki64(fd, offset, SEEK_SET) != offset)
+            return std::map<std::string, std::string>();
+        ssize_t n = util::nread(fd, &buf[0], buf.size());
+        if (n < 10 || std::memcmp(&buf[0], "ID3", 3))
+            return std::map<std::string, std::string>();
+        size_t size = 10 + synchsafe32(&buf[6]);
+        if (size > buf.size() && static_cast<size_t>(n) == buf.size()) {
+            buf.resize(size);
+            ssize_t nn = util::nread(fd, &buf[n], size - n);
+            if (nn > 0)
+                n += nn;
+        }
+        return parseTag(&buf[0], n);
+    }
     std::map<std::string, std::string> fetchAiffID3Tags(int fd)
     {
         util::FilePositionSaver _(fd);
-        lseek(fd, 0, SEEK_SET);
-        TagLibX::FDIOStreamReader stream(fd);
-        TagLib::RIFF::AIFF::File file(&stream, false);
-        auto tag = file.tag();
-        return fetchID3v2Tags(tag);
+        char header[12];
+        if (_lseeki64(fd, 0, SEEK_SET) != 0 ||
+            util::nread(fd, header, 12) != 12 ||
+            std::memcmp(header, "FORM", 4))
+            return std::map<std::string, std::string>();
+        int64_t pos = 12;
+        while (util::nread(fd, header, 8) == 8) {
+            uint32_t size =
+                be32(reinterpret_cast<const uint8_t *>(header + 4));
+            pos += 8;
+            if (!std::memcmp(header, "ID3 ", 4) ||
+                !std::memcmp(header, "id3 ", 4))
+                return fetchTags(fd, pos);
+            pos += size + (size & 1);
+            if (_lseeki64(fd, pos, SEEK_SET) != pos)
+                break;
+        }
+        return std::map<std::string, std::string>();
     }
     std::map<std::string, std::string> fetchMPEGID3Tags(int fd)
     {
-        util::FilePositionSaver _(fd);
-        lseek(fd, 0, SEEK_SET);
-        TagLibX::FDIOStreamReader stream(fd);
-        TagLib::MPEG::File file(&stream,
-                                TagLib::ID3v2::FrameFactory::instance(),
-                                false);
-        auto tag = file.ID3v2Tag();
-        return fetchID3v2Tags(tag);
+        return fetchTags(fd, 0);
     }
 }
 
@@ -591,3 +852,232 @@ namespace CAF {
         return fetchTags(info);
     }
 }
+
+namespace APE {
+    std::map<std::string, std::string> fetchTags(int fd)
+    {
+        std::map<std::string, std::string> tags;
+        std::string cover;
+        util::FilePositionSaver _(fd);
+
+        /* APE tag footer, possibly followed by ID3v1 tag */
+        uint8_t tail[32 + 128];
+        int64_t end = _lseeki64(fd, 0, SEEK_END);
+        if (end < static_cast<int64_t>(sizeof tail) ||
+            _lseeki64(fd, end - sizeof tail, SEEK_SET) < 0 ||
+            util::nread(fd, tail, sizeof tail) != sizeof tail)
+            return tags;
+        const uint8_t *footer = tail + 128;
+        if (!std::memcmp(tail + 32, "TAG", 3)) {
+            footer = tail;
+            end -= 128;
+        }
+        if (std::memcmp(footer, "APETAGEX", 8))
+            return tags;
+        uint32_t size = le32(footer + 12); /* including footer */
+        uint32_t count = le32(footer + 16);
+        if (size <= 32 || size > end)
+            return tags;
+        std::vector<uint8_t> buf(size - 32);
+        if (_lseeki64(fd, end - size, SEEK_SET) < 0 ||
+            util::nread(fd, &buf[0], buf.size()) != buf.size())
+            return tags;
+
+        const uint8_t *p = buf.data();
+        const uint8_t *endp = p + buf.size();
+        for (uint32_t i = 0; i < count && endp - p > 8; ++i) {
+            uint32_t value_size = le32(p);
+            uint32_t flags = le32(p + 4);
+            p += 8;
+            const uint8_t *kend = std::find(p, endp, 0);
+            if (kend == endp ||
+                value_size > static_cast<size_t>(endp - kend - 1))
+                break;
+            std::string key(p, kend);
+            const uint8_t *value = kend + 1;
+            p = value + value_size;
+
+            switch ((flags >> 1) & 3) {
+            case 0:
+                /*
+                 * multiple values are NUL separated, join them like
+                 * TagLib does
+                 */
+                {
+                    std::string text(value, p);
+                    std::replace(text.begin(), text.end(), '\0', ' ');
+                    tags[key] = text;
+                }
+                break;
+            case 1:
+                if (strcasecmp(key.c_str(), "Cover Art (Front)"))
+                    break;
+                /* strip filename\0 at the beginning */
+                value = std::find(value, p, 0);
+                if (value < p)
+                    cover.assign(value + 1, p);
+                break;
+            }
+        }
+        tags = TextBasedTag::normalizeTags(tags);
+        if (cover.size()) tags["COVER ART"] = cover;
+        return tags;
+    }
+}
+
+namespace Vorbis {
+    std::vector<uint8_t> decodeBase64(const char *s, size_t len)
+    {
+        std::vector<uint8_t> result;
+        uint32_t acc = 0;
+        int bits = 0;
+        for (size_t i = 0; i < len && s[i] != '='; ++i) {
+            int c = s[i], v;
+            if (c >= 'A' && c <= 'Z') v = c - 'A';
+            else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+            else if (c >= '0' && c <= '9') v = c - '0' + 52;
+            else if (c == '+') v = 62;
+            else if (c == '/') v = 63;
+            else continue;
+            acc = (acc << 6) | v;
+            if ((bits += 6) >= 8) {
+                bits -= 8;
+                result.push_back((acc >> bits) & 0xff);
+            }
+        }
+        return result;
+    }
+
+    /* FLAC picture block, as found in METADATA_BLOCK_PICTURE */
+    bool parsePicture(const std::vector<uint8_t> &block, std::string *data)
+    {
+        const uint8_t *p = block.data();
+        const uint8_t *endp = p + block.size();
+        if (endp - p < 8 || be32(p) != 3) /* front cover only */
+            return false;
+        p += 4;
+        for (int i = 0; i < 2; ++i) { /* MIME type, description */
+            uint32_t len = be32(p);
+            if (len > static_cast<size_t>(endp - p - 4))
+                return false;
+            p += 4 + len;
+        }
+        if (endp - p < 20)
+            return false;
+        uint32_t len = be32(p + 16);
+        p += 20;
+        if (len > static_cast<size_t>(endp - p))
+            return false;
+        data->assign(p, p + len);
+        return true;
+    }
+
+    std::map<std::string, std::string> parseComment(const uint8_t *data,
+                                                    size_t size)
+    {
+        std::map<std::string, std::string> tags;
+        std::string cover;
+        const uint8_t *p = data;
+        const uint8_t *endp = data + size;
+
+        if (endp - p < 4 ||
+            le32(p) > static_cast<size_t>(endp - p - 4)) /* vendor string */
+            return tags;
+        p += 4 + le32(p);
+        if (endp - p < 4)
+            return tags;
+        uint32_t count = le32(p);
+        p += 4;
+        for (uint32_t i = 0; i < count && endp - p >= 4; ++i) {
+            uint32_t len = le32(p);
+            p += 4;
+            if (len > static_cast<size_t>(endp - p))
+                break;
+            const char *s = reinterpret_cast<const char *>(p);
+            const char *e = s + len;
+            p += len;
+            const char *eq = std::find(s, e, '=');
+            if (eq == e)
+                continue;
+            std::string key(s, eq);
+            if (!strcasecmp(key.c_str(), "METADATA_BLOCK_PICTURE")) {
+                std::string pic;
+                if (cover.empty() &&
+                    parsePicture(decodeBase64(eq + 1, e - eq - 1), &pic))
+                    cover.swap(pic);
+            } else {
+                /* repeated fields are joined like TagLib does */
+                std::string &value = tags[strutil::supper(key)];
+                if (value.size())
+                    value.push_back(' ');
+                value.append(eq + 1, e);
+            }
+        }
+        tags = TextBasedTag::normalizeTags(tags);
+        if (cover.size()) tags["COVER ART"] = cover;
+        return tags;
+    }
+
+    /*
+     * Reassemble the second packet (comment header) of the first logical
+     * stream from Ogg pages at the beginning of the file.
+     */
+    std::map<std::string, std::string> fetchOggTags(int fd)
+    {
+        util::FilePositionSaver _(fd);
+        std::vector<uint8_t> buf(0x10000);
+        size_t filled = 0, pos = 0;
+        auto fill = [&](size_t size) -> bool {
+            if (filled - pos >= size)
+                return true;
+            if (buf.size() < pos + size)
+                buf.resize(std::max(buf.size() * 2, pos + size));
+            ssize_t n = util::nread(fd, &buf[filled], buf.size() - filled);
+            if (n > 0)
+                filled += n;
+            return filled - pos >= size;
+        };
+        if (_lseeki64(fd, 0, SEEK_SET) != 0)
+            return std::map<std::string, std::string>();
+
+        std::vector<uint8_t> packet;
+        unsigned packetno = 0;
+        uint32_t serial = 0;
+        while (packetno < 2 && fill(27)) {
+            const uint8_t *page = &buf[pos];
+            if (std::memcmp(page, "OggS", 4))
+                break;
+            unsigned nsegs = page[26];
+            if (!fill(27 + nsegs))
+                break;
+            page = &buf[pos];
+            size_t body_size = 0;
+            for (unsigned i = 0; i < nsegs; ++i)
+                body_size += page[27 + i];
+            if (!fill(27 + nsegs + body_size))
+                break;
+            page = &buf[pos];
+            if (pos == 0)
+                serial = le32(page + 14);
+            if (le32(page + 14) == serial) {
+                const uint8_t *bp = page + 27 + nsegs;
+                for (unsigned i = 0; i < nsegs && packetno < 2; ++i) {
+                    unsigned lace = page[27 + i];
+                    if (packetno == 1)
+                        packet.insert(packet.end(), bp, bp + lace);
+                    bp += lace;
+                    if (lace < 255)
+                        ++packetno;
+                }
+            }
+            pos += 27 + nsegs + body_size;
+        }
+        if (packetno < 2)
+            return std::map<std::string, std::string>();
+        if (packet.size() >= 7 && !std::memcmp(&packet[0], "\x03vorbis", 7))
+            return parseComment(&packet[7], packet.size() - 7);
+        if (packet.size() >= 8 && !std::memcmp(&packet[0], "OpusTags", 8))
+            return parseComment(&packet[8], packet.size() - 8);
+        return std::map<std::string, std::string>();
+    }
+}
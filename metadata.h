@@ -55,6 +55,17 @@ namespace ID3 {
     std::map<std::string, std::string> fetchMPEGID3Tags(int fd);
 }
 
+namespace APE {
+    std::map<std::string, std::string> fetchTags(int fd);
+}
+
+namespace Vorbis {
+    std::map<std::string, std::string> parseComment(const uint8_t *data,
+                                                    size_t size);
+    /* Ogg Vorbis or Opus */
+    std::map<std::string, std::string> fetchOggTags(int fd);
+}
+
 namespace M4A {
     const char *getTagNameFromFourCC(uint32_t fcc);
 
@@ -791,6 +791,9 @@ void MP4TableProperty::Write(MP4File& file, uint32_t index)
         ASSERT(m_pProperties[0]->GetCount() == numEntries);
     }
 
+    if (WriteBulk(file, numEntries)) {
+        return;
+    }
     for (uint32_t i = 0; i < numEntries; i++) {
         WriteEntry(file, i);
     }
@@ -803,6 +806,64 @@ void MP4TableProperty::WriteEntry(MP4File& file, uint32_t index)
     }
 }
 
+// Tables made only of integer columns (stts, stsz, stco, co64, stsc...)
+// are serialized column by column into a staging buffer and written
+// in large chunks, instead of one small WriteBytes() per value.
+// Returns false if the table has any other kind of column.
+bool MP4TableProperty::WriteBulk(MP4File& file, uint32_t numEntries)
+{
+    const uint32_t chunkBytes = 64 * 1024;
+    uint32_t numProperties = m_pProperties.Size();
+    uint32_t entrySize = 0;
+
+    for (uint32_t j = 0; j < numProperties; j++) {
+        switch (m_pProperties[j]->GetType()) {
+        case Integer8Property:
+        case Integer16Property:
+        case Integer24Property:
+        case Integer32Property:
+        case Integer64Property:
+        case Integer6432Property:
+            break;
+        default:
+            return false;
+        }
+        int size = ((MP4IntegerProperty*)m_pProperties[j])->GetWriteSize();
+        if (size < 0) {
+            return false;
+        }
+        entrySize += size;
+    }
+    if (entrySize == 0 || numEntries == 0) {
+        return true;
+    }
+
+    uint32_t entriesPerChunk = max(chunkBytes / entrySize, (uint32_t)1);
+    uint8_t* pBuffer = (uint8_t*)MP4Malloc(entriesPerChunk * entrySize);
+    try {
+        for (uint32_t i = 0; i < numEntries; i += entriesPerChunk) {
+            uint32_t count = min(entriesPerChunk, numEntries - i);
+            uint32_t offset = 0;
+            for (uint32_t j = 0; j < numProperties; j++) {
+                MP4IntegerProperty* pProperty =
+                    (MP4IntegerProperty*)m_pProperties[j];
+                int size = pProperty->GetWriteSize();
+                if (size == 0) {
+                    continue;
+                }
+                pProperty->WriteColumn(pBuffer + offset, entrySize, i, count);
+                offset += size;
+            }
+            file.WriteBytes(pBuffer, count * entrySize);
+        }
+    } catch (...) {
+        MP4Free(pBuffer);
+        throw;
+    }
+    MP4Free(pBuffer);
+    return true;
+}
+
 void MP4TableProperty::Dump(uint8_t indent,
                             bool dumpImplicits, uint32_t index)
 {
@@ -123,6 +123,17 @@ public:
 
     void IncrementValue(int32_t increment = 1, uint32_t index = 0);
 
+    // bulk serialization, used by MP4TableProperty::Write()
+    // GetWriteSize() is the number of bytes Write() emits per value,
+    // or -1 if values can't be written that way.
+    virtual int GetWriteSize() {
+        return -1;
+    }
+    // store count values starting at first, big-endian, stride bytes apart
+    virtual void WriteColumn(uint8_t* pDst, uint32_t stride,
+                             uint32_t first, uint32_t count) {
+    }
+
 private:
     MP4IntegerProperty();
     MP4IntegerProperty ( const MP4IntegerProperty &src );
@@ -186,6 +197,17 @@ private:
             } \
             file.WriteUInt##xsize(m_values[index]); \
         } \
+        int GetWriteSize() { \
+            return m_implicit ? 0 : xsize / 8; \
+        } \
+        void WriteColumn(uint8_t* pDst, uint32_t stride, \
+                         uint32_t first, uint32_t count) { \
+            for (uint32_t i = 0; i < count; i++, pDst += stride) { \
+                uint##isize##_t value = m_values[first + i]; \
+                for (int j = xsize / 8; j--; value >>= 8) \
+                    pDst[j] = (uint8_t)value; \
+            } \
+        } \
         void Dump(uint8_t indent, \
             bool dumpImplicits, uint32_t index = 0); \
     \
@@ -237,6 +259,18 @@ public:
         else
             file.WriteUInt32(m_values[index]);
     }
+    int GetWriteSize() {
+        return m_implicit ? 0 : m_is64bit ? 8 : 4;
+    }
+    void WriteColumn(uint8_t* pDst, uint32_t stride,
+                     uint32_t first, uint32_t count) {
+        int size = m_is64bit ? 8 : 4;
+        for (uint32_t i = 0; i < count; i++, pDst += stride) {
+            uint64_t value = m_values[first + i];
+            for (int j = size; j--; value >>= 8)
+                pDst[j] = (uint8_t)value;
+        }
+    }
 private:
     bool m_is64bit;
 };
@@ -262,6 +296,10 @@ public:
     void Dump(uint8_t indent,
               bool dumpImplicits, uint32_t index = 0);
 
+    int GetWriteSize() {
+        return -1;
+    }
+
 protected:
     uint8_t m_numBits;
 
@@ -540,6 +578,7 @@ public:
 protected:
     virtual void ReadEntry(MP4File& file, uint32_t index);
     virtual void WriteEntry(MP4File& file, uint32_t index);
+    virtual bool WriteBulk(MP4File& file, uint32_t numEntries);
 
     bool FindContainedProperty(const char* name,
                                MP4Property** ppProperty, uint32_t* pIndex);
@@ -67,6 +67,10 @@ MP4Track::MP4Track(MP4File& file, MP4Atom& trakAtom)
     m_cachedSttsSid = MP4_INVALID_SAMPLE_ID;
     m_cachedCttsSid = MP4_INVALID_SAMPLE_ID;
 
+    m_compactSampleSizes = false;
+    m_maxSampleSizeEntry = 0;
+    m_totalSampleSizeEntries = 0;
+
     bool success = true;
 
     MP4Integer32Property* pTrackIdProperty;
@@ -522,6 +526,8 @@ void MP4Track::FinishWrite(uint32_t options)
     // write out any remaining samples in chunk buffer
     WriteChunkBuffer();
 
+    ExpandCompactSampleSizes();
+
     if (m_pStszFixedSampleSizeProperty == NULL &&
             m_stsz_sample_bits == 4) {
         if (m_have_stz2_4bit_sample) {
@@ -635,6 +641,13 @@ uint32_t MP4Track::GetSampleSize(MP4SampleId sampleId)
             return fixedSampleSize * m_bytesPerSample;
         }
     }
+    if (m_compactSampleSizes) {
+        uint32_t index = sampleId - 1;
+        if (m_sampleSizes32.Size()) {
+            return m_bytesPerSample * m_sampleSizes32[index];
+        }
+        return m_bytesPerSample * m_sampleSizes16[index];
+    }
     // will have to check for 4 bit sample size here
     if (m_stsz_sample_bits == 4) {
         uint8_t value = m_pStszSampleSizeProperty->GetValue((sampleId - 1) / 2);
@@ -658,6 +671,10 @@ uint32_t MP4Track::GetMaxSampleSize()
         }
     }
 
+    if (m_compactSampleSizes) {
+        return m_maxSampleSizeEntry * m_bytesPerSample;
+    }
+
     uint32_t maxSampleSize = 0;
     uint32_t numSamples = m_pStszSampleSizeProperty->GetCount();
     for (MP4SampleId sid = 1; sid <= numSamples; sid++) {
@@ -686,6 +703,10 @@ uint64_t MP4Track::GetTotalOfSampleSizes()
         }
     }
 
+    if (m_compactSampleSizes) {
+        return m_totalSampleSizeEntries * m_bytesPerSample;
+    }
+
     // else non-fixed sample size, sum them
     uint64_t totalSampleSizes = 0;
     uint32_t numSamples = m_pStszSampleSizeProperty->GetCount();
@@ -699,6 +720,35 @@ uint64_t MP4Track::GetTotalOfSampleSizes()
 
 void MP4Track::SampleSizePropertyAddValue (uint32_t size)
 {
+    // a stsz we are building from scratch goes to the compact storage
+    if (!m_compactSampleSizes &&
+            m_pStszSampleSizeProperty->GetType() == Integer32Property &&
+            m_pStszSampleSizeProperty->GetCount() == 0) {
+        m_compactSampleSizes = true;
+        m_maxSampleSizeEntry = 0;
+        m_totalSampleSizeEntries = 0;
+    }
+    if (m_compactSampleSizes) {
+        if (size > 0xffff && m_sampleSizes32.Size() == 0) {
+            // widen; everything stored so far fits in 16 bits
+            uint32_t count = m_sampleSizes16.Size();
+            m_sampleSizes32.Resize(count);
+            for (uint32_t i = 0; i < count; i++) {
+                m_sampleSizes32[i] = m_sampleSizes16[i];
+            }
+            m_sampleSizes16.Resize(0);
+            m_sampleSizes32.Add(size);
+        } else if (m_sampleSizes32.Size()) {
+            m_sampleSizes32.Add(size);
+        } else {
+            m_sampleSizes16.Add((uint16_t)size);
+        }
+        if (size > m_maxSampleSizeEntry) {
+            m_maxSampleSizeEntry = size;
+        }
+        m_totalSampleSizeEntries += size;
+        return;
+    }
     // this has to deal with different sample size values
     switch (m_pStszSampleSizeProperty->GetType()) {
     case Integer32Property:
@@ -729,6 +779,28 @@ void MP4Track::SampleSizePropertyAddValue (uint32_t size)
     //  m_pStszSampleSizeProperty->IncrementValue();
 }
 
+// move sample sizes from the compact write-side storage into the
+// stsz entries property, so that the table can be serialized
+void MP4Track::ExpandCompactSampleSizes()
+{
+    if (!m_compactSampleSizes) {
+        return;
+    }
+    MP4Integer32Property* pProperty =
+        (MP4Integer32Property*)m_pStszSampleSizeProperty;
+    bool wide = m_sampleSizes32.Size() != 0;
+    uint32_t count = wide ? m_sampleSizes32.Size() : m_sampleSizes16.Size();
+
+    pProperty->SetCount(count);
+    for (uint32_t i = 0; i < count; i++) {
+        pProperty->SetValue(wide ? m_sampleSizes32[i] : m_sampleSizes16[i],
+                            i);
+    }
+    m_sampleSizes16.Resize(0);
+    m_sampleSizes32.Resize(0);
+    m_compactSampleSizes = false;
+}
+
 void MP4Track::UpdateSampleSizes(MP4SampleId sampleId, uint32_t numBytes)
 {
     if (m_bytesPerSample > 1) {
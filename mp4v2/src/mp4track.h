@@ -243,11 +243,22 @@ protected:
     MP4Integer32Property* m_pStszSampleCountProperty;
 
     void SampleSizePropertyAddValue(uint32_t bytes);
+    void ExpandCompactSampleSizes();
     uint8_t m_stsz_sample_bits;
     bool m_have_stz2_4bit_sample;
     uint8_t m_stz2_4bit_sample_value;
     MP4IntegerProperty* m_pStszSampleSizeProperty;
 
+    // While writing a new stsz, variable sample sizes are kept here
+    // instead of in m_pStszSampleSizeProperty: 16 bits per sample until
+    // a size doesn't fit, then 32 bits. Running max and total avoid
+    // rescanning at finish. Expanded into the property by FinishWrite().
+    bool                m_compactSampleSizes;
+    MP4Integer16Array   m_sampleSizes16;
+    MP4Integer32Array   m_sampleSizes32;
+    uint32_t            m_maxSampleSizeEntry;
+    uint64_t            m_totalSampleSizeEntries;
+
     MP4Integer32Property* m_pStscCountProperty;
     MP4Integer32Property* m_pStscFirstChunkProperty;
     MP4Integer32Property* m_pStscSamplesPerChunkProperty;
@@ -15,10 +15,14 @@ static getopt::option long_options[] = {
     { L"quality", required_argument, 0, 'q' },
     { L"adts", no_argument, 0, 'ADTS' },
     { L"no-smart-padding", no_argument, 0, 'nspd' },
+    { L"remux", no_argument, 0, 'rmux' },
     { L"native-resampler", optional_argument, 0, 'nsrc' },
 #endif
 #ifdef REFALAC
     { L"fast", no_argument, 0, 'afst' },
+    { L"variable-frames", no_argument, 0, 'avfr' },
+    { L"tune-ag", no_argument, 0, 'atag' },
+    { L"resume", no_argument, 0, 'rsme' },
 #endif
     { L"check", no_argument, 0, 'chck' },
     { L"alac", no_argument, 0, 'A' },
@@ -28,10 +32,17 @@ static getopt::option long_options[] = {
     { L"no-optimize", no_argument, 0, 'noop' },
     { L"bits-per-sample", required_argument, 0, 'b' },
     { L"no-dither", no_argument, 0, 'ndit' },
+    { L"noise-shaping", required_argument, 0, 'nshp' },
     { L"rate", required_argument, 0, 'r' },
+    { L"halfband-resampler", no_argument, 0, 'hbsr' },
     { L"lowpass", required_argument, 0, 'lpf ' },
     { L"peak", no_argument, 0, 'peak' },
+    { L"audit", no_argument, 0, 'adit' },
+    { L"sanitize", no_argument, 0, 'snit' },
     { L"normalize", no_argument, 0, 'N' },
+    { L"peak-from-tag", no_argument, 0, 'pktg' },
+    { L"peak-cache", required_argument, 0, 'pkch' },
+    { L"strict-peak", no_argument, 0, 'pkst' },
     { L"gain", required_argument, 0, 'gain' },
     { L"drc", required_argument, 0, 'drc ' },
     { L"limiter", no_argument, 0, 'limt' },
@@ -52,6 +63,8 @@ static getopt::option long_options[] = {
     { L"stat", no_argument, 0, 'S' },
     { L"threading", no_argument, 0, 'thrd' },
     { L"nice", no_argument, 0, 'n' },
+    { L"affinity", required_argument, 0, 'afty' },
+    { L"low-io-priority", no_argument, 0, 'lwio' },
     { L"sort-args", no_argument, 0, 'soar' },
     { L"tmpdir", required_argument, 0, 'tmpd' },
     { L"text-codepage", required_argument, 0, 'txcp' },
@@ -61,6 +74,9 @@ static getopt::option long_options[] = {
     { L"raw-format", required_argument, 0,  'Rfmt' },
     { L"ignorelength", no_argument, 0, 'i' },
     { L"concat", no_argument, 0, 'cat ' },
+    { L"manifest", required_argument, 0, 'mnfs' },
+    { L"workers", required_argument, 0, 'wrkr' },
+    { L"worker-pipe", required_argument, 0, 'wkpp' },
     { L"cue-tracks", required_argument, 0, 'ctrk' },
     { L"fname-from-tag", no_argument, 0, 'fftg' },
     { L"fname-format", required_argument, 0, 'nfmt' },
@@ -148,9 +164,25 @@ void usage()
 "                       issue especially on HE-AAC.\n"
 "                       However, resulting bitstream will be identical with\n"
 "                       iTunes only when this option is set.\n"
+"--remux                Copy ADTS(AAC) or MP3/MP2 input into M4A as is,\n"
+"                       without decoding and re-encoding.\n"
+"                       Encoding and DSP options are ignored.\n"
+"                       Encoder delay is taken from LAME tag if present.\n"
 #endif
 #ifdef REFALAC
 "--fast                 Fast stereo encoding mode.\n"
+"--variable-frames      Choose frame length from 4096, 2048 and 1024\n"
+"                       on each block, whichever compresses better.\n"
+"                       Makes encoding about 3 times slower.\n"
+"--tune-ag              Choose adaptive Golomb coder parameters from a\n"
+"                       pre-scan of the input, and the history multiplier\n"
+"                       on each frame. Requires seekable input without\n"
+"                       DSP, ignored otherwise.\n"
+"--resume               Keep encoded packets in <output>.resume while\n"
+"                       encoding, and continue from there when the previous\n"
+"                       run was interrupted. Output is written when\n"
+"                       encoding is finished. Requires seekable input\n"
+"                       without DSP, ignored otherwise.\n"
 #endif
 "-d <dirname>           Output directory. Default is current working dir.\n"
 "--check                Show library versions and exit.\n"
@@ -164,21 +196,40 @@ void usage()
 "                       auto: output sampling rate will be automatically\n"
 "                             chosen by encoder.\n"
 "                       n: desired output sampling rate in Hz.\n"
+"--halfband-resampler   Convert sampling rate by built-in halfband filters\n"
+"                       instead of libsoxr, when the rates differ by a\n"
+"                       power of 2. Faster, but aliasing is only rejected\n"
+"                       outside of the transition band.\n"
 "--lowpass <number>     Specify lowpass filter cut-off frequency in Hz.\n"
 "                       Use this when you want lower cut-off than\n"
 "                       Apple default.\n"
 "-b, --bits-per-sample <n>\n"
 "                       Bits per sample of output (for WAV/ALAC only)\n"
 "--no-dither            Turn off dither when quantizing to lower bit depth.\n" 
+"--noise-shaping <none|lipshitz|fweighted>\n"
+"                       Noise shaping filter used with dither.\n"
+"                       Only available at 44.1kHz and 48kHz.\n"
 "--peak                 Scan + print peak (don't generate output file).\n"
 "                       Cannot be used with encoding mode or -D.\n"
 "                       When DSP options are set, peak is computed \n"
 "                       after all DSP filters have been applied.\n"
+"--audit                Check input for clipped samples, NaN/Inf and\n"
+"                       DC offset while encoding, and report them\n"
+"                       for each channel.\n"
+"--sanitize             Replace NaN/Inf in input (implies --audit).\n"
 "--gain <f>             Adjust gain by f dB.\n"
 "                       Use negative value to decrese gain, when you want to\n"
 "                       avoid clipping introduced by DSP.\n"
 "-N, --normalize        Normalize (works in two pass. can generate HUGE\n"
 "                       tempfile for large piped input)\n"
+"--peak-from-tag        With -N, take the peak from ReplayGain track peak\n"
+"                       tag of the input, and normalize in single pass.\n"
+"                       Ignored when DSP is applied before normalization.\n"
+"--peak-cache <file>    With -N, remember scanned peaks in <file>, and\n"
+"                       normalize in single pass when the same input is\n"
+"                       encoded again with the same DSP options.\n"
+"--strict-peak          Verify the stored peak (from tag or cache) while\n"
+"                       encoding, and fail when it doesn't match.\n"
 "--drc <thresh:ratio:knee:attack:release>\n"
 "                       Dynamic range compression.\n"
 "                       Loud parts over threshold are attenuated by ratio.\n"
@@ -240,6 +291,11 @@ void usage()
 "-i, --ignorelength     Assume WAV input and ignore the data chunk length.\n"
 "--threading            Enable multi-threading.\n"
 "-n, --nice             Give lower process priority.\n"
+"--affinity <cpus|auto> Run on the given processors only, such as 0-3,8.\n"
+"                       With \"auto\", processors sharing the last level\n"
+"                       cache with the current one are used (XP SP3+).\n"
+"--low-io-priority      Give lower I/O priority (Vista+).\n"
+"                       This lowers CPU priority, too.\n"
 "--sort-args            Sort filenames given by command line arguments.\n"
 "--text-codepage <n>    Specify text code page of cuesheet/chapter/lyrics.\n"
 "                       Example: 1252 for Latin-1, 65001 for UTF-8.\n"
@@ -260,6 +316,23 @@ void usage()
 "--concat               Encodes whole inputs into a single file. \n"
 "                       Requires output filename (with -o)\n"
 "\n"
+"Option for batch processing:\n"
+"--manifest <filename>  Run jobs listed in the file in a single process.\n"
+"                       Each line is a job, written in the same syntax as\n"
+"                       the command line (input files and options).\n"
+"                       Options given on the command line apply to every\n"
+"                       job, and can be overridden by options on the line.\n"
+"                       Encoding mode (-V, -a, -A etc.) on a line\n"
+"                       replaces the one on the command line.\n"
+"                       Options of the whole process (--log, --tmpdir,\n"
+"                       --nice, --verbose etc.) cannot be given on a line.\n"
+"                       Empty lines and lines starting with # are ignored.\n"
+"--workers <n>          Run jobs of --manifest in n worker processes in\n"
+"                       parallel (1-64). Each worker is a copy of this\n"
+"                       program. A worker that crashes is restarted, and\n"
+"                       the job is retried once. --nice, --affinity and\n"
+"                       --low-io-priority are applied by each worker.\n"
+"\n"
 "Option for cuesheet input only:\n"
 "--cue-tracks <n[-n][,n[-n]]*>\n"
 "                       Limit extraction to specified tracks.\n"
@@ -358,12 +431,60 @@ static const wchar_t * const short_opts = L"hDo:d:b:r:insRSNAa:V:v:c:q:";
 static const wchar_t * const short_opts = L"hDo:d:b:r:insRSNA";
 #endif
 
+/* options of the whole process, which cannot be changed per job */
+static const int process_options[] = {
+    'h', 'chck', 'fmts', 's', 'verb', 'n', 'afty', 'lwio', 'tmpd', 'log ',
+    'mnfs', 'wrkr', 'wkpp'
+};
+static const int *process_options_end =
+    process_options + util::sizeof_array(process_options);
+
+static const int mode_options[] = {
+    'c', 'a', 'v', 'V', 'A', 'D', 'aach', 'play', 'peak'
+};
+static const int *mode_options_end =
+    mode_options + util::sizeof_array(mode_options);
+
+static std::wstring option_name(int ch)
+{
+    if (ch < 0xff)
+        return strutil::format(L"-%c", ch);
+    for (const getopt::option *p = long_options; p->name; ++p)
+        if (p->val == ch)
+            return strutil::format(L"--%s", p->name);
+    return L"option";
+}
+
 bool Options::parse(int &argc, wchar_t **&argv)
+{
+    return parseOptions(argc, argv) && validate(argc);
+}
+
+bool Options::parseOptions(int &argc, wchar_t **&argv)
 {
     int ch, pos;
     while ((ch = getopt::getopt_long(argc, argv,
                                    short_opts, long_options, 0)) != EOF)
     {
+        if (this->manifest_line) {
+            if (std::find(process_options, process_options_end, ch)
+                    != process_options_end) {
+                std::wstring msg =
+                    strutil::format(L"%s cannot be given in the manifest.\n",
+                                    option_name(ch).c_str());
+                complain(msg.c_str());
+                return false;
+            }
+            /* encoding mode of the line replaces the one on command line */
+            if (!this->line_mode_given &&
+                std::find(mode_options, mode_options_end, ch)
+                    != mode_options_end) {
+                this->output_format = 0;
+                this->method = -1;
+                this->bitrate = -1.0;
+                this->line_mode_given = true;
+            }
+        }
         if (ch == 'h')
             return usage(), false;
         else if (ch == 'chck')
@@ -432,6 +553,8 @@ bool Options::parse(int &argc, wchar_t **&argv)
             this->logfilename = getopt::optarg;
         else if (ch == 'nspd')
             this->no_smart_padding = true;
+        else if (ch == 'rmux')
+            this->remux = true;
         else if (ch == 'nsrc') {
             this->native_resampler = true;
             if (getopt::optarg) {
@@ -453,6 +576,16 @@ bool Options::parse(int &argc, wchar_t **&argv)
         }
         else if (ch == 'N')
             this->normalize = true;
+        else if (ch == 'adit')
+            this->audit = true;
+        else if (ch == 'snit')
+            this->sanitize = true;
+        else if (ch == 'pktg')
+            this->peak_from_tag = true;
+        else if (ch == 'pkch')
+            this->peak_cache = getopt::optarg;
+        else if (ch == 'pkst')
+            this->strict_peak = true;
         else if (ch == 's')
             this->verbose = 0;
         else if (ch == 'verb')
@@ -461,6 +594,18 @@ bool Options::parse(int &argc, wchar_t **&argv)
             this->save_stat = true;
         else if (ch == 'n')
             this->nice = true;
+        else if (ch == 'afty') {
+            this->affinity = true;
+            if (std::wcscmp(getopt::optarg, L"auto") &&
+                !strutil::parse_numeric_ranges(getopt::optarg,
+                                               &this->affinity_cpus, 0, 1023))
+            {
+                complain(L"Invalid arg for --affinity.\n");
+                return false;
+            }
+        }
+        else if (ch == 'lwio')
+            this->low_io_priority = true;
         else if (ch == 'thrd')
             this->threading = true;
         else if (ch == 'i')
@@ -513,6 +658,8 @@ bool Options::parse(int &argc, wchar_t **&argv)
                 return false;
             }
         }
+        else if (ch == 'hbsr')
+            this->halfband_resampler = true;
         else if (ch == 'lpf ') {
             if (std::swscanf(getopt::optarg, L"%u", &this->lowpass) != 1) {
                 complain(L"--lowpass requires an integer.\n");
@@ -534,6 +681,20 @@ bool Options::parse(int &argc, wchar_t **&argv)
         else if (ch == 'ndit') {
             this->no_dither = true;
         }
+        else if (ch == 'nshp') {
+            static const wchar_t *shapes[] = {
+                L"none", L"lipshitz", L"fweighted"
+            };
+            size_t i = 0;
+            for (; i < util::sizeof_array(shapes); ++i)
+                if (!std::wcscmp(getopt::optarg, shapes[i]))
+                    break;
+            if (i == util::sizeof_array(shapes)) {
+                complain(L"Invalid arg for --noise-shaping.\n");
+                return false;
+            }
+            this->noise_shaping = i;
+        }
         else if (ch == 'mask') {
             if (std::swscanf(getopt::optarg, L"%i", &this->chanmask) != 1) {
                 complain(L"--chanmask requires an integer.\n");
@@ -569,6 +730,12 @@ bool Options::parse(int &argc, wchar_t **&argv)
             this->raw_format = getopt::optarg;
         else if (ch == 'afst')
             this->alac_fast = true;
+        else if (ch == 'avfr')
+            this->alac_variable_frames = true;
+        else if (ch == 'atag')
+            this->alac_tune_ag = true;
+        else if (ch == 'rsme')
+            this->resume = true;
         else if (ch == 'gain') {
             if (std::swscanf(getopt::optarg, L"%lf", &this->gain) != 1) {
                 complain(L"--gain requires an floating point number.\n");
@@ -637,6 +804,17 @@ bool Options::parse(int &argc, wchar_t **&argv)
         }
         else if (ch == 'soar')
             this->sort_args = true;
+        else if (ch == 'mnfs')
+            this->manifest = getopt::optarg;
+        else if (ch == 'wrkr') {
+            if (std::swscanf(getopt::optarg, L"%u", &this->workers) != 1 ||
+                this->workers < 1 || this->workers > 64) {
+                complain(L"Invalid arg for --workers.\n");
+                return false;
+            }
+        }
+        else if (ch == 'wkpp')
+            this->worker_pipe = getopt::optarg;
         else if (ch == 'gapm') {
             if (std::swscanf(getopt::optarg, L"%u", &this->gapless_mode) != 1) {
                 complain(L"Invalid arg for --gapless-mode.\n");
@@ -730,8 +908,21 @@ bool Options::parse(int &argc, wchar_t **&argv)
     }
     argc -= getopt::optind;
     argv += getopt::optind;
+    return true;
+}
 
-    if (!argc && !this->check_only && !this->print_available_formats) {
+bool Options::validate(int argc)
+{
+    if (argc && this->manifest) {
+        complain(L"Input files cannot be given with --manifest.\n");
+        return false;
+    }
+    if (this->workers && !this->manifest) {
+        complain(L"--workers requires --manifest.\n");
+        return false;
+    }
+    if (!argc && !this->manifest && !this->worker_pipe &&
+        !this->check_only && !this->print_available_formats) {
         if (getopt::optind == 1)
             return usage(), false;
         else {
@@ -789,6 +980,14 @@ bool Options::parse(int &argc, wchar_t **&argv)
         complain(L"--num-priming is only applicable for AAC LC.\n");
         return false;
     }
+    if (this->remux && (!isAAC() || !isMP4())) {
+        complain(L"--remux is only available for M4A output.\n");
+        return false;
+    }
+    if (this->remux && (this->concat || this->is_raw)) {
+        complain(L"--remux cannot be used with --concat or --raw.\n");
+        return false;
+    }
     if (this->delay && this->start) {
         complain(L"Can't use --start and --delay at the same time.\n");
         return false;
@@ -36,12 +36,13 @@ struct Options {
 
         bits_per_sample(0), raw_channels(2), raw_sample_rate(44100),
         artwork_size(0), native_resampler_complexity(0), textcp(0),
-        gapless_mode(0),
+        gapless_mode(0), noise_shaping(0), workers(0),
 
         ofilename(0), outdir(0), raw_format(L"S16LE"),
         fname_format(L"${tracknumber}${title& }${title}"),
         chapter_file(0), logfilename(0), remix_preset(0), remix_file(0),
-        tmpdir(0), start(0), end(0), delay(0),
+        tmpdir(0), manifest(0), worker_pipe(0), peak_cache(0), start(0),
+        end(0), delay(0),
 
         is_raw(false), is_adts(false), is_caf(false),
         save_stat(false), nice(false), native_chanmapper(false),
@@ -51,12 +52,20 @@ struct Options {
         concat(false), no_matrix_normalize(false), no_dither(false),
         filename_from_tag(false), sort_args(false),
         no_smart_padding(false), limiter(false), copy_artwork(false),
+        remux(false), alac_variable_frames(false), affinity(false),
+        low_io_priority(false), alac_tune_ag(false), resume(false),
+        peak_from_tag(false), strict_peak(false), audit(false),
+        sanitize(false), halfband_resampler(false), manifest_line(false),
+        line_mode_given(false),
 
         bitrate(-1.0), gain(0.0),
 
         output_format(0)
     {}
     bool parse(int &argc, wchar_t **&argv);
+    /* parse() is these two; argc/argv are left pointing to input files */
+    bool parseOptions(int &argc, wchar_t **&argv);
+    bool validate(int argc);
 
     bool isMP4() const
     {
@@ -105,15 +114,28 @@ struct Options {
     uint32_t bits_per_sample, raw_channels, raw_sample_rate,
              artwork_size, native_resampler_complexity, textcp,
              gapless_mode;
+    unsigned noise_shaping; /* 0: none (flat TPDF)
+                               1: lipshitz
+                               2: f-weighted */
+    unsigned workers; /* number of worker processes for --manifest */
     const wchar_t
             *ofilename, *outdir, *raw_format, *fname_format, *chapter_file,
-            *logfilename, *remix_preset, *remix_file, *tmpdir,
-            *start, *end, *delay;
+            *logfilename, *remix_preset, *remix_file, *tmpdir, *manifest,
+            *worker_pipe, *peak_cache, *start, *end, *delay;
     bool is_raw, is_adts, is_caf, save_stat, nice, native_chanmapper,
          ignore_length, no_optimize, native_resampler, check_only,
          normalize, print_available_formats, alac_fast, threading,
          concat, no_matrix_normalize, no_dither, filename_from_tag,
-         sort_args, no_smart_padding, limiter, copy_artwork;
+         sort_args, no_smart_padding, limiter, copy_artwork, remux,
+         alac_variable_frames, affinity, low_io_priority, alac_tune_ag,
+         resume, peak_from_tag, strict_peak, audit, sanitize,
+         halfband_resampler;
+    /*
+     * set while parsing a line of --manifest on top of the command line
+     * options: encoding mode of the line replaces the one of the command
+     * line, and options of the whole process are rejected.
+     */
+    bool manifest_line, line_mode_given;
     double bitrate, gain;
 
     uint32_t output_format;
@@ -127,6 +149,7 @@ struct Options {
     std::wstring encoder_name;
     std::vector<uint32_t> chanmap;
     std::vector<int> cue_tracks;
+    std::vector<int> affinity_cpus; /* empty: auto */
 };
 
 #endif
@@ -52,6 +52,8 @@ void CAFSink::writeSamples(const void *data, size_t length, size_t nsamples)
     m_frames_written += nsamples;
     if (m_asbd.mBytesPerFrame == 0)
         m_packet_table.push_back(length);
+    if (m_asbd.mFramesPerPacket == 0)
+        m_packet_frames.push_back(nsamples);
 }
 
 void CAFSink::finishWrite(const AudioFilePacketTableInfo &info)
@@ -176,13 +178,19 @@ void CAFSink::pakt(const AudioFilePacketTableInfo &info)
     write32(info.mPrimingFrames);
     if (info.mPrimingFrames || info.mRemainderFrames)
         write32(info.mRemainderFrames);
+    else if (m_asbd.mFramesPerPacket == 0)
+        write32(0);
     else {
         uint32_t remainder =
             m_packet_table.size() * m_asbd.mFramesPerPacket - m_frames_written;
         write32(remainder);
     }
-    for (size_t i = 0; i < m_packet_table.size(); ++i)
+    /* variable frames per packet: each entry is followed by frame count */
+    for (size_t i = 0; i < m_packet_table.size(); ++i) {
         writeBER(m_packet_table[i]);
+        if (m_asbd.mFramesPerPacket == 0)
+            writeBER(m_packet_frames[i]);
+    }
 
     int64_t off = _ftelli64(m_file.get());
     if (_fseeki64(m_file.get(), pakt_pos + 4, SEEK_SET) == 0)
@@ -16,6 +16,7 @@ class CAFSink : public ISink, public ITagStore {
     std::vector<uint8_t > m_magic_cookie;
     std::map<std::string, std::string> m_tags;
     std::vector<uint32_t> m_packet_table;
+    std::vector<uint32_t> m_packet_frames;
     AudioStreamBasicDescription m_asbd;
 public:
     CAFSink(const std::wstring &filename,
@@ -0,0 +1,141 @@
+#include <io.h>
+#include "JournalSink.h"
+#include "util.h"
+
+namespace {
+    const char kMagic[8] = { 'q', 'a', 'j', 'r', 'n', 'l', '0', '2' };
+    /* frames, packet bytes, record bytes */
+    const size_t kCheckpointSize = 24;
+    /* in seconds of audio */
+    const unsigned kCheckpointInterval = 60;
+
+    template <typename T>
+    void put(std::vector<uint8_t> *vec, const T &obj)
+    {
+        const uint8_t *p = reinterpret_cast<const uint8_t*>(&obj);
+        vec->insert(vec->end(), p, p + sizeof obj);
+    }
+}
+
+JournalSink::JournalSink(const std::wstring &path,
+                         const AudioStreamBasicDescription &asbd,
+                         uint64_t length, const std::vector<uint8_t> &cookie,
+                         const std::string &job, bool resume)
+    : m_path(path),
+      m_frames_written(0),
+      m_bytes_written(0),
+      m_data_size(0),
+      m_stale(false)
+{
+    m_header.assign(kMagic, kMagic + sizeof kMagic);
+    put(&m_header, length);
+    put(&m_header, asbd);
+    put(&m_header, static_cast<uint32_t>(cookie.size()));
+    m_header.insert(m_header.end(), cookie.begin(), cookie.end());
+    put(&m_header, static_cast<uint32_t>(job.size()));
+    m_header.insert(m_header.end(), job.begin(), job.end());
+
+    m_checkpoint_interval =
+        static_cast<uint64_t>(asbd.mSampleRate * kCheckpointInterval);
+    if (!resume || !open())
+        create();
+    m_next_checkpoint = m_frames_written + m_checkpoint_interval;
+}
+
+void JournalSink::writeSamples(const void *data, size_t length,
+                               size_t nsamples)
+{
+    uint32_t record[2] = {
+        static_cast<uint32_t>(length), static_cast<uint32_t>(nsamples)
+    };
+    write(record, sizeof record);
+    write(data, length);
+    m_frames_written += nsamples;
+    m_bytes_written += length;
+    m_data_size += sizeof record + length;
+    if (m_frames_written >= m_next_checkpoint)
+        checkpoint();
+}
+
+void JournalSink::checkpoint()
+{
+    FILE *fp = m_file.get();
+    /* records have to reach the disk before the checkpoint refers them */
+    CHECKCRT(std::fflush(fp));
+    CHECKCRT(_commit(fd()));
+    uint64_t slot[3] = { m_frames_written, m_bytes_written, m_data_size };
+    CHECKCRT(_fseeki64(fp, m_header.size(), SEEK_SET));
+    write(slot, sizeof slot);
+    CHECKCRT(std::fflush(fp));
+    CHECKCRT(_fseeki64(fp, 0, SEEK_END));
+    m_next_checkpoint = m_frames_written + m_checkpoint_interval;
+}
+
+void JournalSink::replay(ISink *sink)
+{
+    checkpoint();
+    FILE *fp = m_file.get();
+    CHECKCRT(_fseeki64(fp, m_header.size() + kCheckpointSize, SEEK_SET));
+    std::vector<uint8_t> packet;
+    for (uint64_t pos = 0; pos < m_data_size; ) {
+        uint32_t record[2];
+        util::check_eof(std::fread(record, sizeof record, 1, fp) == 1);
+        packet.resize(record[0] + 1);
+        util::check_eof(std::fread(&packet[0], 1, record[0], fp)
+                        == record[0]);
+        sink->writeSamples(&packet[0], record[0], record[1]);
+        pos += sizeof record + record[0];
+    }
+}
+
+void JournalSink::remove()
+{
+    m_file.reset();
+    DeleteFileW(win32::prefixed_path(m_path.c_str()).c_str());
+}
+
+bool JournalSink::open()
+{
+    if (GetFileAttributesW(win32::prefixed_path(m_path.c_str()).c_str())
+            == INVALID_FILE_ATTRIBUTES)
+        return false;
+    m_file = win32::fopen(m_path, L"rb+");
+    std::vector<uint8_t> header(m_header.size());
+    ssize_t hsize = header.size();
+    uint64_t slot[3];
+    if (util::nread(fd(), &header[0], hsize) != hsize ||
+        header != m_header ||
+        util::nread(fd(), slot, sizeof slot) != sizeof slot) {
+        m_file.reset();
+        m_stale = true;
+        return false;
+    }
+    /* discard records written after the last checkpoint */
+    int64_t end = m_header.size() + kCheckpointSize + slot[2];
+    if (_filelengthi64(fd()) < end) {
+        m_file.reset();
+        m_stale = true;
+        return false;
+    }
+    CHECKCRT(_chsize_s(fd(), end));
+    CHECKCRT(_fseeki64(m_file.get(), 0, SEEK_END));
+    m_frames_written = slot[0];
+    m_bytes_written = slot[1];
+    m_data_size = slot[2];
+    return true;
+}
+
+void JournalSink::create()
+{
+    m_file = win32::fopen(m_path, L"wb+");
+    uint64_t slot[3] = { 0 };
+    write(&m_header[0], m_header.size());
+    write(slot, sizeof slot);
+    CHECKCRT(std::fflush(m_file.get()));
+}
+
+void JournalSink::write(const void *data, size_t size)
+{
+    if (size && std::fwrite(data, 1, size, m_file.get()) != size)
+        util::throw_crt_error("JournalSink: write failed");
+}
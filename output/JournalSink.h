@@ -0,0 +1,66 @@
+#ifndef _JOURNALSINK_H
+#define _JOURNALSINK_H
+
+#include <vector>
+#include "CoreAudio/CoreAudioTypes.h"
+#include "ISink.h"
+#include "win32util.h"
+
+/*
+ * Keeps encoded packets in a side file, so that an interrupted encoding
+ * can be resumed later.
+ *
+ * The file starts with a header identifying the encoding (source length,
+ * format, magic cookie, and a job key from the caller which identifies
+ * the source content and encoder options), followed by a checkpoint slot,
+ * followed by packet records (32bit size, 32bit number of frames, then
+ * the packet).
+ * The checkpoint slot is rewritten after the records have been committed
+ * to the disk, therefore records beyond the checkpoint are simply
+ * discarded on resume, no matter how the previous run was ended.
+ *
+ * Since every packet is independently decodable, an encoder can continue
+ * from framesWritten() as if it had been started there, as long as
+ * the source is seeked to the same position.
+ * When the encoding is finished, replay() copies everything to the real
+ * sink.
+ */
+class JournalSink: public ISink {
+    std::wstring m_path;
+    std::shared_ptr<FILE> m_file;
+    uint64_t m_frames_written;
+    uint64_t m_bytes_written;
+    uint64_t m_data_size;
+    uint64_t m_next_checkpoint;
+    uint64_t m_checkpoint_interval;
+    std::vector<uint8_t> m_header;
+    bool m_stale;
+public:
+    /*
+     * If resume is true and path holds a journal of the same encoding,
+     * it is continued from the last checkpoint. Otherwise a new journal is
+     * created.
+     */
+    JournalSink(const std::wstring &path,
+                const AudioStreamBasicDescription &asbd, uint64_t length,
+                const std::vector<uint8_t> &cookie, const std::string &job,
+                bool resume);
+    /* a journal was there, but for another encoding, and was replaced */
+    bool replacedStale() const { return m_stale; }
+    /* frames already in the journal when opened, plus written since */
+    uint64_t framesWritten() const { return m_frames_written; }
+    /* total size of the packets */
+    uint64_t bytesWritten() const { return m_bytes_written; }
+    void writeSamples(const void *data, size_t length, size_t nsamples);
+    void checkpoint();
+    void replay(ISink *sink);
+    /* close and delete the journal */
+    void remove();
+private:
+    int fd() { return fileno(m_file.get()); }
+    bool open();
+    void create();
+    void write(const void *data, size_t size);
+};
+
+#endif
@@ -0,0 +1,50 @@
+#include <cstring>
+#include <algorithm>
+#include "PipeWriter.h"
+#include "win32util.h"
+
+PipeWriter::PipeWriter(int fd)
+    : m_fd(fd),
+      m_buffer(BLOCK_SIZE),
+      m_filled(0),
+      m_last_flush(GetTickCount())
+{
+}
+
+PipeWriter::~PipeWriter()
+{
+    try {
+        flush();
+    } catch (...) {}
+}
+
+void PipeWriter::write(const void *data, size_t size)
+{
+    const char *bp = static_cast<const char*>(data);
+    while (size > 0) {
+        size_t n = std::min(size, BLOCK_SIZE - m_filled);
+        std::memcpy(&m_buffer[m_filled], bp, n);
+        m_filled += n;
+        bp += n;
+        size -= n;
+        if (m_filled == BLOCK_SIZE)
+            flush();
+    }
+    if (GetTickCount() - m_last_flush > FLUSH_INTERVAL)
+        flush();
+}
+
+void PipeWriter::flush()
+{
+    m_last_flush = GetTickCount();
+    const char *bp = &m_buffer[0];
+    size_t size = m_filled;
+    m_filled = 0;
+    while (size > 0) {
+        int n = ::_write(m_fd, bp, static_cast<unsigned>(size));
+        if (n < 0)
+            util::throw_crt_error("write failed");
+        bp += n;
+        size -= n;
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef _PIPEWRITER_H
+#define _PIPEWRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Batched writer for non-seekable output (pipe).
+ * Data is accumulated into a block, and written with a single write()
+ * when the block is full. So that a live consumer is not kept waiting,
+ * the block is also written out when FLUSH_INTERVAL (ms) has passed
+ * since the last write.
+ */
+class PipeWriter {
+    enum { BLOCK_SIZE = 0x10000, FLUSH_INTERVAL = 100 };
+    int m_fd;
+    std::vector<char> m_buffer;
+    size_t m_filled;
+    uint32_t m_last_flush;
+public:
+    explicit PipeWriter(int fd);
+    ~PipeWriter();
+    void write(const void *data, size_t size);
+    void flush();
+private:
+    PipeWriter(const PipeWriter &);
+    PipeWriter &operator=(const PipeWriter &);
+};
+
+#endif
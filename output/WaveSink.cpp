@@ -24,6 +24,8 @@ WaveSink::WaveSink(const std::shared_ptr<FILE> &fp,
           m_chanmask(chanmask), m_bytes_written(0), m_asbd(asbd)
 {
     m_seekable = win32::is_seekable(fileno(fp.get()));
+    if (!m_seekable)
+        m_pipe = std::make_shared<PipeWriter>(fileno(fp.get()));
     std::string header = buildHeader();
 
     uint32_t hdrsize = header.size();
@@ -115,7 +117,6 @@ void WaveSink::writeSamples(const void *data, size_t length, size_t nsamples)
     }
     write(bp, length);
     m_bytes_written += length;
-    if (!m_seekable) std::fflush(m_file.get());
 }
 
 void WaveSink::finishWrite()
@@ -125,7 +126,10 @@ void WaveSink::finishWrite()
     m_closed = true;
     FILE *fp = m_file.get();
     if (m_bytes_written & 1) write("\0", 1);
-    if (!m_seekable) return;
+    if (!m_seekable) {
+        m_pipe->flush();
+        return;
+    }
     uint64_t datasize64 = m_bytes_written;
     uint64_t riffsize64 = datasize64 + m_data_pos - 8;
     uint64_t nsamples = m_bytes_written / m_bytes_per_frame;
@@ -3,9 +3,11 @@
 
 #include "ISink.h"
 #include "win32util.h"
+#include "PipeWriter.h"
 
 class WaveSink : public ISink {
     std::shared_ptr<FILE> m_file;
+    std::shared_ptr<PipeWriter> m_pipe;
     bool m_closed;
     bool m_seekable;
     bool m_rf64;
@@ -31,9 +33,13 @@ private:
     std::string buildHeader();
     void write(const void *data, size_t length)
     {
-        std::fwrite(data, 1, length, m_file.get());
-        if (ferror(m_file.get()))
-            win32::throw_error("write failed", _doserrno);
+        if (m_pipe.get())
+            m_pipe->write(data, length);
+        else {
+            std::fwrite(data, 1, length, m_file.get());
+            if (ferror(m_file.get()))
+                win32::throw_error("write failed", _doserrno);
+        }
     }
 };
 
@@ -390,6 +390,29 @@ MP4Sink::MP4Sink(const std::wstring &path,
     }
 }
 
+MP4Sink::MP4Sink(const std::wstring &path,
+                 const AudioStreamBasicDescription &asbd,
+                 bool temp)
+        : MP4SinkBase(path, temp),
+          m_gapless_mode(MODE_ITUNSMPB)
+{
+    std::memset(&m_priming_info, 0, sizeof m_priming_info);
+    try {
+        unsigned rate = asbd.mSampleRate;
+        /* MPEG-2 (LSF) and 2.5 are below 32kHz */
+        uint8_t type = rate >= 32000 ? MP4_MPEG1_AUDIO_TYPE
+                                     : MP4_MPEG2_AUDIO_TYPE;
+        m_mp4file.SetTimeScale(rate);
+        m_track_id = m_mp4file.AddAudioTrack(rate, asbd.mFramesPerPacket,
+                                             type);
+        m_mp4file.SetIntegerProperty(
+                "moov.trak.mdia.minf.stbl.stsd.mp4a.channels",
+                asbd.mChannelsPerFrame);
+    } catch (mp4v2::impl::Exception *e) {
+        handle_mp4error(e);
+    }
+}
+
 void MP4Sink::writeTags()
 {
     MP4TrackId tid = m_mp4file.FindTrackId(0);
@@ -452,6 +475,30 @@ ADTSSink::ADTSSink(const std::shared_ptr<FILE> &fp,
 
 void ADTSSink::writeSamples(const void *data, size_t length, size_t nsamples)
 {
+    /* fill frame_length of the header template, and write at once */
+    size_t frame_length = length + m_pce_data.size() + 7;
+    if (m_frame.size() < frame_length)
+        m_frame.resize(frame_length);
+    uint8_t *fp = &m_frame[0];
+    std::memcpy(fp, m_header, 7);
+    fp[3] |= (frame_length >> 11) & 0x3;
+    fp[4]  = (frame_length >> 3) & 0xff;
+    fp[5] |= (frame_length & 0x7) << 5;
+    if (m_pce_data.size())
+        std::memcpy(fp + 7, &m_pce_data[0], m_pce_data.size());
+    std::memcpy(fp + 7 + m_pce_data.size(), data, length);
+    write(fp, frame_length);
+}
+
+void ADTSSink::init(const std::vector<uint8_t> &config)
+{
+    m_seekable = win32::is_seekable(fileno(m_fp.get()));
+    if (!m_seekable)
+        m_pipe = std::make_shared<PipeWriter>(fileno(m_fp.get()));
+    unsigned rate;
+    size_t off = parseDecSpecificConfig(config, &m_sample_rate_index, &rate,
+                                        &m_channel_config);
+
     BitStream bs;
     bs.put(0xfff, 12); // syncword
     bs.put(0, 1);  // ID(MPEG identifier). 0 for MPEG4, 1 for MPEG2
@@ -467,23 +514,11 @@ void ADTSSink::writeSamples(const void *data, size_t length, size_t nsamples)
                    * copyright_identification_bit: 1
                    * copyright_identification_start: 1
                    */
-    bs.put(length + m_pce_data.size() + 7, 13); // frame_length
+    bs.put(0, 13); // frame_length, filled per frame
     bs.put(0x7ff, 11); // adts_buffer_fullness, 0x7ff for VBR
     bs.put(0, 2); // number_of_raw_data_blocks_in_frame
     bs.byteAlign();
-
-    write(bs.data(), 7);
-    if (m_pce_data.size())
-        write(&m_pce_data[0], m_pce_data.size());
-    write(data, length);
-}
-
-void ADTSSink::init(const std::vector<uint8_t> &config)
-{
-    m_seekable = win32::is_seekable(fileno(m_fp.get()));
-    unsigned rate;
-    size_t off = parseDecSpecificConfig(config, &m_sample_rate_index, &rate,
-                                        &m_channel_config);
+    std::memcpy(m_header, bs.data(), 7);
 
     /* keep program config element stored in GASpecificConfig */
     if (m_channel_config == 0 && config.size() * 8 > off) {
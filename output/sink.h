@@ -6,6 +6,7 @@
 #include "ISink.h"
 #include "win32util.h"
 #include "misc.h"
+#include "PipeWriter.h"
 
 class MP4SinkBase: public ITagStore {
 protected:
@@ -71,6 +72,9 @@ public:
     };
     MP4Sink(const std::wstring &path, const std::vector<uint8_t> &cookie,
             bool temp=false);
+    /* MPEG-1/2 audio (mp3 and such), which has no decoder config */
+    MP4Sink(const std::wstring &path, const AudioStreamBasicDescription &asbd,
+            bool temp=false);
     void writeSamples(const void *data, size_t length, size_t nsamples)
     {
         try {
@@ -115,18 +119,29 @@ class ADTSSink: public ISink {
     uint32_t m_sample_rate_index;
     uint32_t m_channel_config;
     bool m_seekable;
+    uint8_t m_header[7];
     std::vector<uint8_t> m_pce_data;
+    std::vector<uint8_t> m_frame;
+    std::shared_ptr<PipeWriter> m_pipe;
 public:
     ADTSSink(const std::wstring &path, const std::vector<uint8_t> &cookie,
              bool append=false);
     ADTSSink(const std::shared_ptr<FILE> &fp,
              const std::vector<uint8_t> &cookie);
     void writeSamples(const void *data, size_t length, size_t nsamples);
+    /* writes out what is buffered for a pipe, so that errors surface */
+    void finishWrite()
+    {
+        if (m_pipe.get())
+            m_pipe->flush();
+    }
 private:
     void init(const std::vector<uint8_t> &cookie);
     void write(const void *data, size_t size)
     {
-        if (_write(fileno(m_fp.get()), data, size) < 0)
+        if (m_pipe.get())
+            m_pipe->write(data, size);
+        else if (_write(fileno(m_fp.get()), data, size) < 0)
             win32::throw_error("write failed", _doserrno);
     }
 };
@@ -1,7 +1,21 @@
 #include <cstdio>
 #include <cstdarg>
 #include <vector>
+#include <emmintrin.h>
 #include "util.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#ifndef PROCESS_MODE_BACKGROUND_BEGIN  /* not in XP targeting SDK */
+#define PROCESS_MODE_BACKGROUND_BEGIN 0x00100000
+#endif
+#include "win32util.h"
+#elif defined(__linux__)
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
 
 namespace util {
     void bswap16buffer(uint16_t *bp, size_t size)
@@ -132,6 +146,105 @@ namespace util {
             data[i] ^= 0x80000000U;
     }
 
+    template <unsigned W, bool BE, bool U>
+    void unpackPCM(const void *input, uint32_t *output, size_t count)
+    {
+        const uint8_t *src = static_cast<const uint8_t*>(input);
+        for (size_t i = 0; i < count; ++i, src += W) {
+            uint32_t v = 0;
+            /* j-th byte from the most significant one */
+            for (unsigned j = 0; j < W; ++j)
+                v |= static_cast<uint32_t>(src[BE ? j : W - 1 - j])
+                        << (24 - 8 * j);
+            output[i] = U ? v ^ 0x80000000U : v;
+        }
+    }
+
+    /*
+     * 16 samples at a time by SSE2, the rest by the generic one.
+     * get_pcm_unpacker() picks this only when has_sse2().
+     */
+    template <bool U>
+    void unpackPCM8(const void *input, uint32_t *output, size_t count)
+    {
+        const uint8_t *src = static_cast<const uint8_t*>(input);
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i sign = _mm_set1_epi8(U ? -0x80 : 0);
+        size_t n = count & ~15;
+        for (size_t i = 0; i < n; i += 16) {
+            __m128i v = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(src + i));
+            v = _mm_xor_si128(v, sign);
+            __m128i lo = _mm_unpacklo_epi8(zero, v);
+            __m128i hi = _mm_unpackhi_epi8(zero, v);
+            __m128i *dst = reinterpret_cast<__m128i*>(output + i);
+            _mm_storeu_si128(dst,     _mm_unpacklo_epi16(zero, lo));
+            _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(zero, lo));
+            _mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(zero, hi));
+            _mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(zero, hi));
+        }
+        unpackPCM<1, false, U>(src + n, output + n, count - n);
+    }
+
+    /* Same as above, 8 samples at a time */
+    template <bool BE, bool U>
+    void unpackPCM16(const void *input, uint32_t *output, size_t count)
+    {
+        const uint8_t *src = static_cast<const uint8_t*>(input);
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i sign = _mm_set1_epi16(U ? -0x8000 : 0);
+        size_t n = count & ~7;
+        for (size_t i = 0; i < n; i += 8) {
+            __m128i v = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(src + i * 2));
+            if (BE)
+                v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            v = _mm_xor_si128(v, sign);
+            __m128i *dst = reinterpret_cast<__m128i*>(output + i);
+            _mm_storeu_si128(dst,     _mm_unpacklo_epi16(zero, v));
+            _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(zero, v));
+        }
+        unpackPCM<2, BE, U>(src + n * 2, output + n, count - n);
+    }
+
+    pcm_unpacker_t get_pcm_unpacker(unsigned width, bool big_endian,
+                                    bool is_unsigned)
+    {
+        static const pcm_unpacker_t table[4][2][2] = {
+            {
+                { unpackPCM8<false>, unpackPCM8<true> },
+                { unpackPCM8<false>, unpackPCM8<true> }
+            },
+            {
+                { unpackPCM16<false, false>, unpackPCM16<false, true> },
+                { unpackPCM16<true, false>,  unpackPCM16<true, true> }
+            },
+            {
+                { unpackPCM<3, false, false>, unpackPCM<3, false, true> },
+                { unpackPCM<3, true, false>,  unpackPCM<3, true, true> }
+            },
+            {
+                { unpackPCM<4, false, false>, unpackPCM<4, false, true> },
+                { unpackPCM<4, true, false>,  unpackPCM<4, true, true> }
+            },
+        };
+        static const pcm_unpacker_t generic[2][2][2] = {
+            {
+                { unpackPCM<1, false, false>, unpackPCM<1, false, true> },
+                { unpackPCM<1, false, false>, unpackPCM<1, false, true> }
+            },
+            {
+                { unpackPCM<2, false, false>, unpackPCM<2, false, true> },
+                { unpackPCM<2, true, false>,  unpackPCM<2, true, true> }
+            },
+        };
+        if (width < 1 || width > 4)
+            throw std::runtime_error("util::get_pcm_unpacker(): BUG");
+        if (width <= 2 && !has_sse2())
+            return generic[width - 1][big_endian][is_unsigned];
+        return table[width - 1][big_endian][is_unsigned];
+    }
+
     ssize_t nread(int fd, void *buffer, size_t size)
     {
         char *bp = static_cast<char*>(buffer);
@@ -147,6 +260,228 @@ namespace util {
         return total > 0 ? total : n;
     }
 
+#ifdef _WIN32
+    namespace {
+        const size_t kPoolMaxBytes = 64 << 20;
+
+        void unmap_mirror(char *base, size_t size, void *handle)
+        {
+            UnmapViewOfFile(base + size);
+            UnmapViewOfFile(base);
+            CloseHandle(static_cast<HANDLE>(handle));
+        }
+
+        struct MirrorRegion {
+            char *base;
+            size_t size;
+            void *handle;
+        };
+
+        struct BufferCache {
+            CRITICAL_SECTION cs;
+            std::vector<std::vector<uint8_t> > buffers;
+            std::vector<MirrorRegion> mirrors;
+            size_t bytes;
+
+            BufferCache(): bytes(0)
+            {
+                InitializeCriticalSection(&cs);
+                buffers.reserve(64);
+            }
+        };
+        /*
+         * Never deleted, since buffers owned by static objects can be
+         * given back during static destruction.
+         */
+        BufferCache *buffer_cache = new BufferCache();
+    }
+
+    void BufferPool::take(std::vector<uint8_t> *v)
+    {
+        win32::CriticalSectionLock lock(&buffer_cache->cs);
+        std::vector<std::vector<uint8_t> > &cache = buffer_cache->buffers;
+        if (cache.empty())
+            return;
+        size_t best = 0;
+        for (size_t i = 1; i < cache.size(); ++i)
+            if (cache[i].capacity() > cache[best].capacity())
+                best = i;
+        buffer_cache->bytes -= cache[best].capacity();
+        v->clear();
+        v->swap(cache[best]);
+        cache[best].swap(cache.back());
+        cache.pop_back();
+    }
+
+    void BufferPool::give(std::vector<uint8_t> *v)
+    {
+        size_t size = v->capacity();
+        if (!size)
+            return;
+        v->clear();
+        win32::CriticalSectionLock lock(&buffer_cache->cs);
+        if (buffer_cache->bytes + size > kPoolMaxBytes)
+            return;
+        buffer_cache->buffers.push_back(std::vector<uint8_t>());
+        buffer_cache->buffers.back().swap(*v);
+        buffer_cache->bytes += size;
+    }
+
+    bool BufferPool::take_mirror(size_t size, char **base, size_t *actual,
+                                 void **handle)
+    {
+        win32::CriticalSectionLock lock(&buffer_cache->cs);
+        std::vector<MirrorRegion> &cache = buffer_cache->mirrors;
+        size_t best = cache.size();
+        for (size_t i = 0; i < cache.size(); ++i)
+            if (cache[i].size >= size &&
+                (best == cache.size() || cache[i].size < cache[best].size))
+                best = i;
+        if (best == cache.size())
+            return false;
+        *base = cache[best].base;
+        *actual = cache[best].size;
+        *handle = cache[best].handle;
+        buffer_cache->bytes -= cache[best].size;
+        cache[best] = cache.back();
+        cache.pop_back();
+        return true;
+    }
+
+    bool BufferPool::give_mirror(char *base, size_t size, void *handle)
+    {
+        win32::CriticalSectionLock lock(&buffer_cache->cs);
+        if (buffer_cache->bytes + size > kPoolMaxBytes)
+            return false;
+        MirrorRegion region = { base, size, handle };
+        buffer_cache->mirrors.push_back(region);
+        buffer_cache->bytes += size;
+        return true;
+    }
+
+    size_t MirroredMemory::granularity()
+    {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        return si.dwAllocationGranularity;
+    }
+
+    bool MirroredMemory::allocate(size_t size)
+    {
+        release();
+        size_t unit = granularity();
+        size = (size + unit - 1) / unit * unit;
+        if (BufferPool::take_mirror(size, &m_base, &m_size, &m_handle))
+            return true;
+        uint64_t size64 = size;
+        HANDLE hMap = CreateFileMappingW(INVALID_HANDLE_VALUE, 0,
+                                         PAGE_READWRITE,
+                                         static_cast<DWORD>(size64 >> 32),
+                                         static_cast<DWORD>(size64), 0);
+        if (!hMap)
+            return false;
+        /*
+         * There's no way to atomically reserve an address range and map
+         * views into it, therefore someone might steal the range between
+         * VirtualFree() and MapViewOfFileEx(). Just retry in that case.
+         */
+        for (int retry = 0; retry < 16; ++retry) {
+            char *base = static_cast<char*>(VirtualAlloc(0, size * 2,
+                                                         MEM_RESERVE,
+                                                         PAGE_NOACCESS));
+            if (!base)
+                break;
+            VirtualFree(base, 0, MEM_RELEASE);
+            void *lo = MapViewOfFileEx(hMap, FILE_MAP_ALL_ACCESS,
+                                       0, 0, size, base);
+            void *hi = lo ? MapViewOfFileEx(hMap, FILE_MAP_ALL_ACCESS,
+                                            0, 0, size, base + size)
+                          : 0;
+            if (lo == base && hi == base + size) {
+                m_base = base;
+                m_size = size;
+                m_handle = hMap;
+                return true;
+            }
+            if (hi) UnmapViewOfFile(hi);
+            if (lo) UnmapViewOfFile(lo);
+        }
+        CloseHandle(hMap);
+        return false;
+    }
+
+    void MirroredMemory::release()
+    {
+        if (m_base && !BufferPool::give_mirror(m_base, m_size, m_handle))
+            unmap_mirror(m_base, m_size, m_handle);
+        m_base = 0;
+        m_size = 0;
+        m_handle = 0;
+    }
+#elif defined(__linux__) && defined(SYS_memfd_create)
+    size_t MirroredMemory::granularity()
+    {
+        return sysconf(_SC_PAGESIZE);
+    }
+
+    bool MirroredMemory::allocate(size_t size)
+    {
+        release();
+        size_t unit = granularity();
+        size = (size + unit - 1) / unit * unit;
+        int fd = syscall(SYS_memfd_create, "util::FIFO", 0);
+        if (fd < 0)
+            return false;
+        if (ftruncate(fd, size) < 0) {
+            close(fd);
+            return false;
+        }
+        void *vp = mmap(0, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1, 0);
+        if (vp == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        char *base = static_cast<char*>(vp);
+        /* MAP_FIXED replaces the reservation above, so this can't race */
+        if (mmap(base, size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+         || mmap(base + size, size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+        {
+            munmap(base, size * 2);
+            close(fd);
+            return false;
+        }
+        close(fd);
+        m_base = base;
+        m_size = size;
+        return true;
+    }
+
+    void MirroredMemory::release()
+    {
+        if (m_base)
+            munmap(m_base, m_size * 2);
+        m_base = 0;
+        m_size = 0;
+    }
+#else
+    size_t MirroredMemory::granularity() { return 4096; }
+    bool MirroredMemory::allocate(size_t size) { return false; }
+    void MirroredMemory::release() {}
+#endif
+
+#ifndef _WIN32
+    void BufferPool::take(std::vector<uint8_t> *) {}
+    void BufferPool::give(std::vector<uint8_t> *) {}
+    bool BufferPool::take_mirror(size_t, char **, size_t *, void **)
+    {
+        return false;
+    }
+    bool BufferPool::give_mirror(char *, size_t, void *) { return false; }
+#endif
+
     bool parse_timespec(const wchar_t *spec, double sample_rate,
                         int64_t *result)
     {
@@ -174,4 +509,84 @@ namespace util {
         *result = sign * static_cast<int64_t>(sample_rate * ss + .5);
         return true;
     }
+
+#ifdef _WIN32
+    /*
+     * Functions and flags below are Vista+ (GetLogicalProcessorInformation
+     * is XP SP3+), and must not be linked statically so that we still run
+     * on XP. They are looked up at runtime, and we fail softly without
+     * them.
+     */
+    static bool is_vista_or_later()
+    {
+        OSVERSIONINFOEXW vi = { sizeof(vi) };
+        vi.dwMajorVersion = 6;
+        DWORDLONG cond = VerSetConditionMask(0, VER_MAJORVERSION,
+                                             VER_GREATER_EQUAL);
+        return VerifyVersionInfoW(&vi, VER_MAJORVERSION, cond) != 0;
+    }
+
+    bool set_cpu_affinity(const std::vector<int> &cpus)
+    {
+        DWORD_PTR mask = 0;
+        if (cpus.size()) {
+            for (size_t i = 0; i < cpus.size(); ++i) {
+                if (static_cast<size_t>(cpus[i]) >= sizeof(DWORD_PTR) * 8)
+                    return false;
+                mask |= static_cast<DWORD_PTR>(1) << cpus[i];
+            }
+        } else {
+            typedef BOOL (WINAPI *GLPI)(PSYSTEM_LOGICAL_PROCESSOR_INFORMATION,
+                                        PDWORD);
+            typedef DWORD (WINAPI *GCPN)(void);
+            HMODULE kernel32 = GetModuleHandleW(L"kernel32.dll");
+            GLPI get_info = reinterpret_cast<GLPI>(
+                GetProcAddress(kernel32, "GetLogicalProcessorInformation"));
+            GCPN get_cpu = reinterpret_cast<GCPN>(
+                GetProcAddress(kernel32, "GetCurrentProcessorNumber"));
+            if (!get_info || !get_cpu)
+                return false;
+            DWORD size = 0;
+            get_info(0, &size);
+            std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION>
+                info(size / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+            if (info.empty() || !get_info(&info[0], &size))
+                return false;
+            DWORD_PTR self = static_cast<DWORD_PTR>(1) << get_cpu();
+            unsigned level = 0;
+            for (size_t i = 0; i < info.size(); ++i) {
+                if (info[i].Relationship == RelationCache &&
+                    (info[i].ProcessorMask & self) &&
+                    info[i].Cache.Level > level)
+                {
+                    level = info[i].Cache.Level;
+                    mask = info[i].ProcessorMask;
+                }
+            }
+        }
+        return mask && SetProcessAffinityMask(GetCurrentProcess(), mask);
+    }
+
+    bool lower_io_priority()
+    {
+        if (!is_vista_or_later())
+            return false;
+        /* Windows has no I/O only knob; this lowers CPU priority, too */
+        return SetPriorityClass(GetCurrentProcess(),
+                                PROCESS_MODE_BACKGROUND_BEGIN) != 0;
+    }
+
+    bool has_sse2()
+    {
+#ifdef _M_X64
+        return true;
+#else
+        return !!IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE);
+#endif
+    }
+#else
+    bool set_cpu_affinity(const std::vector<int> &) { return false; }
+    bool lower_io_priority() { return false; }
+    bool has_sse2() { return false; }
+#endif
 }
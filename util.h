@@ -5,6 +5,7 @@
 #include <cstring>
 #include <cwchar>
 #include <string>
+#include <vector>
 #include <sstream>
 #include <algorithm>
 #include <iterator>
@@ -48,28 +49,81 @@ namespace util {
     template <typename T, size_t size>
     inline size_t sizeof_array(const T (&)[size]) { return size; }
 
+    /*
+     * Virtual memory region of size() bytes that is mapped twice in a row,
+     * so that data()[i] and data()[i + size()] refer to the same byte.
+     * allocate() returns false when the platform doesn't support it.
+     */
+    class MirroredMemory {
+        char *m_base;
+        size_t m_size;
+        void *m_handle;
+    public:
+        MirroredMemory(): m_base(0), m_size(0), m_handle(0) {}
+        ~MirroredMemory() { release(); }
+        bool allocate(size_t size);
+        void release();
+        void swap(MirroredMemory &other)
+        {
+            std::swap(m_base, other.m_base);
+            std::swap(m_size, other.m_size);
+            std::swap(m_handle, other.m_handle);
+        }
+        char *data() const { return m_base; }
+        size_t size() const { return m_size; }
+        static size_t granularity();
+    private:
+        MirroredMemory(const MirroredMemory&);
+        MirroredMemory& operator=(const MirroredMemory&);
+    };
+
+    /*
+     * Ring buffer on top of MirroredMemory. Both the readable and writable
+     * region are always contiguous, therefore reserve() never has to
+     * compact the buffer with memmove().
+     * When mirroring is not available, falls back to std::vector.
+     */
     template <typename T> class FIFO {
+        MirroredMemory m_mirror;
         std::vector<T> m_data;
-        size_t m_unit, m_begin, m_end;
+        T *m_ptr;
+        size_t m_capacity, m_unit, m_begin, m_end;
+        bool m_mirrored;
     public:
-        FIFO(): m_data(256), m_unit(1), m_begin(0), m_end(0) {}
+        FIFO(): m_ptr(0), m_capacity(0), m_unit(1), m_begin(0), m_end(0),
+                m_mirrored(true)
+        {}
         void set_unit(size_t n) { m_unit = n; }
         void reset() { m_begin = m_end = 0; }
         size_t count() { return (m_end - m_begin) / m_unit; }
-        T *read_ptr() { return &m_data[m_begin]; }
-        void advance(size_t n) { m_begin += n * m_unit; }
+        T *read_ptr() { return m_ptr + m_begin; }
+        void advance(size_t n)
+        {
+            m_begin += n * m_unit;
+            if (m_mirrored && m_begin >= m_capacity) {
+                m_begin -= m_capacity;
+                m_end -= m_capacity;
+            }
+        }
         T *read(size_t n)
         {
             T *begin = read_ptr();
             advance(n);
             return begin;
         }
-        T *write_ptr() { return &m_data[m_end]; }
+        T *write_ptr() { return m_ptr + m_end; }
         void commit(size_t n) { m_end += n * m_unit; }
         void reserve(size_t n)
         {
             if (m_begin == m_end)
                 reset();
+            size_t need = m_end - m_begin + n * m_unit;
+            if (m_mirrored) {
+                if (need > m_capacity)
+                    grow_mirror(need);
+                if (m_mirrored)
+                    return;
+            }
             if (m_begin > 0) {
                 std::memmove(&m_data[0], read_ptr(),
                              sizeof(T) * (m_end - m_begin));
@@ -78,8 +132,78 @@ namespace util {
             }
             if (m_end + n * m_unit > m_data.size()) {
                 m_data.resize(m_end + n * m_unit);
+                m_ptr = &m_data[0];
             }
         }
+    private:
+        FIFO(const FIFO&);
+        FIFO& operator=(const FIFO&);
+
+        void grow_mirror(size_t need)
+        {
+            size_t used = m_end - m_begin;
+            size_t size = std::max(need, m_capacity * 2) * sizeof(T);
+            MirroredMemory mirror;
+            if (!mirror.allocate(size)) {
+                /* fall back to plain vector for the rest of our life */
+                m_data.resize(std::max(need, static_cast<size_t>(256)));
+                if (used)
+                    std::memcpy(&m_data[0], read_ptr(), sizeof(T) * used);
+                m_mirror.release();
+                m_ptr = &m_data[0];
+                m_begin = 0;
+                m_end = used;
+                m_capacity = 0;
+                m_mirrored = false;
+                return;
+            }
+            T *ptr = reinterpret_cast<T*>(mirror.data());
+            if (used)
+                std::memcpy(ptr, read_ptr(), sizeof(T) * used);
+            m_mirror.swap(mirror);
+            m_ptr = ptr;
+            m_capacity = m_mirror.size() / sizeof(T);
+            m_begin = 0;
+            m_end = used;
+        }
+    };
+
+    /*
+     * Process wide cache of released sample buffers and MirroredMemory
+     * regions. With --workers, every worker process has a pool of its own.
+     * Jobs run one after another there, so the buffers of a finished job
+     * are handed out to the next one, instead of being freed and then
+     * allocated (and page faulted) again for every file.
+     * At most 64MiB is kept; anything beyond that is freed as usual.
+     */
+    class BufferPool {
+    public:
+        /* swaps in the largest cached vector, if any */
+        static void take(std::vector<uint8_t> *v);
+        /* takes over the storage of v, leaving it empty */
+        static void give(std::vector<uint8_t> *v);
+        /* cached region of at least size bytes */
+        static bool take_mirror(size_t size, char **base, size_t *actual,
+                                void **handle);
+        static bool give_mirror(char *base, size_t size, void *handle);
+    };
+
+    /*
+     * std::vector<uint8_t> whose storage is taken from BufferPool, and
+     * given back to it on destruction.
+     */
+    class PooledBuffer: public std::vector<uint8_t> {
+    public:
+        PooledBuffer() { BufferPool::take(this); }
+        explicit PooledBuffer(size_t n)
+        {
+            BufferPool::take(this);
+            resize(n);
+        }
+        ~PooledBuffer() { BufferPool::give(this); }
+    private:
+        PooledBuffer(const PooledBuffer&);
+        PooledBuffer& operator=(const PooledBuffer&);
     };
 
     struct fourcc {
@@ -204,6 +328,18 @@ namespace util {
 
     void convert_sign(uint32_t *data, size_t size);
 
+    /*
+     * Converts count samples of integer PCM, 1 to 4 bytes wide, into
+     * 32bit signed, left aligned.
+     * Byte swapping and sign conversion are done in the same pass, instead
+     * of bswapbuffer() + unpack() + convert_sign() walking the block three
+     * times. Pick one per source when the format is known.
+     */
+    typedef void (*pcm_unpacker_t)(const void *input, uint32_t *output,
+                                   size_t count);
+    pcm_unpacker_t get_pcm_unpacker(unsigned width, bool big_endian,
+                                    bool is_unsigned);
+
     ssize_t nread(int fd, void *buffer, size_t size);
 
     inline double dB_to_scale(double dB)
@@ -237,6 +373,25 @@ namespace util {
         return h ? strutil::format(L"%d:%02d:%02d.%03d", h, m, s, millis)
                  : strutil::format(L"%d:%02d.%03d", m, s, millis);
     }
+
+    /*
+     * Restrict the process to the given processors. Threads started
+     * afterwards (reader, decoder workers) are kept on the same set.
+     * Empty set means the processors sharing the last level cache with
+     * the one we are running on.
+     * Returns false when not supported or failed.
+     */
+    bool set_cpu_affinity(const std::vector<int> &cpus);
+
+    /* Returns false when not supported or failed. */
+    bool lower_io_priority();
+
+    /*
+     * Whether SSE2 is available. 32bit builds target plain IA32, therefore
+     * SSE2 code paths must be chosen at runtime by this, with a scalar
+     * fallback. Always true on x64.
+     */
+    bool has_sse2();
 }
 
 #define CHECKCRT(expr) \
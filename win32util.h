@@ -35,6 +35,18 @@ namespace win32 {
         }
     };
 
+    struct CriticalSectionLock {
+        CRITICAL_SECTION *m_cs;
+        CriticalSectionLock(CRITICAL_SECTION *cs): m_cs(cs)
+        {
+            EnterCriticalSection(m_cs);
+        }
+        ~CriticalSectionLock()
+        {
+            LeaveCriticalSection(m_cs);
+        }
+    };
+
     void throw_error(const std::wstring& msg, DWORD error);
 
     inline void throw_error(const std::string& msg, DWORD error)